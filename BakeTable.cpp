@@ -0,0 +1,71 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Tool for baking the inverse area tables (see 'PSCMapsBaked.h')
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <PSCMapsBaked.h> // baked tables
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// usage: bake_exe file [num_alpha num_b num_u]
+
+int main( int argc, char *argv[] )
+{
+   if ( argc != 2 && argc != 5 )
+   {
+      cerr << "usage: " << argv[0] << " file [num_alpha num_b num_u]" << endl
+           << "   (defaults: " << baked_ini_num_alpha << " " << baked_ini_num_b << " "
+           << baked_ini_num_u << ", 'num_b' must be odd)" << endl ;
+      return 1 ;
+   }
+
+   const string   file_name = argv[1] ;
+   const uint32_t num_alpha = ( argc == 5 ) ? uint32_t( atoi( argv[2] ) ) : baked_ini_num_alpha ,
+                  num_b     = ( argc == 5 ) ? uint32_t( atoi( argv[3] ) ) : baked_ini_num_b ,
+                  num_u     = ( argc == 5 ) ? uint32_t( atoi( argv[4] ) ) : baked_ini_num_u ;
+
+   if ( num_alpha < 2 || num_b < 3 || num_b % 2 != 1 || num_u < 2 )
+   {
+      cerr << "wrong table sizes: " << num_alpha << " " << num_b << " " << num_u << endl ;
+      return 1 ;
+   }
+
+   cout << "baking table (version " << baked_table_version << ", " << num_alpha << " x "
+        << num_b << " x " << num_u << ") to '" << file_name << "' ..." << endl ;
+
+   if ( ! BakedInverseTable::bake( file_name, num_alpha, num_b, num_u ) )
+   {
+      cerr << "cannot write file '" << file_name << "'" << endl ;
+      return 1 ;
+   }
+
+   // check the file can be loaded
+   BakedInverseTable table ;
+   if ( ! table.load( file_name ) )
+   {
+      cerr << "cannot load the baked table: " << table.get_error() << endl ;
+      return 1 ;
+   }
+   cout << "done (" << table.get_header().file_size << " bytes)." << endl ;
+   return 0 ;
+}
@@ -0,0 +1,1134 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Headless benchmarks
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+
+#include <PSCMaps.h>          // maps implementation
+#include <PSCMapsTabulated.h> // maps with a fitted inverse
+#include <PSCMapsBaked.h>     // maps with a baked inverse table
+#include <PSCMapsCache.h>     // cache of initialized maps
+#include <PSCMapsSoA.h>       // state of many caps, column-wise
+#include <PSCMapsMixed.h>     // mixed precision maps
+#include <PSCFastMath.h>      // polynomial approximations (math policies)
+#include <PSCMapsEngine.h>    // multithreaded evaluation of many caps
+#include <PSCSequences.h>     // (s,t) sequences
+#include <Bench.h>            // timing and cases, shared by the benchmark units
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// the geometric cases, and the accumulator for results (see 'Bench.h')
+
+const BenchCase bench_cases[num_bench_cases] =
+{
+   { "ellipse only", 0.4,  0.8 },
+   { "ellipse+lune", 0.6,  0.2 },
+   { "lune only",    0.6, -0.3 }
+} ;
+
+double sink = 0.0 ;
+
+// --------------------------------------------------------------------------
+// compares 'eval_map' in a loop against 'eval_map_batch', for one cap
+
+template< class T >
+void BenchEvalMap( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   // generate (s,t) samples in SoA form
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool );
+
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   const double scalar_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         pscm.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double batch_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << scalar_sps*1e-6
+        << setw(12) << batch_sps*1e-6
+        << setw(9)  << batch_sps/scalar_sps << "x" << endl ;
+}
+// --------------------------------------------------------------------------
+// measures the cost of one inversion (in nanoseconds), by using 'InverseNSB'
+// with step rule 'Step' and callables 'F' and 'f', for all the targets in
+// 'targets', and prints it along with the max. residual |F(t)-A|
+
+template< class T, class Step, class FuncF, class Funcf >
+void BenchInverseNSB( const char * descr, const FuncF & F, const Funcf & f,
+                      const T t_max, const vector<T> & targets )
+{
+   vector<T> results( targets.size() );
+
+   const double ips = SamplesPerSecond( targets.size(), [&]()
+   {
+      for( size_t i = 0 ; i < targets.size() ; i++ )
+         results[i] = InverseNSB<T,Step>( F, f, t_max, targets[i], T(1.0) );
+      sink += results[0] ;
+   });
+
+   double max_res = 0.0 ;
+   for( size_t i = 0 ; i < targets.size() ; i++ )
+      max_res = std::max( max_res, double( std::abs( F( results[i] ) - targets[i] ) ) );
+
+   cout << "   " << setw(32) << left << descr << right << fixed << setprecision(1)
+        << setw(10) << 1e9/ips << scientific << setprecision(2) << setw(14) << max_res
+        << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// same as 'BenchInverseNSB' (hybrid steps), but using 'InverseNSB_fused' with
+// 'eval_Ap_with_integrand' (Ap and its derivative evaluated together)
+
+template< class T, class FuncF >
+void BenchInverseNSBFused( const char * descr, const PSCMaps<T> & pscm, const FuncF & F,
+                           const T t_max, const vector<T> & targets )
+{
+   const T Ap_max = T(0.5)*pscm.get_area();
+   auto    Ap_fd  = [&]( T y )
+   {
+      const ValDer<T> Ff = pscm.eval_Ap_with_integrand( y );
+      return ValDer<T>{ Ff.value/Ap_max, Ff.der/Ap_max } ;
+   } ;
+   vector<T> results( targets.size() );
+
+   const double ips = SamplesPerSecond( targets.size(), [&]()
+   {
+      for( size_t i = 0 ; i < targets.size() ; i++ )
+         results[i] = InverseNSB_fused<T>( Ap_fd, t_max, targets[i], T(1.0) );
+      sink += results[0] ;
+   });
+
+   double max_res = 0.0 ;
+   for( size_t i = 0 ; i < targets.size() ; i++ )
+      max_res = std::max( max_res, double( std::abs( F( results[i] ) - targets[i] ) ) );
+
+   cout << "   " << setw(32) << left << descr << right << fixed << setprecision(1)
+        << setw(10) << 1e9/ips << scientific << setprecision(2) << setw(14) << max_res
+        << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// inversion of the parallel map area Ap (ellipse+lune case), with
+// type-erased callables (std::function) and with inlined callables (lambdas)
+
+template< class T >
+void BenchInversion( const char * type_name )
+{
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(0.6), T(0.2), false );
+
+   const T Ap_max = T(0.5)*pscm.get_area(),
+           y_max  = pscm.get_ay();
+
+   auto Ap_func      = [&]( T y ) { return pscm.eval_Ap( y )/Ap_max ; } ;
+   auto Ap_integrand = [&]( T y ) { return pscm.eval_par_integrand( y )/Ap_max ; } ;
+
+   const FuncType<T> Ap_func_erased( Ap_func ),
+                     Ap_integrand_erased( Ap_integrand );
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<T> dist( T(0.0), T(1.0) );
+   vector<T> targets( 4096 );
+   for( T & a : targets )
+      a = dist( gen );
+
+   cout << endl << "InverseNSB (" << type_name << "): nanosecs. per inversion and max. residual" << endl ;
+   BenchInverseNSB<T,StepHybrid>   ( "hybrid,    std::function", Ap_func_erased, Ap_integrand_erased, y_max, targets );
+   BenchInverseNSB<T,StepHybrid>   ( "hybrid,    inlined",       Ap_func, Ap_integrand, y_max, targets );
+   BenchInverseNSBFused<T>         ( "hybrid,    fused",         pscm, Ap_func, y_max, targets );
+   BenchInverseNSB<T,StepNewton>   ( "newton,    inlined",       Ap_func, Ap_integrand, y_max, targets );
+   BenchInverseNSB<T,StepSecant>   ( "secant,    inlined",       Ap_func, Ap_integrand, y_max, targets );
+   BenchInverseNSB<T,StepBisection>( "bisection, inlined",       Ap_func, Ap_integrand, y_max, targets );
+}
+// --------------------------------------------------------------------------
+// compares 'PSCMaps::eval_map' (iterative inversion) against
+// 'PSCMapsTabulated::eval_map' (fitted inverse), and reports the time needed
+// to build the fit, along with the number of samples needed to amortize it
+
+template< class T >
+void BenchTabulated( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool );
+
+   PSCMapsTabulated<T> tab ;
+   const double build_per_sec = SamplesPerSecond( 1, [&]()
+   {
+      tab.initialize( T(bc.alpha), T(bc.beta), use_radial, 0 );
+   });
+   if ( ! tab.is_tabulated() )
+   {
+      // no iterations are needed, or the fit does not meet the tolerance
+      if ( 0 < tab.get_max_error() )
+         cout << "   " << setw(13) << left << bc.name
+              << setw(9)  << (use_radial ? "radial" : "parallel")
+              << setw(7)  << type_name << "(not tabulated, error "
+              << scientific << setprecision(1) << double( tab.get_max_error() ) << ")"
+              << defaultfloat << right << endl ;
+      return ;
+   }
+
+   const PSCMaps<T> & pscm = tab.get_maps();
+
+   const double iter_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         pscm.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double tab_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         tab.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double break_even = (1.0/build_per_sec)/( 1.0/iter_sps - 1.0/tab_sps );
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << iter_sps*1e-6
+        << setw(12) << tab_sps*1e-6
+        << setw(9)  << tab_sps/iter_sps << "x"
+        << setw(7)  << tab.get_num_nodes()
+        << setw(10) << 1e6/build_per_sec
+        << setw(9)  << setprecision(0) << break_even
+        << scientific << setprecision(1) << setw(10) << double( tab.get_max_error() )
+        << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares 'PSCMaps::eval_map' (iterative inversion) against
+// 'PSCMapsBaked::eval_map' (baked table lookup and a Newton step)
+
+template< class T >
+void BenchBaked( const BenchCase & bc, const bool use_radial, const char * type_name,
+                 const BakedInverseTable & table )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool );
+
+   PSCMapsBaked<T> baked ;
+   baked.initialize( T(bc.alpha), T(bc.beta), use_radial, &table );
+   if ( ! baked.is_using_table() )
+      return ;
+
+   const PSCMaps<T> & pscm = baked.get_maps();
+
+   const double iter_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         pscm.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double baked_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         baked.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << iter_sps*1e-6
+        << setw(12) << baked_sps*1e-6
+        << setw(9)  << baked_sps/iter_sps << "x" << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares 'PSCMaps::initialize' against 'PSCMapsCache::get', for the caps
+// seen from a grid of shading points on a plane (in scanline order), under a
+// spherical light. Reports the hit rate, and the max. error in the map
+// position (for a few samples) due to the quantization of the angles
+
+template< class T >
+void BenchCache( const T max_angle_error, const char * type_name )
+{
+   // light center (0,0,0.1), radius 0.3, shading points in [-2,2]^2 (normal: Z axis)
+   // (the caps are partially visible, except near the light)
+   constexpr int    grid_size = 128 ;
+   constexpr double height    = 0.1 ,
+                    radius    = 0.3 ;
+
+   vector<T> alpha, beta ;
+   for( int i = 0 ; i < grid_size ; i++ )
+   for( int j = 0 ; j < grid_size ; j++ )
+   {
+      const double px   = -2.0 + 4.0*(double(j)+0.5)/double(grid_size),
+                   py   = -2.0 + 4.0*(double(i)+0.5)/double(grid_size),
+                   dist = std::max( 1.01*radius, std::sqrt( px*px + py*py + height*height ) );
+      alpha.push_back( T( std::asin( radius/dist ) ));
+      beta.push_back( T( std::asin( height/dist ) ));
+   }
+   const size_t num_caps = alpha.size() ;
+
+   PSCMaps<T> pscm ;
+   const double init_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      for( size_t i = 0 ; i < num_caps ; i++ )
+      {
+         pscm.initialize( alpha[i], beta[i], true );
+         sink += pscm.get_area();
+      }
+   });
+
+   PSCMapsCache<T> cache( cache_ini_capacity, max_angle_error );
+   const double cache_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      for( size_t i = 0 ; i < num_caps ; i++ )
+         sink += cache.get( alpha[i], beta[i], true ).get_area();
+   });
+
+   // hit rate in a single pass (from an empty cache), and max. error in the map position
+   double max_error = 0.0 ;
+   cache.clear();
+   cache.reset_counters();
+   for( size_t i = 0 ; i < num_caps ; i++ )
+   {
+      pscm.initialize( alpha[i], beta[i], true );
+      const PSCMaps<T> & cached = cache.get( alpha[i], beta[i], true );
+      for( const T st : { T(0.1), T(0.5), T(0.9) } )
+      {
+         T x0, y0, x1, y1 ;
+         pscm.eval_map( st, T(1.0)-st, x0, y0 );
+         cached.eval_map( st, T(1.0)-st, x1, y1 );
+         max_error = std::max( max_error, double( std::max( std::abs( x1-x0 ), std::abs( y1-y0 ) ) ));
+      }
+   }
+   const double hit_rate = double( cache.get_num_hits() )/double( cache.get_num_hits() + cache.get_num_misses() );
+
+   cout << "   " << setw(7) << left << type_name << right << scientific << setprecision(0)
+        << setw(10) << double( max_angle_error ) << fixed << setprecision(2)
+        << setw(12) << init_cps*1e-6
+        << setw(12) << cache_cps*1e-6
+        << setw(9)  << cache_cps/init_cps << "x"
+        << setw(9)  << setprecision(1) << 100.0*hit_rate << "%"
+        << scientific << setprecision(1) << setw(11) << max_error << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares an array of maps objects against 'PSCMapsSoA', for many caps (lights)
+// with random angles: sum of the areas of all caps (as done to select a light),
+// and 'eval_map' for a few samples of each cap
+
+template< class T >
+void BenchSoA( const char * type_name )
+{
+   constexpr size_t num_caps        = 4096 ,
+                    samples_per_cap = 4 ,
+                    num_samples     = num_caps*samples_per_cap ;
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<T> dist( T(0.0), T(1.0) );
+   vector<T> alpha( num_caps ), beta( num_caps );
+   for( size_t i = 0 ; i < num_caps ; i++ )
+   {
+      alpha[i] = T(0.05) + T(1.1)*dist( gen );
+      beta[i]  = -alpha[i] + ( T(0.5*M_PI) + alpha[i] )*dist( gen );
+   }
+   const SamplePool<T> pool = MakeSamplePool<T>( num_samples );
+   const vector<T> &   s = pool.s, & t = pool.t ;
+   vector<T>           x( num_samples ), y( num_samples );
+   vector<size_t>      cap( num_samples );
+   for( size_t k = 0 ; k < num_samples ; k++ )
+      cap[k] = k/samples_per_cap ;
+
+   vector< PSCMaps<T> > aos( num_caps );
+   for( size_t i = 0 ; i < num_caps ; i++ )
+      aos[i].initialize( alpha[i], beta[i], true );
+
+   PSCMapsSoA<T> soa ;
+   soa.initialize( alpha.data(), beta.data(), num_caps, true );
+
+   const double aos_aps = SamplesPerSecond( num_caps, [&]()
+   {
+      T sum = T(0.0) ;
+      for( size_t i = 0 ; i < num_caps ; i++ )
+         sum += aos[i].get_area();
+      sink += sum ;
+   });
+
+   const double soa_aps = SamplesPerSecond( num_caps, [&]()
+   {
+      const T * areas = soa.get_areas();
+      T sum = T(0.0) ;
+      for( size_t i = 0 ; i < num_caps ; i++ )
+         sum += areas[i] ;
+      sink += sum ;
+   });
+
+   const double aos_sps = SamplesPerSecond( num_samples, [&]()
+   {
+      for( size_t k = 0 ; k < num_samples ; k += samples_per_cap )
+         aos[cap[k]].eval_map_batch( &s[k], &t[k], &x[k], &y[k], samples_per_cap );
+      sink += x[0] + y[num_samples-1] ;
+   });
+
+   const double soa_sps = SamplesPerSecond( num_samples, [&]()
+   {
+      soa.eval_map( cap.data(), s.data(), t.data(), x.data(), y.data(), num_samples );
+      sink += x[0] + y[num_samples-1] ;
+   });
+
+   cout << "   " << setw(7) << left << type_name << right
+        << setw(7)  << sizeof( PSCMaps<T> ) << fixed << setprecision(2)
+        << setw(12) << aos_aps*1e-6
+        << setw(12) << soa_aps*1e-6
+        << setw(9)  << soa_aps/aos_aps << "x"
+        << setw(12) << aos_sps*1e-6
+        << setw(12) << soa_sps*1e-6
+        << setw(9)  << soa_sps/aos_sps << "x" << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares 'PSCMapsSoA::initialize' (a loop with 'PSCMaps::initialize')
+// against 'PSCMapsSoA::initialize_batch', for caps with random angles
+// (all the cases), and reports the max. difference in the areas
+
+template< class T >
+void BenchSoAInit( const bool use_radial, const char * type_name )
+{
+   constexpr size_t num_caps = 4096 ;
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<T> dist( T(0.0), T(1.0) );
+   vector<T> alpha( num_caps ), beta( num_caps );
+   for( size_t i = 0 ; i < num_caps ; i++ )
+   {
+      alpha[i] = T(0.5*M_PI)*dist( gen );
+      beta[i]  = T(0.5*M_PI)*( T(2.0)*dist( gen ) - T(1.0) );
+   }
+
+   PSCMapsSoA<T> soa, soa_batch ;
+   const double loop_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      soa.initialize( alpha.data(), beta.data(), num_caps, use_radial );
+      sink += soa.get_area( num_caps-1 );
+   });
+   const double batch_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      soa_batch.initialize_batch( alpha.data(), beta.data(), num_caps, use_radial );
+      sink += soa_batch.get_area( num_caps-1 );
+   });
+
+   double max_diff = 0.0 ;
+   for( size_t i = 0 ; i < num_caps ; i++ )
+      max_diff = std::max( max_diff, double( std::abs( soa.get_area( i ) - soa_batch.get_area( i ) )));
+
+   cout << "   " << setw(9) << left << (use_radial ? "radial" : "parallel")
+        << setw(7) << type_name << right << fixed << setprecision(2)
+        << setw(12) << loop_cps*1e-6
+        << setw(12) << batch_cps*1e-6
+        << setw(9)  << batch_cps/loop_cps << "x"
+        << scientific << setprecision(1) << setw(11) << max_diff << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares two ways of initializing the maps from the geometry (sphere center
+// relative to the shading point, radius and normal) for random configurations,
+// both of them including the computation of the local frame:
+// (1) alpha and beta computed with 'asin', and 'initialize', and
+// (2) 'initialize_geometric' (no trigonometric functions).
+// Reports millions of caps/sec. and the max. relative error in the area of both
+// (w.r.t. 'initialize_geometric' in long double, for caps with area above 1e-3)
+
+template< class T >
+void BenchInitGeometric( const bool use_radial, const char * type_name )
+{
+   constexpr size_t num_caps = 4096 ;
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<double> dist( -1.0, 1.0 );
+   vector<T> center( 3*num_caps ), normal( 3*num_caps ), radius( num_caps ),
+             area_asin( num_caps ), area_geom( num_caps );
+   for( size_t i = 0 ; i < num_caps ; i++ )
+   {
+      double n[3] = { dist( gen ), dist( gen ), dist( gen ) },
+             c[3] = { 4.0*dist( gen ), 4.0*dist( gen ), 4.0*dist( gen ) };
+      const double n_len = std::sqrt( n[0]*n[0] + n[1]*n[1] + n[2]*n[2] ),
+                   c_len = std::sqrt( c[0]*c[0] + c[1]*c[1] + c[2]*c[2] );
+      for( int k = 0 ; k < 3 ; k++ )
+      {
+         normal[3*i+k] = T( n[k]/n_len );
+         center[3*i+k] = T( c[k] );
+      }
+      radius[i] = T( c_len*( 0.01 + 0.49*( dist( gen ) + 1.0 ) ) ); // (shading point is outside)
+   }
+
+   PSCMaps<T> pscm ;
+   T          vx[3], vy[3] ;
+
+   const double asin_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      for( size_t i = 0 ; i < num_caps ; i++ )
+      {
+         const T * c   = &center[3*i] ,
+                 * n   = &normal[3*i] ;
+         const T   d   = std::sqrt( c[0]*c[0] + c[1]*c[1] + c[2]*c[2] ),
+                   c_n = c[0]*n[0] + c[1]*n[1] + c[2]*n[2] ;
+         T cp[3] = { c[0]-c_n*n[0], c[1]-c_n*n[1], c[2]-c_n*n[2] } ;
+         const T inv_len = T(1.0)/std::sqrt( cp[0]*cp[0] + cp[1]*cp[1] + cp[2]*cp[2] );
+         for( int k = 0 ; k < 3 ; k++ )
+            vx[k] = cp[k]*inv_len ;
+         vy[0] = n[1]*vx[2] - n[2]*vx[1] ;
+         vy[1] = n[2]*vx[0] - n[0]*vx[2] ;
+         vy[2] = n[0]*vx[1] - n[1]*vx[0] ;
+
+         pscm.initialize( std::asin( radius[i]/d ), std::asin( std::max( T(-1.0), std::min( T(1.0), c_n/d ) ) ),
+                          use_radial );
+         area_asin[i] = pscm.get_area();
+      }
+      sink += area_asin[num_caps-1] + vy[0] ;
+   });
+
+   const double geom_cps = SamplesPerSecond( num_caps, [&]()
+   {
+      for( size_t i = 0 ; i < num_caps ; i++ )
+      {
+         pscm.initialize_geometric( &center[3*i], radius[i], &normal[3*i], use_radial, vx, vy );
+         area_geom[i] = pscm.get_area();
+      }
+      sink += area_geom[num_caps-1] + vy[0] ;
+   });
+
+   double err_asin = 0.0, err_geom = 0.0 ;
+   for( size_t i = 0 ; i < num_caps ; i++ )
+   {
+      const long double c[3] = { center[3*i], center[3*i+1], center[3*i+2] },
+                        n[3] = { normal[3*i], normal[3*i+1], normal[3*i+2] } ;
+      long double        vx_ref[3], vy_ref[3] ;
+      PSCMaps<long double> ref ;
+      ref.initialize_geometric( c, radius[i], n, use_radial, vx_ref, vy_ref );
+      const double area = double( ref.get_area() );
+      if ( area < 1e-3 )
+         continue ;
+      err_asin = std::max( err_asin, std::abs( double( area_asin[i] ) - area )/area );
+      err_geom = std::max( err_geom, std::abs( double( area_geom[i] ) - area )/area );
+   }
+
+   cout << "   " << setw(9) << left << (use_radial ? "radial" : "parallel")
+        << setw(7) << type_name << right << fixed << setprecision(2)
+        << setw(12) << asin_cps*1e-6
+        << setw(12) << geom_cps*1e-6
+        << setw(9)  << geom_cps/asin_cps << "x"
+        << scientific << setprecision(1) << setw(11) << err_asin << setw(11) << err_geom << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares two ways of obtaining unit directions (in world coordinates) and
+// their pdfs, for a cap seen from a shading point with a tilted normal:
+// (1) 'eval_map_batch' and then a loop with x*vx + y*vy + sqrt(1-x^2-y^2)*vz
+//     and cos(theta)/area, and (2) 'eval_directions'.
+// Reports millions of samples/sec. and the max. difference in the directions
+
+template< class T >
+void BenchDirections( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool ),
+             dx( num_samples_pool ), dy( num_samples_pool ), dz( num_samples_pool ),
+             pdf( num_samples_pool ),
+             ex( num_samples_pool ), ey( num_samples_pool ), ez( num_samples_pool ),
+             epdf( num_samples_pool );
+
+   // normal, a unit vector 'u' perpendicular to it, and the sphere (at distance 1)
+   const double n_len = std::sqrt( 0.3*0.3 + 0.5*0.5 + 0.8*0.8 ),
+                n[3]  = { 0.3/n_len, -0.5/n_len, 0.8/n_len },
+                u_len = std::sqrt( n[2]*n[2] + n[1]*n[1] ),
+                u[3]  = { 0.0, n[2]/u_len, -n[1]/u_len } ;
+   T normal[3], center[3], vx[3], vy[3] ;
+   for( int k = 0 ; k < 3 ; k++ )
+   {
+      normal[k] = T( n[k] );
+      center[k] = T( std::cos( bc.beta )*u[k] + std::sin( bc.beta )*n[k] );
+   }
+
+   PSCMaps<T> pscm ;
+   pscm.initialize_geometric( center, T( std::sin( bc.alpha ) ), normal, use_radial, vx, vy );
+   const T inv_area = T(1.0)/pscm.get_area();
+
+   const double loop_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+      {
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+         for( size_t k = i ; k < i+batch_size ; k++ )
+         {
+            const T z = std::sqrt( std::max( T(0.0), T(1.0) - x[k]*x[k] - y[k]*y[k] ) );
+            ex[k]   = x[k]*vx[0] + y[k]*vy[0] + z*normal[0] ;
+            ey[k]   = x[k]*vx[1] + y[k]*vy[1] + z*normal[1] ;
+            ez[k]   = x[k]*vx[2] + y[k]*vy[2] + z*normal[2] ;
+            epdf[k] = z*inv_area ;
+         }
+      }
+      sink += ex[0] + epdf[num_samples_pool-1] ;
+   });
+
+   const double dirs_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_directions( &s[i], &t[i], batch_size, vx, vy, normal,
+                               &dx[i], &dy[i], &dz[i], &pdf[i] );
+      sink += dx[0] + pdf[num_samples_pool-1] ;
+   });
+
+   double max_diff = 0.0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      max_diff = std::max( { max_diff, double( std::abs( dx[i]-ex[i] ) ), double( std::abs( dy[i]-ey[i] ) ),
+                             double( std::abs( dz[i]-ez[i] ) ) } );
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << loop_sps*1e-6
+        << setw(12) << dirs_sps*1e-6
+        << setw(9)  << dirs_sps/loop_sps << "x"
+        << scientific << setprecision(1) << setw(11) << max_diff << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// measures 'inverse_map' and 'contains_and_pdf' for one cap (in millions of
+// samples or directions per sec.), and checks them:
+// (1) the max. difference between (s,t) and the inverse of its image,
+// (2) the fraction of the sampled directions which are found in the cap, and
+// (3) the relative error in the area of the cap estimated with 'contains_and_pdf',
+//     for directions with projections on the unit disk given by Sobol points
+
+template< class T >
+void BenchInverseMap( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   // (samples too close to the borders are not inverted accurately)
+   SamplePool<T> pool = MakeSamplePool<T>( num_samples_pool, T(0.01), T(0.99) );
+   vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool ),
+             s_inv( num_samples_pool ), t_inv( num_samples_pool ),
+             dx( num_samples_pool ), dy( num_samples_pool ), dz( num_samples_pool ),
+             pdf( num_samples_pool );
+
+   const T normal[3] = { T(0.0), T(0.0), T(1.0) },
+           center[3] = { T( std::cos( bc.beta ) ), T(0.0), T( std::sin( bc.beta ) ) } ;
+   T vx[3], vy[3] ;
+
+   PSCMaps<T> pscm ;
+   pscm.initialize_geometric( center, T( std::sin( bc.alpha ) ), normal, use_radial, vx, vy );
+   pscm.eval_map_batch( s.data(), t.data(), x.data(), y.data(), num_samples_pool );
+
+   const double inv_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         pscm.inverse_map( x[i], y[i], s_inv[i], t_inv[i] );
+      sink += s_inv[0] + t_inv[num_samples_pool-1] ;
+   });
+
+   double max_diff = 0.0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      max_diff = std::max( { max_diff, double( std::abs( s_inv[i]-s[i] ) ), double( std::abs( t_inv[i]-t[i] ) ) } );
+
+   // sampled directions: all of them must be in the cap
+   pscm.eval_directions( s.data(), t.data(), num_samples_pool, vx, vy, normal,
+                         dx.data(), dy.data(), dz.data(), nullptr );
+   pscm.contains_and_pdf( dx.data(), dy.data(), dz.data(), num_samples_pool, vx, vy, normal, pdf.data() );
+   size_t num_inside = 0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      num_inside += ( pdf[i] > T(0.0) ) ? 1 : 0 ;
+
+   // directions uniform in projected solid angle: the fraction in the cap is area/PI
+   // (the Sobol points make the estimate accurate enough to check the cap geometry)
+   const SobolSequence<T> seq( 1234 );
+   seq.generate( 0, num_samples_pool, s.data(), t.data() );
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+   {
+      const T r   = std::sqrt( s[i] ),
+              phi = T(2.0*M_PI)*t[i] ;
+      dx[i] = r*std::cos( phi );
+      dy[i] = r*std::sin( phi );
+      dz[i] = std::sqrt( std::max( T(0.0), T(1.0) - r*r ) );
+   }
+   const double pdf_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      pscm.contains_and_pdf( dx.data(), dy.data(), dz.data(), num_samples_pool, vx, vy, normal, pdf.data() );
+      sink += pdf[0] ;
+   });
+   size_t num_in_cap = 0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      num_in_cap += ( pdf[i] > T(0.0) ) ? 1 : 0 ;
+   const double area_est = M_PI*double( num_in_cap )/double( num_samples_pool ),
+                area     = double( pscm.get_area() );
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << inv_sps*1e-6
+        << setw(12) << pdf_sps*1e-6
+        << scientific << setprecision(1) << setw(11) << max_diff
+        << fixed << setprecision(2) << setw(9) << 100.0*double( num_inside )/double( num_samples_pool ) << "%"
+        << scientific << setprecision(1) << setw(11) << std::abs( area_est - area )/area << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares 'PSCMaps<double>' against 'PSCMapsMixed' (float evaluation, and a
+// double refinement step when needed), both with 'error_bound' as tolerance:
+// millions of samples/sec. and max. error in the map position of both
+// (w.r.t. 'PSCMaps<double>' with a very tight tolerance)
+
+void BenchMixed( const BenchCase & bc, const bool use_radial, const double error_bound )
+{
+   const SamplePool<double> pool = MakeSamplePool<double>();
+   const vector<double> & s = pool.s, & t = pool.t ;
+   vector<double> x( num_samples_pool ), y( num_samples_pool ),
+                  xm( num_samples_pool ), ym( num_samples_pool ),
+                  x_ref( num_samples_pool ), y_ref( num_samples_pool );
+
+   PSCMaps<double> ref, pscm ;
+   ref.initialize( bc.alpha, bc.beta, use_radial, InversionConfig<double>( 1e-13, 200 ) );
+   ref.eval_map_batch( s.data(), t.data(), x_ref.data(), y_ref.data(), num_samples_pool );
+   pscm.initialize( bc.alpha, bc.beta, use_radial, InversionConfig<double>( error_bound ) );
+
+   PSCMapsMixed<> mixed ;
+   mixed.initialize( bc.alpha, bc.beta, use_radial, error_bound );
+
+   const double double_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double mixed_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         mixed.eval_map_batch( &s[i], &t[i], &xm[i], &ym[i], batch_size );
+      sink += xm[0] + ym[num_samples_pool-1] ;
+   });
+
+   double err_double = 0.0, err_mixed = 0.0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+   {
+      err_double = std::max( err_double, std::hypot( x[i]-x_ref[i], y[i]-y_ref[i] ) );
+      err_mixed  = std::max( err_mixed,  std::hypot( xm[i]-x_ref[i], ym[i]-y_ref[i] ) );
+   }
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel") << right
+        << scientific << setprecision(0) << setw(7) << error_bound
+        << fixed << setprecision(2)
+        << setw(12) << double_sps*1e-6
+        << setw(12) << mixed_sps*1e-6
+        << setw(9)  << mixed_sps/double_sps << "x"
+        << setw(8)  << ( mixed.is_refining() ? "yes" : "no" )
+        << scientific << setprecision(1) << setw(11) << err_double
+        << setw(11) << err_mixed << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// compares a function in 'simd' (standard library, lane by lane) against the
+// same function in 'fastmath', on packs: millions of evaluations per second,
+// and max. error in ULPs of both (w.r.t. the long double standard function),
+// for 'num_samples_pool' arguments 'a' in [lo,hi] (the functions take a second
+// argument 'b' in [-1,1], which is only used by atan2)
+
+template< class T, class FuncStd, class FuncFast, class FuncRef >
+void BenchFastMathFunc( const char * descr, const char * type_name, const double lo, const double hi,
+                        FuncStd f_std, FuncFast f_fast, FuncRef f_ref )
+{
+   constexpr size_t w = simd::Pack<T>::width ;
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<double> dist( lo, hi ), dist_b( -1.0, 1.0 );
+   vector<T> a( num_samples_pool ), b( num_samples_pool ),
+             r( num_samples_pool ), r_fast( num_samples_pool );
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+   {
+      a[i] = T( dist( gen ) );
+      b[i] = T( dist_b( gen ) );
+   }
+
+   const double std_eps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += w )
+         simd::store( &r[i], f_std( simd::load( &a[i] ), simd::load( &b[i] ) ) );
+      sink += r[0] ;
+   });
+   const double fast_eps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += w )
+         simd::store( &r_fast[i], f_fast( simd::load( &a[i] ), simd::load( &b[i] ) ) );
+      sink += r_fast[0] ;
+   });
+
+   // error in ULPs (the ULP of the reference value rounded to T)
+   double max_ulp_std = 0.0, max_ulp_fast = 0.0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+   {
+      const long double ref = f_ref( (long double)( a[i] ), (long double)( b[i] ) );
+      const T           rt  = std::abs( T( ref ) ),
+                        ulp = std::nextafter( rt, std::numeric_limits<T>::infinity() ) - rt ;
+      max_ulp_std  = std::max( max_ulp_std,  double( std::abs( r[i] - ref )/ulp ) );
+      max_ulp_fast = std::max( max_ulp_fast, double( std::abs( r_fast[i] - ref )/ulp ) );
+   }
+
+   cout << "   " << setw(8) << left << descr << setw(7) << type_name << right << fixed << setprecision(2)
+        << setw(12) << std_eps*1e-6
+        << setw(12) << fast_eps*1e-6
+        << setw(9)  << fast_eps/std_eps << "x"
+        << setw(10) << max_ulp_std
+        << setw(10) << max_ulp_fast << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// runs 'BenchFastMathFunc' for each function in 'fastmath'
+// (for atan2, 'a' and 'b' are the coordinates of points in [-1,1]^2)
+
+template< class T >
+void BenchFastMath( const char * type_name )
+{
+   typedef simd::Pack<T> V ;
+   typedef long double   LD ;
+
+   BenchFastMathFunc<T>( "sin", type_name, -M_PI, M_PI,
+      []( const V a, const V ) { return simd::sin( a ); },
+      []( const V a, const V ) { return fastmath::sin( a ); },
+      []( const LD a, const LD ) { return std::sin( a ); } );
+   BenchFastMathFunc<T>( "cos", type_name, -M_PI, M_PI,
+      []( const V a, const V ) { return simd::cos( a ); },
+      []( const V a, const V ) { return fastmath::cos( a ); },
+      []( const LD a, const LD ) { return std::cos( a ); } );
+   BenchFastMathFunc<T>( "tan", type_name, -1.5, 1.5,
+      []( const V a, const V ) { return simd::tan( a ); },
+      []( const V a, const V ) { return fastmath::tan( a ); },
+      []( const LD a, const LD ) { return std::tan( a ); } );
+   BenchFastMathFunc<T>( "asin", type_name, -1.0, 1.0,
+      []( const V a, const V ) { return simd::asin( a ); },
+      []( const V a, const V ) { return fastmath::asin( a ); },
+      []( const LD a, const LD ) { return std::asin( a ); } );
+   BenchFastMathFunc<T>( "atan", type_name, -50.0, 50.0,
+      []( const V a, const V ) { return simd::atan( a ); },
+      []( const V a, const V ) { return fastmath::atan( a ); },
+      []( const LD a, const LD ) { return std::atan( a ); } );
+   BenchFastMathFunc<T>( "atan2", type_name, -1.0, 1.0,
+      []( const V a, const V b ) { return simd::atan2( a, b ); },
+      []( const V a, const V b ) { return fastmath::atan2( a, b ); },
+      []( const LD a, const LD b ) { return std::atan2( a, b ); } );
+}
+// --------------------------------------------------------------------------
+// compares 'eval_map_batch' with the 'MathStd' and 'MathFast' policies, for one
+// cap, and reports the max. error in the map position of both, w.r.t. the map
+// evaluated with doubles (and 'MathStd')
+
+template< class T >
+void BenchMathPolicy( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool ),
+             x_fast( num_samples_pool ), y_fast( num_samples_pool );
+
+   PSCMaps<T>          pscm ;
+   PSCMaps<T,MathFast> pscm_fast ;
+   PSCMaps<double>     pscm_ref ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+   pscm_fast.initialize( T(bc.alpha), T(bc.beta), use_radial );
+   pscm_ref.initialize( bc.alpha, bc.beta, use_radial );
+
+   const double std_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+   const double fast_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm_fast.eval_map_batch( &s[i], &t[i], &x_fast[i], &y_fast[i], batch_size );
+      sink += x_fast[0] + y_fast[num_samples_pool-1] ;
+   });
+
+   double max_err = 0.0, max_err_fast = 0.0 ;
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+   {
+      double xr, yr ;
+      pscm_ref.eval_map( s[i], t[i], xr, yr );
+      max_err      = std::max( max_err,      std::max( std::abs( x[i]-xr ),      std::abs( y[i]-yr ) ));
+      max_err_fast = std::max( max_err_fast, std::max( std::abs( x_fast[i]-xr ), std::abs( y_fast[i]-yr ) ));
+   }
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << std_sps*1e-6
+        << setw(12) << fast_sps*1e-6
+        << setw(9)  << fast_sps/std_sps << "x"
+        << scientific << setprecision(1) << setw(11) << max_err
+        << setw(11) << max_err_fast << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// runs 'PSCMapsEngine' with 1 to N threads (N is the number of hardware threads,
+// at least 2), with and without work stealing, for 256 caps with 1024 samples
+// each: the first half of the caps are partially visible (they need
+// iterations), the others are fully visible (they do not), so the initial
+// ranges of the threads have very different costs
+
+template< class T >
+void BenchEngine( const char * type_name )
+{
+   constexpr size_t num_jobs = 256, samples_per_job = 1024 ;
+
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+   vector<T> x( num_jobs*samples_per_job ), y( num_jobs*samples_per_job ),
+             x1( num_jobs*samples_per_job ), y1( num_jobs*samples_per_job );
+   vector< SampleJob<T> > jobs( num_jobs );
+   for( size_t j = 0 ; j < num_jobs ; j++ )
+   {
+      const double alpha = 0.3 + 0.9*dist( gen ),
+                   b     = ( j < num_jobs/2 ) ? -0.9 + 1.4*dist( gen ) : 1.1 + 0.2*dist( gen );
+      jobs[j] = SampleJob<T>{ T(alpha), T( std::min( b*alpha, 0.5*M_PI ) ), true, samples_per_job,
+                              nullptr, nullptr, &x[j*samples_per_job], &y[j*samples_per_job] } ;
+   }
+
+   const unsigned max_threads = std::max( 2u, std::thread::hardware_concurrency() );
+   double         sps_1       = 0.0 ;
+
+   for( unsigned n = 1 ; n <= max_threads ; n = ( n < max_threads && max_threads < 2*n ) ? max_threads : 2*n )
+   {
+      PSCMapsEngine<T> engine( n );
+
+      engine.set_work_stealing( false );
+      const double static_sps = SamplesPerSecond( num_jobs*samples_per_job, [&]()
+      {
+         engine.run( jobs.data(), num_jobs );
+         sink += x[0] ;
+      });
+      engine.set_work_stealing( true );
+      const double stealing_sps = SamplesPerSecond( num_jobs*samples_per_job, [&]()
+      {
+         engine.run( jobs.data(), num_jobs );
+         sink += x[0] ;
+      });
+
+      // the results must be the same for any number of threads
+      if ( n == 1 )
+      {
+         sps_1 = stealing_sps ;
+         x1    = x ;
+         y1    = y ;
+      }
+      const bool same = ( x == x1 && y == y1 );
+
+      cout << "   " << setw(7) << left << type_name << right << setw(8) << n << fixed << setprecision(2)
+           << setw(12) << static_sps*1e-6
+           << setw(12) << stealing_sps*1e-6
+           << setw(9)  << stealing_sps/static_sps << "x"
+           << setw(9)  << stealing_sps/sps_1 << "x" << defaultfloat
+           << setw(8)  << engine.get_num_steals()
+           << setw(7)  << ( same ? "yes" : "NO" ) << endl ;
+   }
+}
+// --------------------------------------------------------------------------
+// usage: bench_exe [baked_table_file]
+
+int main( int argc, char *argv[] )
+{
+   cout << "eval_map: scalar loop vs. eval_map_batch (batches of "
+        << batch_size << " samples), in millions of samples/sec." << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+        << right << setw(12) << "scalar" << setw(12) << "batch" << setw(10) << "speedup" << endl ;
+
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchEvalMap<float> ( bc, use_radial, "float" );
+         BenchEvalMap<double>( bc, use_radial, "double" );
+      }
+
+   BenchInversion<float> ( "float" );
+   BenchInversion<double>( "double" );
+
+   cout << endl << "eval_map: iterative inversion vs. fitted inverse (PSCMapsTabulated), in millions of samples/sec." << endl
+        << "(nodes in the fit, time to build it in microsecs., samples to amortize it, and max. error)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+        << right << setw(12) << "iterative" << setw(12) << "fitted" << setw(10) << "speedup"
+        << setw(7) << "nodes" << setw(10) << "build" << setw(9) << "amort." << setw(10) << "error" << endl ;
+
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchTabulated<float> ( bc, use_radial, "float" );
+         BenchTabulated<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "initialize vs. PSCMapsCache::get, in millions of caps/sec. (for a grid of shading points)" << endl
+        << "(hit rate, and max. error in the map position)" << endl
+        << endl
+        << "   " << setw(7) << left << "type" << right << setw(10) << "max.err." << setw(12) << "initialize"
+        << setw(12) << "cache" << setw(10) << "speedup" << setw(10) << "hits" << setw(11) << "pos.error" << endl ;
+   for( const double max_angle_error : { 1e-4, 1e-3, 1e-2 } )
+   {
+      BenchCache<float> ( float(max_angle_error), "float" );
+      BenchCache<double>( max_angle_error, "double" );
+   }
+
+   cout << endl << "array of maps objects vs. PSCMapsSoA, for 4096 caps (bytes per object, millions of" << endl
+        << "areas/sec. when adding the areas of all caps, and millions of samples/sec. for 4 samples per cap)" << endl
+        << endl
+        << "   " << setw(7) << left << "type" << right << setw(7) << "bytes"
+        << setw(12) << "areas" << setw(12) << "areas SoA" << setw(10) << "speedup"
+        << setw(12) << "samples" << setw(12) << "samples SoA" << setw(10) << "speedup" << endl ;
+   BenchSoA<float> ( "float" );
+   BenchSoA<double>( "double" );
+
+   cout << endl << "PSCMapsSoA: initialize (scalar loop) vs. initialize_batch, in millions of caps/sec." << endl
+        << "(random caps, all cases, and max. difference in the areas)" << endl
+        << endl
+        << "   " << setw(9) << left << "map" << setw(7) << "type" << right
+        << setw(12) << "loop" << setw(12) << "batch" << setw(10) << "speedup" << setw(11) << "area diff." << endl ;
+   for( const bool use_radial : { true, false } )
+   {
+      BenchSoAInit<float> ( use_radial, "float" );
+      BenchSoAInit<double>( use_radial, "double" );
+   }
+
+   cout << endl << "initialize from the geometry: asin and initialize vs. initialize_geometric, in millions of" << endl
+        << "caps/sec. (including the local frame), and max. relative error in the area of both" << endl
+        << endl
+        << "   " << setw(9) << left << "map" << setw(7) << "type" << right
+        << setw(12) << "asin" << setw(12) << "geometric" << setw(10) << "speedup"
+        << setw(11) << "err.asin" << setw(11) << "err.geom." << endl ;
+   for( const bool use_radial : { true, false } )
+   {
+      BenchInitGeometric<float> ( use_radial, "float" );
+      BenchInitGeometric<double>( use_radial, "double" );
+   }
+
+   cout << endl << "world-space directions and pdfs: eval_map_batch and a loop vs. eval_directions," << endl
+        << "in millions of samples/sec. (and max. difference in the directions)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+        << right << setw(12) << "loop" << setw(12) << "directions" << setw(10) << "speedup"
+        << setw(11) << "diff." << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchDirections<float> ( bc, use_radial, "float" );
+         BenchDirections<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "inverse_map and contains_and_pdf, in millions of samples (or directions)/sec. (max. difference" << endl
+        << "between (s,t) and the inverse of its image, percentage of sampled directions found in the cap," << endl
+        << "and relative error of the area estimated with 'contains_and_pdf', for " << num_samples_pool << " directions)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+        << right << setw(12) << "inverse" << setw(12) << "pdf" << setw(11) << "diff."
+        << setw(10) << "inside" << setw(11) << "area err." << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchInverseMap<float> ( bc, use_radial, "float" );
+         BenchInverseMap<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "eval_map_batch: PSCMaps<double> vs. PSCMapsMixed (float, refined in double when the bound" << endl
+        << "needs it), in millions of samples/sec. (and max. error in the map position of both)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << right << setw(7) << "bound"
+        << setw(12) << "double" << setw(12) << "mixed" << setw(10) << "speedup" << setw(8) << "refine"
+        << setw(11) << "err.double" << setw(11) << "err.mixed" << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+         for( const double error_bound : { 1e-4, 1e-9 } )
+            BenchMixed( bc, use_radial, error_bound );
+
+   cout << endl << "fastmath: standard library (lane by lane) vs. polynomial approximations, on packs," << endl
+        << "in millions of evaluations/sec. (and max. error in ULPs of both, for " << num_samples_pool << " arguments)" << endl
+        << endl
+        << "   " << setw(8) << left << "func." << setw(7) << "type" << right
+        << setw(12) << "std" << setw(12) << "fastmath" << setw(10) << "speedup"
+        << setw(10) << "ulp std" << setw(10) << "ulp fast" << endl ;
+   BenchFastMath<float> ( "float" );
+   BenchFastMath<double>( "double" );
+
+   cout << endl << "eval_map_batch: MathStd vs. MathFast policies, in millions of samples/sec." << endl
+        << "(and max. error in the map position of both, w.r.t. doubles and MathStd)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+        << right << setw(12) << "MathStd" << setw(12) << "MathFast" << setw(10) << "speedup"
+        << setw(11) << "error" << setw(11) << "err.fast" << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchMathPolicy<float> ( bc, use_radial, "float" );
+         BenchMathPolicy<double>( bc, use_radial, "double" );
+      }
+
+   BenchCheckPolicies();
+   BenchSequences();
+
+   cout << endl << "PSCMapsEngine: static ranges vs. work stealing, in millions of samples/sec., for 1 to "
+        << std::max( 2u, std::thread::hardware_concurrency() ) << " threads" << endl
+        << "(speedup of stealing w.r.t. static ranges and w.r.t. 1 thread, ranges stolen in the last run," << endl
+        << "and whether the results are the same as with 1 thread)" << endl
+        << endl
+        << "   " << setw(7) << left << "type" << right << setw(8) << "threads"
+        << setw(12) << "static" << setw(12) << "stealing" << setw(10) << "speedup"
+        << setw(10) << "scaling" << setw(8) << "steals" << setw(7) << "same" << endl ;
+   BenchEngine<float> ( "float" );
+   BenchEngine<double>( "double" );
+
+   BakedInverseTable table ;
+   if ( argc < 2 || ! table.load( argv[1] ) )
+      cout << endl << "(baked table not benchmarked: "
+           << ( argc < 2 ? string("no file given") : table.get_error() ) << ", see 'make bake')" << endl ;
+   else
+   {
+      cout << endl << "eval_map: iterative inversion vs. baked table (PSCMapsBaked), in millions of samples/sec." << endl
+           << endl
+           << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type"
+           << right << setw(12) << "iterative" << setw(12) << "baked" << setw(10) << "speedup" << endl ;
+
+      for( const BenchCase & bc : bench_cases )
+         for( const bool use_radial : { true, false } )
+         {
+            BenchBaked<float> ( bc, use_radial, "float", table );
+            BenchBaked<double>( bc, use_radial, "double", table );
+         }
+   }
+
+   cout << endl << "(checksum " << sink << ")" << endl ;
+   return 0 ;
+}
@@ -0,0 +1,113 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Declarations shared by the benchmark units
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_BENCH_H
+#define PSCMAPS_BENCH_H
+
+#include <cstddef>
+#include <chrono>
+#include <vector>
+#include <random>
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr size_t
+   num_samples_pool = 1 << 16 , // number of (s,t) pairs generated for each run
+   batch_size       = 256 ,     // samples per (light, shading point) pair
+   num_bench_cases  = 3 ;       // number of entries in 'bench_cases'
+constexpr double
+   min_run_time     = 0.25 ;    // minimum time (in seconds) for each measurement
+
+// --------------------------------------------------------------------------
+// a spherical cap configuration, one for each geometric case
+// (the cases are defined in 'Bench.cpp')
+
+struct BenchCase
+{
+   const char * name ;
+   double       alpha, beta ;
+} ;
+
+extern const BenchCase bench_cases[num_bench_cases] ;
+
+// --------------------------------------------------------------------------
+// accumulates results so the compiler cannot drop the evaluations
+
+extern double sink ;
+
+// --------------------------------------------------------------------------
+// benchmarks in other units (called from 'main' in 'Bench.cpp')
+
+void BenchCheckPolicies();   // see 'BenchChecks.cpp'
+void BenchSequences();       // see 'BenchSequences.cpp'
+
+// --------------------------------------------------------------------------
+// a pool of 'n' random (s,t) samples in SoA form, uniformly distributed in
+// [lo,hi]^2. The generator has a fixed seed, so all the benchmarks (and all
+// the runs) use the same samples
+
+template< class T >
+struct SamplePool
+{
+   std::vector<T> s, t ;
+} ;
+
+template< class T >
+SamplePool<T> MakeSamplePool( const size_t n = num_samples_pool, const T lo = T(0.0), const T hi = T(1.0) )
+{
+   std::mt19937 gen( 1234 );
+   std::uniform_real_distribution<T> dist( T(0.0), T(1.0) );
+   SamplePool<T> pool ;
+   pool.s.resize( n );
+   pool.t.resize( n );
+   for( size_t i = 0 ; i < n ; i++ )
+   {
+      pool.s[i] = lo + (hi-lo)*dist( gen );
+      pool.t[i] = lo + (hi-lo)*dist( gen );
+   }
+   return pool ;
+}
+
+// --------------------------------------------------------------------------
+// runs 'func' (which processes all the samples in the pool) repeatedly,
+// until at least 'run_time' seconds have elapsed,
+// returns the number of samples processed per second
+
+template< class Func >
+double SamplesPerSecond( const size_t num_samples, Func func, const double run_time = min_run_time )
+{
+   using clock = std::chrono::steady_clock ;
+
+   size_t      num_runs = 0 ;
+   const auto  start    = clock::now();
+   double      elapsed  = 0.0 ;
+
+   do
+   {
+      func();
+      num_runs++ ;
+      elapsed = std::chrono::duration<double>( clock::now() - start ).count();
+   }
+   while ( elapsed < run_time );
+
+   return double(num_runs*num_samples)/elapsed ;
+}
+
+#endif
@@ -0,0 +1,147 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Headless benchmarks: cost of the checking policies
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+// the benchmarks are compiled with NDEBUG, but here the assertions must be
+// evaluated, in order to measure what the 'Checked' policy costs
+#undef NDEBUG
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <PSCMaps.h>  // maps implementation
+#include <Bench.h>    // timing and cases, shared by the benchmark units
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+namespace
+{
+
+// --------------------------------------------------------------------------
+// same as 'Checked', but local to this unit: the maps instantiated with it
+// (which assert) are not mixed with those in 'Bench.cpp' (which do not)
+
+struct CheckedAsserts : public Checked {} ;
+
+// --------------------------------------------------------------------------
+// samples per second of 'eval_map' in a loop, and of 'eval_map_batch'
+
+template< class Maps, class T >
+double EvalMapSPS( const Maps & pscm, const vector<T> & s, const vector<T> & t,
+                   vector<T> & x, vector<T> & y )
+{
+   return SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+         pscm.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+}
+
+template< class Maps, class T >
+double EvalMapBatchSPS( const Maps & pscm, const vector<T> & s, const vector<T> & t,
+                        vector<T> & x, vector<T> & y )
+{
+   return SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+}
+// --------------------------------------------------------------------------
+// compares 'eval_map' in a loop, for one cap, with each checking policy, and
+// 'eval_map_batch' with 'Checked' and 'Unchecked' (in millions of samples/sec.),
+// and reports the clamps counted by 'Counting' per million samples (the
+// inversion statistics of that pass, and of a pass with 'eval_map_batch',
+// are flushed to the totals)
+
+template< class T >
+void BenchCheckPolicy( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>();
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_samples_pool ), y( num_samples_pool );
+
+   PSCMaps<T,MathStd,CheckedAsserts> pscm_checked ;
+   PSCMaps<T,MathStd,Counting>       pscm_counting ;
+   PSCMaps<T,MathStd,Unchecked>      pscm_unchecked ;
+   pscm_checked.initialize( T(bc.alpha), T(bc.beta), use_radial );
+   pscm_counting.initialize( T(bc.alpha), T(bc.beta), use_radial );
+   pscm_unchecked.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   const double checked_sps   = EvalMapSPS( pscm_checked, s, t, x, y ),
+                counting_sps  = EvalMapSPS( pscm_counting, s, t, x, y ),
+                unchecked_sps = EvalMapSPS( pscm_unchecked, s, t, x, y ),
+                checked_bps   = EvalMapBatchSPS( pscm_checked, s, t, x, y ),
+                unchecked_bps = EvalMapBatchSPS( pscm_unchecked, s, t, x, y );
+
+   // clamps in one pass over the pool
+   clamp_counters().reset();
+   for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      pscm_counting.eval_map( s[i], t[i], x[i], y[i] );
+   const double clamps = double( clamp_counters().total() )*1e6/double( num_samples_pool );
+   pscm_counting.eval_map_batch( s.data(), t.data(), x.data(), y.data(), num_samples_pool );
+   flush_inversion_stats();
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(10) << checked_sps*1e-6
+        << setw(10) << counting_sps*1e-6
+        << setw(10) << unchecked_sps*1e-6
+        << setw(9)  << unchecked_sps/checked_sps << "x"
+        << setw(10) << checked_bps*1e-6
+        << setw(10) << unchecked_bps*1e-6
+        << setw(9)  << unchecked_bps/checked_bps << "x"
+        << setprecision(1) << setw(9) << clamps << defaultfloat << endl ;
+}
+
+} // end anonymous namespace
+
+// --------------------------------------------------------------------------
+// runs 'BenchCheckPolicy' for all the cases
+
+void BenchCheckPolicies()
+{
+   cout << endl << "checking policies: Checked (with assertions) vs. Counting vs. Unchecked, in millions" << endl
+        << "of samples/sec., for eval_map and eval_map_batch (and clamps counted per million samples)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type" << right
+        << setw(10) << "checked" << setw(10) << "counting" << setw(10) << "unchecked" << setw(10) << "speedup"
+        << setw(10) << "b.checked" << setw(10) << "b.unchk." << setw(10) << "speedup"
+        << setw(9) << "clamps" << endl ;
+
+   reset_total_inversion_stats();
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchCheckPolicy<float> ( bc, use_radial, "float" );
+         BenchCheckPolicy<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "inversion statistics collected by 'Counting' (float and double, one pass of eval_map and" << endl
+        << "one of eval_map_batch for each case above): inversions, mean iterations, interval steps, NaN steps," << endl
+        << "exits at max. iterations and parabola approximations, and the histograms of iterations" << endl
+        << endl ;
+   total_inversion_stats().print( cout );
+}
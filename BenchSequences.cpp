@@ -0,0 +1,334 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Headless benchmarks: stratified and low-discrepancy samples
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <PSCMaps.h>       // maps implementation
+#include <PSCSequences.h>  // (s,t) sequences
+#include <Bench.h>         // timing and cases, shared by the benchmark units
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+namespace
+{
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr size_t
+   num_trials       = 64 ,       // seeds used to measure the error of each sequence
+   trial_samples    = 256 ,      // samples in each trial (16x16 for the jittered grid)
+   grid_res         = 16 ,       // columns and rows of the jittered grid
+   reference_log2   = 18 ;       // log2 of the number of samples for the reference integral
+
+// --------------------------------------------------------------------------
+// integrand used to compare the sequences (smooth, no symmetries)
+
+inline double Integrand( const double x, const double y )
+{
+   return std::exp( x + 0.5*y );
+}
+// --------------------------------------------------------------------------
+// estimate of the integral of 'Integrand' over the projected cap, with the
+// points 'first' to 'first+n-1' of the sequence 'seq'
+
+template< class Seq >
+double Estimate( const PSCMaps<double> & pscm, const Seq & seq, const size_t first,
+                 const size_t n, vector<double> & x, vector<double> & y )
+{
+   pscm.eval_map_sequence( seq, first, n, x.data(), y.data() );
+   double sum = 0.0 ;
+   for( size_t i = 0 ; i < n ; i++ )
+      sum += Integrand( x[i], y[i] );
+   return pscm.get_area()*sum/double( n );
+}
+// --------------------------------------------------------------------------
+// same as 'Estimate', but with 'n_pairs' points of 'seq' and their antithetic
+// points (2*n_pairs samples, see 'PSCMaps::eval_map_antithetic')
+
+template< class Seq >
+double EstimateAntithetic( const PSCMaps<double> & pscm, const Seq & seq, const size_t n_pairs,
+                           vector<double> & x, vector<double> & y )
+{
+   vector<double> s( n_pairs ), t( n_pairs );
+   seq.generate( 0, n_pairs, s.data(), t.data() );
+   pscm.eval_map_antithetic( s.data(), t.data(), x.data(), y.data(), n_pairs );
+   double sum = 0.0 ;
+   for( size_t i = 0 ; i < 2*n_pairs ; i++ )
+      sum += Integrand( x[i], y[i] );
+   return pscm.get_area()*sum/double( 2*n_pairs );
+}
+// --------------------------------------------------------------------------
+// compares, for one cap, the user loop (a point generated and mapped in each
+// iteration, with 'eval_map'), generating all the points in a buffer and then
+// calling 'eval_map_batch', and 'eval_map_sequence' (in millions of
+// samples/sec.), all of them with the scrambled Sobol sequence
+
+template< class T >
+void BenchSequenceSpeed( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   const SobolSequence<T> seq( 1234 );
+   vector<T> s( num_samples_pool ), t( num_samples_pool ),
+             x( num_samples_pool ), y( num_samples_pool );
+
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   const double loop_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i++ )
+      {
+         T si, ti ;
+         seq.generate( i, 1, &si, &ti );
+         pscm.eval_map( si, ti, x[i], y[i] );
+      }
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double buffer_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      seq.generate( 0, num_samples_pool, s.data(), t.data() );
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double seq_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      pscm.eval_map_sequence( seq, 0, num_samples_pool, x.data(), y.data() );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << loop_sps*1e-6
+        << setw(12) << buffer_sps*1e-6
+        << setw(12) << seq_sps*1e-6
+        << setw(9)  << seq_sps/loop_sps << "x" << defaultfloat << endl ;
+}
+// --------------------------------------------------------------------------
+// RMS relative error of the integral of 'Integrand' over one cap, estimated
+// with 'trial_samples' samples from each sequence (over 'num_trials' seeds)
+
+void BenchSequenceError( const BenchCase & bc, const bool use_radial )
+{
+   PSCMaps<double> pscm ;
+   pscm.initialize( bc.alpha, bc.beta, use_radial, InversionConfig<double>( 1e-10, 50 ) );
+
+   const size_t   n_ref = size_t(1) << reference_log2 ;
+   vector<double> x( n_ref ), y( n_ref );
+   const double   reference = Estimate( pscm, SobolSequence<double>( 987654321 ), 0, n_ref, x, y );
+
+   double sq_err[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 } ;
+   for( size_t k = 0 ; k < num_trials ; k++ )
+   {
+      const double est[5] =
+      {
+         Estimate( pscm, UniformSequence<double>( hash64( k ) ), 0, trial_samples, x, y ),
+         EstimateAntithetic( pscm, UniformSequence<double>( hash64( k ) ), trial_samples/2, x, y ),
+         Estimate( pscm, JitteredGrid<double>( grid_res, grid_res, hash64( k ) ), 0, trial_samples, x, y ),
+         Estimate( pscm, SobolSequence<double>( k ), 0, trial_samples, x, y ),
+         Estimate( pscm, R2Sequence<double>( k ), 0, trial_samples, x, y )
+      } ;
+      for( int j = 0 ; j < 5 ; j++ )
+         sq_err[j] += ( est[j]-reference )*( est[j]-reference );
+   }
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9) << (use_radial ? "radial" : "parallel") << right << scientific << setprecision(2) ;
+   for( int j = 0 ; j < 5 ; j++ )
+      cout << setw(12) << std::sqrt( sq_err[j]/double( num_trials ) )/reference ;
+   cout << defaultfloat << endl ;
+}
+
+// --------------------------------------------------------------------------
+// compares 'eval_map_batch' against 'eval_grid' (in millions of samples/sec.),
+// for jittered grids with 'grid_res' x 'grid_res' samples (as many grids as
+// needed for the pool), and reports the max. difference in the map position
+
+template< class T >
+void BenchGrid( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   constexpr size_t grid_samples = grid_res*grid_res ,
+                    num_grids    = num_samples_pool/grid_samples ;
+
+   // jitters of all the grids, and (s,t) arrays for one grid
+   vector<T> jitter_s( num_samples_pool ), jitter_t( num_grids*grid_res ), unused( num_samples_pool ),
+             s( grid_samples ), t( grid_samples ),
+             x( num_samples_pool ), y( num_samples_pool ),
+             xg( num_samples_pool ), yg( num_samples_pool );
+   UniformSequence<T>( 11 ).generate( 0, num_samples_pool, jitter_s.data(), unused.data() );
+   UniformSequence<T>( 22 ).generate( 0, num_grids*grid_res, jitter_t.data(), unused.data() );
+
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   // the (s,t) points are built from the jitters in the timed region, as
+   // 'eval_grid' does
+   const double batch_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t g = 0 ; g < num_grids ; g++ )
+      {
+         for( size_t j = 0 ; j < grid_res ; j++ )
+            for( size_t i = 0 ; i < grid_res ; i++ )
+            {
+               const size_t k = j*grid_res + i ;
+               s[k] = std::min( ( T(i) + jitter_s[g*grid_samples+k] )/T(grid_res), T(1.0) );
+               t[k] = std::min( ( T(j) + jitter_t[g*grid_res+j] )/T(grid_res), T(1.0) );
+            }
+         pscm.eval_map_batch( s.data(), t.data(), &x[g*grid_samples], &y[g*grid_samples], grid_samples );
+      }
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double grid_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t g = 0 ; g < num_grids ; g++ )
+         pscm.eval_grid( grid_res, grid_res, &jitter_s[g*grid_samples], &jitter_t[g*grid_res],
+                         &xg[g*grid_samples], &yg[g*grid_samples] );
+      sink += xg[0] + yg[num_samples_pool-1] ;
+   });
+
+   double max_diff = 0.0 ;
+   for( size_t k = 0 ; k < num_samples_pool ; k++ )
+      max_diff = std::max( max_diff, std::max( std::abs( double(x[k]-xg[k]) ), std::abs( double(y[k]-yg[k]) ) ) );
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << batch_sps*1e-6
+        << setw(12) << grid_sps*1e-6
+        << setw(9)  << grid_sps/batch_sps << "x"
+        << scientific << setprecision(1) << setw(11) << max_diff << defaultfloat << endl ;
+}
+
+// --------------------------------------------------------------------------
+// compares 'eval_map_batch' for all the samples in the pool against
+// 'eval_map_antithetic' for half of them (in millions of samples/sec.), and
+// reports the max. difference between the antithetic samples and the map
+// evaluated at (s,1-t)
+
+template< class T >
+void BenchAntithetic( const BenchCase & bc, const bool use_radial, const char * type_name )
+{
+   constexpr size_t n_pairs = num_samples_pool/2 ;
+
+   vector<T> s( num_samples_pool ), t( num_samples_pool ),
+             x( num_samples_pool ), y( num_samples_pool ),
+             xa( num_samples_pool ), ya( num_samples_pool );
+   UniformSequence<T>( 33 ).generate( 0, num_samples_pool, s.data(), t.data() );
+
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   const double batch_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < num_samples_pool ; i += batch_size )
+         pscm.eval_map_batch( &s[i], &t[i], &x[i], &y[i], batch_size );
+      sink += x[0] + y[num_samples_pool-1] ;
+   });
+
+   const double anti_sps = SamplesPerSecond( num_samples_pool, [&]()
+   {
+      for( size_t i = 0 ; i < n_pairs ; i += batch_size/2 )
+         pscm.eval_map_antithetic( &s[i], &t[i], &xa[2*i], &ya[2*i], batch_size/2 );
+      sink += xa[0] + ya[num_samples_pool-1] ;
+   });
+
+   // the antithetic samples, evaluated with (s,1-t)
+   double max_diff = 0.0 ;
+   for( size_t i = 0 ; i < n_pairs ; i += batch_size/2 )
+      for( size_t k = 0 ; k < batch_size/2 ; k++ )
+      {
+         T xm, ym ;
+         pscm.eval_map( s[i+k], T(1.0)-t[i+k], xm, ym );
+         const size_t j = 2*i + batch_size/2 + k ;
+         max_diff = std::max( max_diff, std::max( std::abs( double(xm-xa[j]) ), std::abs( double(ym-ya[j]) ) ) );
+      }
+
+   cout << "   " << setw(13) << left << bc.name
+        << setw(9)  << (use_radial ? "radial" : "parallel")
+        << setw(7)  << type_name << right << fixed << setprecision(2)
+        << setw(12) << batch_sps*1e-6
+        << setw(12) << anti_sps*1e-6
+        << setw(9)  << anti_sps/batch_sps << "x"
+        << scientific << setprecision(1) << setw(11) << max_diff << defaultfloat << endl ;
+}
+
+} // end anonymous namespace
+
+// --------------------------------------------------------------------------
+// runs 'BenchSequenceSpeed', 'BenchSequenceError', 'BenchGrid' and
+// 'BenchAntithetic' for all the cases
+
+void BenchSequences()
+{
+   cout << endl << "Sobol sequence: user loop (generate and eval_map) vs. buffer and eval_map_batch" << endl
+        << "vs. eval_map_sequence, in millions of samples/sec." << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type" << right
+        << setw(12) << "loop" << setw(12) << "buffer" << setw(12) << "sequence" << setw(10) << "speedup" << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchSequenceSpeed<float> ( bc, use_radial, "float" );
+         BenchSequenceSpeed<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "sequences: RMS relative error of the integral of exp(x+y/2) over the cap, with "
+        << trial_samples << " samples" << endl
+        << "(over " << num_trials << " seeds, in doubles)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << right
+        << setw(12) << "uniform" << setw(12) << "antithetic" << setw(12) << "jittered" << setw(12) << "sobol" << setw(12) << "r2" << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+         BenchSequenceError( bc, use_radial );
+
+   cout << endl << "jittered " << grid_res << "x" << grid_res << " grids: eval_map_batch vs. eval_grid (one inversion per row),"
+        << " in millions" << endl
+        << "of samples/sec. (and max. difference in the map position)" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type" << right
+        << setw(12) << "batch" << setw(12) << "grid" << setw(10) << "speedup" << setw(11) << "diff." << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchGrid<float> ( bc, use_radial, "float" );
+         BenchGrid<double>( bc, use_radial, "double" );
+      }
+
+   cout << endl << "eval_map_batch vs. eval_map_antithetic (pairs mirrored about the X axis), in millions" << endl
+        << "of samples/sec. (and max. difference w.r.t. the map evaluated at (s,1-t))" << endl
+        << endl
+        << "   " << setw(13) << left << "case" << setw(9) << "map" << setw(7) << "type" << right
+        << setw(12) << "batch" << setw(12) << "antithetic" << setw(10) << "speedup" << setw(11) << "diff." << endl ;
+   for( const BenchCase & bc : bench_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         BenchAntithetic<float> ( bc, use_radial, "float" );
+         BenchAntithetic<double>( bc, use_radial, "double" );
+      }
+}
@@ -299,7 +299,14 @@ void DrawIntegralCurve( const int x0m, const int y0m, const int wxm, const int w
    glColor3f( 0.0, 0.0, 1.0 );
    DrawVertexes( GL_LINES, { {ref_line_val, 0.0}, {ref_line_val, 1.0} } );
 
-   // trace newton inversion at ref_line_val angle
+   // trace newton inversion at ref_line_val angle, by using a copy of the
+   // sampler with the 'Tracing' policy, which records all its evaluations
+   InversionConfig<scalar> trace_config = sampler.get_inversion_config() ;
+   trace_config.trace = true ;
+   PSCMaps<scalar,MathStd,Tracing> tracer ;
+   tracer.initialize( alpha, beta, mode_radial, trace_config );
+   clear_trace();
+
    if ( sampler.is_using_radial() )
    {
       const scalar
@@ -308,9 +315,7 @@ void DrawIntegralCurve( const int x0m, const int y0m, const int wxm, const int w
 
       cout << "Test for RADIAL inversion at theta == " << theta_ref <<  " (blue radius)" << endl ;
 
-      Vars<scalar>::trace_newton_inversion = true ;
-      const scalar theta_inv = sampler.eval_Ar_inverse( Ar_theta_ref );
-      Vars<scalar>::trace_newton_inversion = false ;
+      const scalar theta_inv = tracer.eval_Ar_inverse( Ar_theta_ref );
 
       cout << "-----" << endl
            << "theta ref  == " << theta_ref << endl
@@ -325,15 +330,22 @@ void DrawIntegralCurve( const int x0m, const int y0m, const int wxm, const int w
 
       cout << "Test for PARALLEL inversion at y == " << y_ref <<  ", Ap(y_ref) == " << Ap_y_ref << " (blue line)" << endl ;
 
-      Vars<scalar>::trace_newton_inversion = true ;
-      const scalar y_inv = sampler.eval_Ap_inverse( Ap_y_ref );
-      Vars<scalar>::trace_newton_inversion = false ;
+      const scalar y_inv = tracer.eval_Ap_inverse( Ap_y_ref );
 
       cout << "-----" << endl
            << "y ref     == " << y_ref << endl
            << "y inv     == " << y_inv << endl
            << "diff      == " << std::abs( y_ref-y_inv ) << endl ;
    }
+
+   const vector<TraceRecord> records = collect_trace();
+   if ( ! records.empty() )
+   {
+      const TraceRecord & r = records.back() ;
+      cout << "iterations == " << r.iterations << ( r.is_converged() ? "" : " (not converged)" ) << endl
+           << "residual   == " << r.residual << endl
+           << "time (ns)  == " << r.time_ns << endl ;
+   }
 }
 
 // --------------------------------------------------------------------------
@@ -400,7 +412,7 @@ void DrawScene( )
    /// draw all the iso curves
    DrawIsoCurves(  );
 
-   Vars<scalar>::print_settings();
+   sampler.get_inversion_config().print();
    sampler.debug();
 
    // draw the ellipse
@@ -0,0 +1,284 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Microbenchmarks with machine-readable results, and comparison against a baseline
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+#include <PSCMaps.h>  // maps implementation
+#include <Bench.h>    // timing, shared by the benchmark units
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr size_t
+   num_micro_samples = 1 << 12 ,  // number of inputs for each measurement
+   num_micro_cases   = 4 ,        // number of entries in 'micro_cases'
+   num_micro_runs    = 7 ;        // runs for each measurement (the fastest one is kept)
+constexpr double
+   micro_run_time    = 0.03 ,     // minimum time (in seconds) for each run
+   ini_threshold     = 0.25 ;     // default relative slowdown flagged as a regression
+
+// --------------------------------------------------------------------------
+// the geometric cases: those in 'Bench.cpp', and a lune only cap which is
+// almost invisible (tiny lune area, see the parabola approximation in
+// 'PSCMaps::eval_Ar_inverse')
+
+const BenchCase micro_cases[num_micro_cases] =
+{
+   { "ellipse only",   0.4,  0.8   },
+   { "ellipse+lune",   0.6,  0.2   },
+   { "lune only",      0.6, -0.3   },
+   { "near invisible", 0.6, -0.595 }
+} ;
+
+double sink = 0.0 ;
+
+// --------------------------------------------------------------------------
+// one result: the benchmark key (operation, case, map and type), and the
+// time per operation in nanoseconds
+
+struct MicroResult
+{
+   string key ;
+   double ns_per_op ;
+} ;
+
+// --------------------------------------------------------------------------
+// runs 'SamplesPerSecond' several times and returns the fastest result, which
+// is much less sensitive than the mean to the noise of a shared machine
+
+template< class Func >
+double BestSamplesPerSecond( Func func )
+{
+   double best = 0.0 ;
+   for( size_t i = 0 ; i < num_micro_runs ; i++ )
+      best = std::max( best, SamplesPerSecond( num_micro_samples, func, micro_run_time ) );
+   return best ;
+}
+
+// --------------------------------------------------------------------------
+// measures 'initialize', 'eval_map', 'eval_map_batch' and the inversion of
+// the area function of the map ('eval_Ar_inverse' or 'eval_Ap_inverse'),
+// for one cap, and appends the results
+
+template< class T >
+void MicroBenchCase( const BenchCase & bc, const bool use_radial, const char * type_name,
+                     vector<MicroResult> & results )
+{
+   const SamplePool<T> pool = MakeSamplePool<T>( num_micro_samples );
+   const vector<T> & s = pool.s, & t = pool.t ;
+   vector<T> x( num_micro_samples ), y( num_micro_samples ), areas( num_micro_samples );
+
+   PSCMaps<T> pscm ;
+   pscm.initialize( T(bc.alpha), T(bc.beta), use_radial );
+
+   // the inverted areas (one for each 't', as 'eval_map' inverts |2t-1|*area/2)
+   for( size_t i = 0 ; i < num_micro_samples ; i++ )
+      areas[i] = t[i]*T(0.5)*pscm.get_area() ;
+
+   const string suffix = string(",") + bc.name + "," + ( use_radial ? "radial" : "parallel" ) + "," + type_name ;
+
+   auto add = [&]( const char * op, const double ops_per_sec )
+   {
+      results.push_back( MicroResult{ op + suffix, 1e9/ops_per_sec } );
+   } ;
+
+   PSCMaps<T> pscm_init ;
+   add( "initialize", BestSamplesPerSecond( [&]()
+   {
+      for( size_t i = 0 ; i < num_micro_samples ; i++ )
+      {
+         pscm_init.initialize( T(bc.alpha), T(bc.beta), use_radial );
+         sink += pscm_init.get_area() ;
+      }
+   }));
+   add( "eval_map", BestSamplesPerSecond( [&]()
+   {
+      for( size_t i = 0 ; i < num_micro_samples ; i++ )
+         pscm.eval_map( s[i], t[i], x[i], y[i] );
+      sink += x[0] + y[num_micro_samples-1] ;
+   }));
+   add( "eval_map_batch", BestSamplesPerSecond( [&]()
+   {
+      pscm.eval_map_batch( s.data(), t.data(), x.data(), y.data(), num_micro_samples );
+      sink += x[0] + y[num_micro_samples-1] ;
+   }));
+   add( use_radial ? "eval_Ar_inverse" : "eval_Ap_inverse", BestSamplesPerSecond( [&]()
+   {
+      T sum = T(0.0) ;
+      for( size_t i = 0 ; i < num_micro_samples ; i++ )
+         sum += use_radial ? pscm.eval_Ar_inverse( areas[i] ) : pscm.eval_Ap_inverse( areas[i] );
+      sink += sum ;
+   }));
+}
+// --------------------------------------------------------------------------
+// writes the results as comma-separated values, one line per benchmark
+// (lines starting with '#' are comments), returns false on error
+
+bool WriteResults( const string & file_name, const vector<MicroResult> & results )
+{
+   ofstream file( file_name );
+   if ( ! file )
+      return false ;
+   file << "# PSCMaps microbenchmarks, nanoseconds per operation" << endl
+        << "# operation,case,map,type,ns_per_op" << endl ;
+   for( const MicroResult & r : results )
+      file << r.key << "," << setprecision(6) << r.ns_per_op << endl ;
+   return bool( file );
+}
+// --------------------------------------------------------------------------
+// reads results written by 'WriteResults' (the key is everything up to the
+// last comma), returns false on error
+
+bool ReadResults( const string & file_name, map<string,double> & results )
+{
+   ifstream file( file_name );
+   if ( ! file )
+      return false ;
+   string line ;
+   while ( std::getline( file, line ) )
+   {
+      const size_t pos = line.rfind( ',' );
+      if ( line.empty() || line[0] == '#' || pos == string::npos )
+         continue ;
+      results[line.substr( 0, pos )] = atof( line.c_str()+pos+1 );
+   }
+   return true ;
+}
+// --------------------------------------------------------------------------
+// prints the results along with the baseline ones, and returns the number of
+// regressions: benchmarks slower than the baseline by more than 'threshold'.
+// The ratios are divided by their median, so a machine which is slower or
+// faster as a whole (frequency scaling, a shared host) does not show up as a
+// change of every benchmark, while a regression in a few of them still does.
+// As this also hides a regression in all of them, the raw ratios are printed
+// too (benchmarks slower only in raw terms are flagged as 'slower'), and a
+// median ratio above the threshold counts as one more regression
+
+size_t CompareResults( const vector<MicroResult> & results, const map<string,double> & baseline,
+                       const double threshold )
+{
+   size_t num_regressions = 0 ;
+
+   vector<double> ratios ;
+   for( const MicroResult & r : results )
+      if ( baseline.count( r.key ) > 0 )
+         ratios.push_back( r.ns_per_op/baseline.at( r.key ) );
+   double median = 1.0 ;
+   if ( ! ratios.empty() )
+   {
+      std::nth_element( ratios.begin(), ratios.begin() + ratios.size()/2, ratios.end() );
+      median = ratios[ratios.size()/2] ;
+   }
+
+   cout << endl << "comparison against the baseline, in ns/op. (regressions: slower by more than "
+        << fixed << setprecision(0) << threshold*100.0 << "% after" << endl
+        << "dividing by the median ratio, which is " << setprecision(2) << median << "; slower: only"
+        << " before dividing)" << endl
+        << endl
+        << "   " << setw(48) << left << "benchmark" << right << setw(11) << "baseline"
+        << setw(11) << "current" << setw(9) << "ratio" << setw(9) << "norm." << endl ;
+
+   for( const MicroResult & r : results )
+   {
+      cout << "   " << setw(48) << left << r.key << right << fixed << setprecision(2) ;
+      const auto it = baseline.find( r.key );
+      if ( it == baseline.end() )
+      {
+         cout << setw(11) << "-" << setw(11) << r.ns_per_op << "   (not in the baseline)" << endl ;
+         continue ;
+      }
+      const double ratio      = r.ns_per_op/it->second ,
+                   norm_ratio = ratio/median ;
+      const bool   regression = 1.0 + threshold < norm_ratio ,
+                   slower     = 1.0 + threshold < ratio ;
+      cout << setw(11) << it->second << setw(11) << r.ns_per_op << setw(8) << ratio << "x"
+           << setw(8) << norm_ratio << "x"
+           << ( regression ? "   REGRESSION" : slower ? "   slower" : "" ) << endl ;
+      if ( regression )
+         num_regressions++ ;
+   }
+
+   if ( 1.0 + threshold < median )
+   {
+      cout << endl << "REGRESSION: the median ratio is " << fixed << setprecision(2) << median
+           << "x, so most benchmarks are slower than the baseline (a broad" << endl
+           << "regression, or a slower machine: run again and compare with a baseline from the same machine state)" << endl ;
+      num_regressions++ ;
+   }
+   return num_regressions ;
+}
+// --------------------------------------------------------------------------
+// usage: microbench_exe results_file [baseline_file [threshold]]
+// (the exit status is 1 when there are regressions w.r.t. the baseline)
+
+int main( int argc, char *argv[] )
+{
+   if ( argc < 2 || 4 < argc )
+   {
+      cerr << "usage: " << argv[0] << " results_file [baseline_file [threshold]]" << endl
+           << "(threshold: relative slowdown flagged as a regression, by default " << ini_threshold << ")" << endl ;
+      return 1 ;
+   }
+   const string results_file = argv[1] ;
+   const double threshold    = ( argc == 4 ) ? atof( argv[3] ) : ini_threshold ;
+
+   map<string,double> baseline ;
+   if ( argc > 2 && ! ReadResults( argv[2], baseline ) )
+   {
+      cerr << "cannot read the baseline file '" << argv[2] << "'" << endl ;
+      return 1 ;
+   }
+
+   vector<MicroResult> results ;
+   for( const BenchCase & bc : micro_cases )
+      for( const bool use_radial : { true, false } )
+      {
+         MicroBenchCase<float> ( bc, use_radial, "float",  results );
+         MicroBenchCase<double>( bc, use_radial, "double", results );
+      }
+
+   if ( ! WriteResults( results_file, results ) )
+   {
+      cerr << "cannot write the results file '" << results_file << "'" << endl ;
+      return 1 ;
+   }
+   cout << results.size() << " results written to '" << results_file << "'" << endl ;
+
+   if ( argc > 2 )
+   {
+      const size_t num_regressions = CompareResults( results, baseline, threshold );
+      cout << endl << num_regressions << " regression(s)" << endl ;
+      if ( num_regressions > 0 )
+         return 1 ;
+   }
+   cout << "(checksum " << sink << ")" << endl ;
+   return 0 ;
+}
@@ -0,0 +1,265 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** polynomial approximations of transcendental functions, and the
+// ** math policies used by 'PSCMaps' ('MathStd' and 'MathFast')
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCFASTMATH_H
+#define PSCFASTMATH_H
+
+#include <cmath>
+
+#include "PSCSimd.h"   // SIMD lanes (class 'Pack')
+
+namespace PSCM
+{
+namespace fastmath
+{
+
+// -----------------------------------------------------------------------------
+// Functions in this namespace work on plain scalars (float, double) and on
+// 'simd::Pack' of them, with no branches (all lanes follow the same path).
+//
+// Each function reduces the argument to a small interval, where a polynomial
+// in x^2 is evaluated. The polynomial coefficients are minimax for the relative
+// error (obtained with a Remez exchange), with one set for floats and another
+// for doubles (long double uses the doubles set, so it has double accuracy).
+//
+// Max. error, in units in the last place (ULP), measured against long double
+// results for 10^6 arguments in the intervals given (see 'BenchFastMath' in 'Bench.cpp'):
+//
+//    function             interval        float    double
+//    sin, cos, sincos     [-pi,pi]         1.6       1.6
+//    tan                  [-1.5,1.5]       3.2       3.1
+//    asin                 [-1,1]           2.4       2.2
+//    atan                 [-50,50]         2.7       1.6
+//    atan2                (any)            3.1       2.7
+//
+// (the 'std' functions are within 1 ULP). sin/cos/tan use a three-part Cody-Waite
+// reduction by pi/2, which is accurate for the angles used in the maps (|x| <= pi),
+// and degrades for large arguments (|x| above 10^4 or so).
+
+template< class V > inline void sincos( const V x, V & sin_x, V & cos_x );
+template< class V > inline V    sin( const V x );
+template< class V > inline V    cos( const V x );
+template< class V > inline V    tan( const V x );
+template< class V > inline V    asin( const V x );
+template< class V > inline V    atan( const V x );
+template< class V > inline V    atan2( const V y, const V x );
+
+// -----------------------------------------------------------------------------
+// Horner's rule for a polynomial with 'N' coefficients (c[0] is the constant term)
+
+template< class V, class T, int N >
+inline V poly( const V z, const T (&c)[N] )
+{
+   V r = V( c[N-1] );
+   for( int i = N-2 ; 0 <= i ; i-- )
+      r = simd::fma( r, z, V( c[i] ) );
+   return r ;
+}
+// -----------------------------------------------------------------------------
+// sin and cos of 'x'
+
+template< class V >
+inline void sincos( const V x, V & sin_x, V & cos_x )
+{
+   typedef typename simd::ScalarOf<V>::type T ;
+   constexpr bool dbl = sizeof(T) > sizeof(float) ;
+
+   // sin(r) == r + r z S(z),  cos(r) == 1 - z/2 + z^2 C(z),  z == r^2, |r| <= pi/4
+   static constexpr float  sf[] = { -1.666665460954859099749e-01f, 8.332160761858978752955e-03f,
+                                    -1.951528319202803894184e-04f } ;
+   static constexpr float  cf[] = {  4.166664568297466106296e-02f, -1.388731625431866374753e-03f,
+                                     2.443315705399914543014e-05f } ;
+   static constexpr double sd[] = { -1.666666666666663067432e-01, 8.333333333322106163582e-03,
+                                    -1.984126982958047905595e-04, 2.755731361850332814014e-06,
+                                    -2.505074734629728176349e-08, 1.589620775187082547535e-10 } ;
+   static constexpr double cd[] = {  4.166666666666665133311e-02, -1.388888888888284432268e-03,
+                                     2.480158729463414349139e-05, -2.755731574120123352105e-07,
+                                     2.087589819501508903602e-09, -1.136801048106977233845e-11 } ;
+
+   // pi/2 in three parts (the first two have trailing zero bits)
+   const T pio2_1 = dbl ? T(1.57079625129699707031e+00) : T(1.5703125) ,
+           pio2_2 = dbl ? T(7.54978941586159635336e-08) : T(4.837512969970703125e-4) ,
+           pio2_3 = dbl ? T(5.39030285815811905290e-15) : T(7.54978995489188216e-8) ;
+
+   // reduction: x == q pi/2 + r
+   const V q = simd::round( x*V( T(0.63661977236758134308) ) ),
+           r = simd::fma( q, V(-pio2_3), simd::fma( q, V(-pio2_2), simd::fma( q, V(-pio2_1), x ))),
+           z = r*r ;
+
+   const V s = dbl ? simd::fma( r*z, poly( z, sd ), r ) : simd::fma( r*z, poly( z, sf ), r ),
+           c = dbl ? simd::fma( z*z, poly( z, cd ), simd::fma( z, V( T(-0.5) ), V( T(1.0) ) ))
+                   : simd::fma( z*z, poly( z, cf ), simd::fma( z, V( T(-0.5) ), V( T(1.0) ) )) ;
+
+   // quadrant: m == q mod 4, in {-2,-1,0,1,2} (-2 and 2 are the same, -1 is 3)
+   const V    m    = q - V( T(4.0) )*simd::round( q*V( T(0.25) ) ),
+              am   = simd::abs( m );
+   const auto odd  = simd::abs( am - V( T(1.0) ) ) < V( T(0.5) ),
+              neg_s = ( V( T(1.5) ) < am ) | ( m < V( T(-0.5) ) ),
+              neg_c = ( V( T(1.5) ) < am ) | ( V( T(0.5) ) < m ) ;
+
+   sin_x = simd::flip_sign( simd::select( odd, c, s ), neg_s );
+   cos_x = simd::flip_sign( simd::select( odd, s, c ), neg_c );
+}
+// -----------------------------------------------------------------------------
+
+template< class V >
+inline V sin( const V x )
+{
+   V s, c ;
+   sincos( x, s, c );
+   return s ;
+}
+// -----------------------------------------------------------------------------
+
+template< class V >
+inline V cos( const V x )
+{
+   V s, c ;
+   sincos( x, s, c );
+   return c ;
+}
+// -----------------------------------------------------------------------------
+
+template< class V >
+inline V tan( const V x )
+{
+   V s, c ;
+   sincos( x, s, c );
+   return s/c ;
+}
+// -----------------------------------------------------------------------------
+// arc sine, for x in [-1,1]
+
+template< class V >
+inline V asin( const V x )
+{
+   typedef typename simd::ScalarOf<V>::type T ;
+   constexpr bool dbl = sizeof(T) > sizeof(float) ;
+
+   // asin(a) == a + a z P(z),  z == a^2, |a| <= 1/2
+   static constexpr float  pf[] = { 1.666675248201030556835e-01f, 7.495297643050269410813e-02f,
+                                    4.547037598044050486882e-02f, 2.417951451479215630362e-02f,
+                                    4.216630880407099119024e-02f } ;
+   static constexpr double pd[] = { 1.666666666666540861177e-01, 7.500000000337086637357e-02,
+                                    4.464285682826955331282e-02, 3.038195913933023991927e-02,
+                                    2.237175799552970208660e-02, 1.735970556223212629405e-02,
+                                    1.388522787467018363648e-02, 1.216925951886303544562e-02,
+                                    6.527776333486972989553e-03, 1.952878884638820231455e-02,
+                                   -1.622504428052554923488e-02, 3.191279312537109117887e-02 } ;
+
+   const T pio2_hi = T(1.57079632679489655800e+00) ,  // pi/2 == pio2_hi + pio2_lo
+           pio2_lo = T(6.12323399573676603587e-17) ;
+
+   // above 1/2: asin(x) == pi/2 - 2 asin( sqrt( (1-x)/2 ) )
+   const V    ax  = simd::abs( x );
+   const auto big = V( T(0.5) ) < ax ;
+   const V    z   = simd::select( big, V( T(0.5) )*( V( T(1.0) ) - ax ), ax*ax ),
+              a   = simd::select( big, simd::sqrt( z ), ax ),
+              p   = dbl ? simd::fma( a*z, poly( z, pd ), a ) : simd::fma( a*z, poly( z, pf ), a ),
+              r   = simd::select( big, V( pio2_hi ) - ( V( T(2.0) )*p - V( pio2_lo ) ), p );
+
+   return simd::flip_sign( r, x < V( T(0.0) ) );
+}
+// -----------------------------------------------------------------------------
+// arc tangent
+
+template< class V >
+inline V atan( const V x )
+{
+   typedef typename simd::ScalarOf<V>::type T ;
+   constexpr bool dbl = sizeof(T) > sizeof(float) ;
+
+   // atan(a) == a + a z P(z),  z == a^2, |a| <= tan(pi/8)
+   static constexpr float  pf[] = { -3.333294913864366479806e-01f, 1.997771002598072107579e-01f,
+                                    -1.387767873682417525216e-01f, 8.053722696575859658934e-02f } ;
+   static constexpr double pd[] = { -3.333333333333015048529e-01, 1.999999999908888949438e-01,
+                                    -1.428571419525585912090e-01, 1.111110665337052188167e-01,
+                                    -9.090782407630143824838e-02, 7.690068235542431228607e-02,
+                                    -6.641120652694710442510e-02, 5.692536295663785005300e-02,
+                                    -4.359087798104321728306e-02, 2.125975690114006509472e-02 } ;
+
+   const T pio2_hi = T(1.57079632679489655800e+00) ,  // pi/2 == pio2_hi + pio2_lo
+           pio2_lo = T(6.12323399573676603587e-17) ;
+
+   // above tan(3pi/8): atan(x) == pi/2 + atan(-1/x),
+   // above tan(pi/8):  atan(x) == pi/4 + atan((x-1)/(x+1))
+   const V    ax  = simd::abs( x );
+   const auto big = V( T(2.41421356237309504880) ) < ax ,
+              mid = V( T(0.41421356237309504880) ) < ax ;
+   const V    one = V( T(1.0) ),
+              a   = simd::select( big, -one/ax, simd::select( mid, (ax-one)/(ax+one), ax ) ),
+              hi  = simd::select( big, V( pio2_hi ), simd::select( mid, V( T(0.5)*pio2_hi ), V( T(0.0) ) ) ),
+              lo  = simd::select( big, V( pio2_lo ), simd::select( mid, V( T(0.5)*pio2_lo ), V( T(0.0) ) ) ),
+              z   = a*a ,
+              p   = dbl ? simd::fma( a*z, poly( z, pd ), a ) : simd::fma( a*z, poly( z, pf ), a ),
+              r   = hi + ( p + lo );
+
+   return simd::flip_sign( r, x < V( T(0.0) ) );
+}
+// -----------------------------------------------------------------------------
+// arc tangent of y/x, in [-pi,pi] (it is 0 when both are 0)
+
+template< class V >
+inline V atan2( const V y, const V x )
+{
+   typedef typename simd::ScalarOf<V>::type T ;
+
+   const V zero = V( T(0.0) ),
+           pi   = V( T(M_PI) ),
+           r    = atan( y/x ) + simd::select( x < zero, simd::flip_sign( pi, y < zero ), zero );
+
+   return simd::select( simd::max( simd::abs( x ), simd::abs( y ) ) <= zero, zero, r );
+}
+
+} // ends namespace fastmath
+
+// -----------------------------------------------------------------------------
+// Math policies: the functions used by 'PSCMaps' for evaluating sin, cos, tan,
+// asin, atan and atan2, on scalars and on packs ('V' is 'T' or a 'simd::Pack<T>').
+// 'MathStd' uses the standard library (lane by lane on packs), 'MathFast' uses
+// the polynomial approximations above.
+
+struct MathStd
+{
+   template< class V > static inline V    sin( const V x )   { return simd::sin( x ); }
+   template< class V > static inline V    cos( const V x )   { return simd::cos( x ); }
+   template< class V > static inline V    tan( const V x )   { return simd::tan( x ); }
+   template< class V > static inline V    asin( const V x )  { return simd::asin( x ); }
+   template< class V > static inline V    atan( const V x )  { return simd::atan( x ); }
+   template< class V > static inline V    atan2( const V y, const V x ) { return simd::atan2( y, x ); }
+   template< class V > static inline void sincos( const V x, V & s, V & c )
+      { s = simd::sin( x ); c = simd::cos( x ); }
+} ;
+
+struct MathFast
+{
+   template< class V > static inline V    sin( const V x )   { return fastmath::sin( x ); }
+   template< class V > static inline V    cos( const V x )   { return fastmath::cos( x ); }
+   template< class V > static inline V    tan( const V x )   { return fastmath::tan( x ); }
+   template< class V > static inline V    asin( const V x )  { return fastmath::asin( x ); }
+   template< class V > static inline V    atan( const V x )  { return fastmath::atan( x ); }
+   template< class V > static inline V    atan2( const V y, const V x ) { return fastmath::atan2( y, x ); }
+   template< class V > static inline void sincos( const V x, V & s, V & c )
+      { fastmath::sincos( x, s, c ); }
+} ;
+
+} // ends namespace PSCM
+
+#endif // ends #ifndef PSCFASTMATH_H
@@ -21,6 +21,8 @@
 #define PSCMAPS_H
 
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
 #include <cmath>
 #include <iostream>
 #include <iomanip>   // std::setprecision
@@ -30,7 +32,11 @@
 #include <cmath>
 #include <string>
 #include <fstream>
+#include <mutex>
 
+#include "PSCSimd.h"     // SIMD lanes (class 'Pack')
+#include "PSCFastMath.h" // math policies ('MathStd', 'MathFast')
+#include "PSCTrace.h"    // trace of slow evaluations ('Tracing' policy)
 
 namespace PSCM
 {
@@ -40,13 +46,106 @@ namespace PSCM
 
 template< class T > using FuncType = std::function< T(T) > ;
 
+// a function value along with its derivative (T can be a scalar or a 'simd::Pack')
+template< class T > struct ValDer
+{
+   T value, // function value
+     der ;  // derivative value
+} ;
+
 // -----------------------------------------------------------------------------
 // constants (evaluated at compile time)
 
 // controls whether  assertions are checked
-// (it also prevents tracing from actually happening)
 constexpr bool do_checks = true ;
 
+// -----------------------------------------------------------------------------
+// Checking policies (third template parameter of 'PSCMaps')
+//
+//   Checked   : assertions are checked when 'do_checks' is true. This is the default.
+//   Counting  : no assertions, but each value clamped to its range by the
+//               scalar evaluation functions is counted, in the counters of the
+//               calling thread (see 'clamp_counters'), and statistics of the
+//               iterative inversions are collected (see 'inversion_stats').
+//   Tracing   : no assertions, but the scalar inversions and the initializations
+//               are timed, and the slow or non-converged ones are recorded in
+//               the trace of the calling thread (see 'PSCTrace.h').
+//   Unchecked : no assertions, no counters and no tracing.
+
+struct Checked   { static constexpr bool checks = do_checks, counts = false, traces = false ; } ;
+struct Counting  { static constexpr bool checks = false,     counts = true,  traces = false ; } ;
+struct Tracing   { static constexpr bool checks = false,     counts = false, traces = true  ; } ;
+struct Unchecked { static constexpr bool checks = false,     counts = false, traces = false ; } ;
+
+// number of values clamped (when they were off-range), by function
+struct ClampCounters
+{
+   unsigned long long
+      y ,            // 'check_y' (parallel map: y out of [0,y_limit])
+      theta ,        // 'check_theta' and 'eval_rmin_rmax' (radial map: angle out of [0,theta_max])
+      Ap_inverse ,   // 'eval_Ap_inverse' (area out of [0,F/2], or result out of [0,y_max])
+      Ar_inverse ,   // 'eval_Ar_inverse' (area out of [0,F/2], or result out of [0,theta_max])
+      ArE_inverse ;  // 'eval_ArE_inverse' (area out of [0,E])
+
+   void reset() { y = theta = Ap_inverse = Ar_inverse = ArE_inverse = 0 ; }
+   unsigned long long total() const { return y + theta + Ap_inverse + Ar_inverse + ArE_inverse ; }
+} ;
+
+// returns the counters of the calling thread (updated by the 'Counting' policy)
+inline ClampCounters & clamp_counters()
+{
+   static thread_local ClampCounters counters = { 0, 0, 0, 0, 0 } ;
+   return counters ;
+}
+
+// number of bins in the histograms of iteration counts
+// (the last bin also holds the inversions with more iterations)
+constexpr int num_iters_bins = 24 ;
+
+// geometric cases of a cap (indexes in 'InversionStats::cases')
+enum CapCase { case_ellipse_only = 0, case_ellipse_lune = 1, case_lune_only = 2, num_cap_cases = 3 } ;
+
+// statistics of the iterative inversions, for one map and one geometric case
+struct InversionCaseStats
+{
+   unsigned long long
+      inversions ,            // inversions done ('InverseNSB' calls, or active lanes in 'InverseNSB_lanes')
+      iters[num_iters_bins] , // histogram of the number of iterations of the inversions
+      interval_steps ,        // steps which fell back to the interval (newton step out of it, or NaN)
+      nan_steps ,             // newton steps which were NaN (also counted in 'interval_steps')
+      max_iters_exits ,       // inversions stopped by 'max_iters' (not converged)
+      parabola ;              // 'eval_Ar_inverse' results from the small lune parabola (no iterations)
+
+   void add( const InversionCaseStats & other );
+   double mean_iters() const ; // (inversions in the last bin count as 'num_iters_bins-1')
+} ;
+
+// statistics of the iterative inversions, by map and geometric case
+struct InversionStats
+{
+   InversionCaseStats cases[2][num_cap_cases] ; // first index: 0 parallel map, 1 radial map
+
+   void reset() { *this = InversionStats() ; }
+   void add( const InversionStats & other );
+
+   // prints a table with one line for each map and case with any inversion or
+   // parabola, and the histograms of the iteration counts
+   void print( std::ostream & os ) const ;
+} ;
+
+// returns the statistics of the calling thread (updated by the 'Counting' policy)
+inline InversionStats & inversion_stats() ;
+
+// adds the statistics of the calling thread to the totals shared by all the
+// threads, and resets them (this is also done when a thread ends)
+inline void flush_inversion_stats() ;
+
+// returns the totals (the statistics flushed by all the threads so far)
+inline InversionStats total_inversion_stats() ;
+
+// resets the totals
+inline void reset_total_inversion_stats() ;
+
 // when do_checks == true, used to control when two values are approximately equal
 constexpr auto epsilon = 1e-6 ;
 
@@ -56,12 +155,57 @@ constexpr double ini_iN_tolerance = 1e-4 ;
 // initial value for the max number of iterations in the inverse newton func.
 constexpr int ini_iN_max_iters = 20 ;
 
+// max. value for the max number of iterations in the inverse newton func.
+constexpr int max_iN_max_iters = 0xFFFF ;
+
+// -----------------------------------------------------------------------------
+// settings for the iterative inversion of the area functions
+//
+// Each maps object keeps its own copy (given to 'initialize'), which is not
+// changed afterwards. Thus, objects used by different threads (or by different
+// integrators) can use different settings, and the inversions do not read
+// any global state.
+
+template< class T > struct InversionConfig
+{
+   T    tolerance ;  // tolerance for inverse newton (max. |F(t)-A|, normalized)
+   int  max_iters ;  // max iters. for inv. Newton (at most 'max_iN_max_iters')
+   bool trace ;      // record all the evaluations, not only the slow ones (only with the 'Tracing' policy)
+
+   InversionConfig( const T    p_tolerance = T(ini_iN_tolerance),
+                    const int  p_max_iters = ini_iN_max_iters,
+                    const bool p_trace     = false )
+      : tolerance( p_tolerance ), max_iters( p_max_iters ), trace( p_trace ) {}
+
+   // prints the settings
+   void print() const ;
+} ;
+
 // -----------------------------------------------------------------------------
 // A class for projected spherical cap maps evaluation state
 
-template< typename T>  // T == float, double, long double, etc....
+template< typename T > class PSCMapsTabulated ; // see 'PSCMapsTabulated.h'
+template< typename T > class PSCMapsBaked ;     // see 'PSCMapsBaked.h'
+template< typename T > class PSCMapsSoA ;       // see 'PSCMapsSoA.h'
+template< class Math > class PSCMapsMixed ;     // see 'PSCMapsMixed.h'
+class BakedInverseTable ;                       // see 'PSCMapsBaked.h'
+
+template< typename T,               // T == float, double, long double, etc....
+          class Math  = MathStd ,     // transcendental functions (see 'PSCFastMath.h')
+          class Check = Checked >     // checking policy (see above)
 class PSCMaps
 {
+   // these use the private evaluation functions, with their own inverse functions
+   template< typename > friend class PSCMapsTabulated ;
+   template< typename > friend class PSCMapsBaked ;
+   friend class BakedInverseTable ;
+
+   // this one stores the state of many objects, column-wise
+   template< typename > friend class PSCMapsSoA ;
+
+   // this one refines the results of a float object with a double object
+   template< class > friend class PSCMapsMixed ;
+
    public:
 
    // Creates an uninitialized 'empty' object (not usable)
@@ -71,12 +215,102 @@ class PSCMaps
    // p_alpha and p_beta are the angles defining the spherical cap (see paper)
    // it must hold: 0 < p_alpha
    // p_use_radial == true --> use radial map, == false --> use parallel map
-   void initialize( const T p_alpha, const T p_beta, const bool p_use_radial );
+   // p_config: settings for the iterative inversions done by this object
+   void initialize( const T p_alpha, const T p_beta, const bool p_use_radial,
+                    const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // Initializes this maps object from the sines and cosines of alpha and beta
+   // (as 'initialize', but without evaluating any trigonometric function)
+   // it must hold: 0 <= p_sin_alpha, 0 <= p_cos_alpha and 0 <= p_cos_beta
+   void initialize_sincos( const T p_sin_alpha, const T p_cos_alpha,
+                           const T p_sin_beta, const T p_cos_beta, const bool p_use_radial,
+                           const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // Initializes this maps object from the geometry, given in any reference frame
+   // (e.g. world coordinates): 'center' is the sphere center relative to the
+   // shading point, 'radius' is the sphere radius and 'normal' is the (unit
+   // length) normal at the shading point. It also computes the X and Y axes of
+   // the local frame ('vx' and 'vy', the Z axis is 'normal'), so a sample
+   // direction is x*vx + y*vy + sqrt(1-x^2-y^2)*normal. No trigonometric
+   // function is evaluated
+   void initialize_geometric( const T center[3], const T radius, const T normal[3],
+                              const bool p_use_radial, T vx[3], T vy[3],
+                              const InversionConfig<T> & p_config = InversionConfig<T>() );
 
    // evaluates one of the two maps (according to 'using_radial')
    // (s,t) must be in [0,1]^2
    void eval_map( T s, T t, T &x, T &y ) const ;
 
+   // evaluates the map for (s,t) and for its antithetic sample (s,1-t), that is
+   // (s,t) --> (x0,y0) and (s,1-t) --> (x1,y1). Both maps fold 't' around 1/2
+   // and invert |2t-1|, so the second sample is the first one mirrored about
+   // the X axis (x1 == x0, y1 == -y0), and it needs no additional inversion
+   void eval_map_pair( T s, T t, T &x0, T &y0, T &x1, T &y1 ) const ;
+
+   // evaluates the map for 'n' samples stored in structure-of-arrays form,
+   // that is (s[i],t[i]) --> (x[i],y[i]), for i in [0,n)
+   // (per-cap decisions and checks are done once for the whole batch)
+   // all (s[i],t[i]) must be in [0,1]^2
+   void eval_map_batch( const T * s, const T * t, T * x, T * y, const size_t n ) const ;
+
+   // evaluates the map for 'n' samples and for their antithetic samples, that is
+   // (s[i],t[i]) --> (x[i],y[i]) and (s[i],1-t[i]) --> (x[n+i],y[n+i]), for i in [0,n)
+   // (as in 'eval_map_pair', the inversions are only done for the first 'n' samples),
+   // 'x' and 'y' must have room for 2n values
+   void eval_map_antithetic( const T * s, const T * t, T * x, T * y, const size_t n ) const ;
+
+   // evaluates the map for the points 'first' to 'first+n-1' of the sequence 'seq'
+   // (see 'PSCSequences.h'), that is seq(first+i) --> (x[i],y[i]), for i in [0,n)
+   // (the points are generated in small blocks, each one passed to 'eval_map_batch')
+   template< class Seq >
+   void eval_map_sequence( const Seq & seq, const size_t first, const size_t n, T * x, T * y ) const ;
+
+   // evaluates the map for a stratified grid with 'nx' columns (along s) and 'ny'
+   // rows (along t), the sample in column 'i' and row 'j' is:
+   //    s = (i+jitter_s[j*nx+i])/nx ,   t = (j+jitter_t[j])/ny
+   // and its (x,y) are written in x[j*nx+i] and y[j*nx+i]. All the samples in a
+   // row share 't', so the inversion (and the interval of x or r) is computed
+   // once per row (in the ellipse only case with the radial map, where there is
+   // no inversion, the whole grid is evaluated as a batch). 'jitter_s' has nx*ny values and 'jitter_t' has ny values, all
+   // of them in [0,1], when either is nullptr, 0.5 is used (centers of the cells)
+   void eval_grid( const size_t nx, const size_t ny, const T * jitter_s, const T * jitter_t,
+                   T * x, T * y ) const ;
+
+   // evaluates the map for 'n' samples, (s[i],t[i]) --> (x,y), and converts them
+   // to unit directions in the reference frame of 'vx', 'vy' and 'normal' (see
+   // 'initialize_geometric'), that is: x*vx + y*vy + sqrt(1-x^2-y^2)*normal,
+   // written in (dir_x[i],dir_y[i],dir_z[i]). When 'pdf' is not nullptr, pdf[i] is
+   // the probability density of the direction w.r.t. solid angle, which is
+   // cos(theta)/area (cos(theta) == sqrt(1-x^2-y^2), the density w.r.t. projected
+   // solid angle is 1/area). The sphere must not be invisible
+   void eval_directions( const T * s, const T * t, const size_t n,
+                         const T vx[3], const T vy[3], const T normal[3],
+                         T * dir_x, T * dir_y, T * dir_z, T * pdf ) const ;
+
+   // initializes this maps object from the geometry (as 'initialize_geometric'),
+   // and then evaluates 'n' directions (as 'eval_directions'), in a single call.
+   // Returns false (and writes nothing) when the sphere is invisible
+   bool sample_directions( const T center[3], const T radius, const T normal[3],
+                           const bool p_use_radial, const T * s, const T * t, const size_t n,
+                           T * dir_x, T * dir_y, T * dir_z, T * pdf,
+                           const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // evaluates the inverse of the map (according to 'using_radial'), that is,
+   // computes (s,t) in [0,1]^2 such that 'eval_map' maps (s,t) to (x,y). (x,y)
+   // must be in the projected cap (see 'contains_and_pdf'), for other points
+   // (s,t) is clamped. This needs no iteration: only the area function (Ap or
+   // Ar) and the interval of x or r are evaluated
+   void inverse_map( T x, T y, T &s, T &t ) const ;
+
+   // for 'n' unit directions (dir_x[i],dir_y[i],dir_z[i]), given in the reference
+   // frame of 'vx', 'vy' and 'normal' (see 'initialize_geometric'), writes in
+   // pdf[i] the probability density of sampling the direction w.r.t. solid angle
+   // with the maps, that is, cos(theta)/area when the direction is in the
+   // spherical cap (and above the horizon), and 0 otherwise (as needed for
+   // multiple importance sampling). Directions are processed in SIMD packs
+   void contains_and_pdf( const T * dir_x, const T * dir_y, const T * dir_z, const size_t n,
+                          const T vx[3], const T vy[3], const T normal[3], T * pdf ) const ;
+
    // returns the area of the projected spherical cap (straight inline returns)
    inline T get_area() const;
 
@@ -87,6 +321,9 @@ class PSCMaps
    // true if the radial map is in use
    inline bool is_using_radial() const ;
 
+   // settings for the inversions (given to 'initialize')
+   inline InversionConfig<T> get_inversion_config() const ;
+
    // query spherical map status (straight inline returns)
    inline bool is_fully_visible() const ;     // true iif  0 <= alpha <= beta  (sphere fully visible)
    inline bool is_partially_visible() const ; // true iif  -alpha <= beta <= alpha (sphere partially visible)
@@ -109,11 +346,13 @@ class PSCMaps
    T eval_Ap( T y ) const;           // evals. Ap (see eq. 15) (y in [0,ey])
    T eval_par_integrand( T y ) const;// evals. integrand of eq. 12 (y in [0,ey])
    T eval_Ap_inverse( T Ap ) const ; // evals. Ap inverse (Ap in [0,area/2]), iteratively
+   ValDer<T> eval_Ap_with_integrand( T y ) const ; // evals. Ap and the integrand together (y in [0,ey])
 
    // evals the radial integral (Ar), the integrand and inverse integral (Ar^{-1))
    T eval_Ar( T theta ) const ;            // evals. Ar (see eq. 23) (theta in [0,PI])
    T eval_rad_integrand( T theta ) const ; // evals. integrand of eq 20 (theta in [0,PI])
    T eval_Ar_inverse( T Ar_value ) const ; // evals. Ar inverse (Ar in [0,area/2]), iteratively (when needed)
+   ValDer<T> eval_Ar_with_integrand( T theta ) const ; // evals. Ar and the integrand together (theta in [0,PI])
 
 
    // test the area integrals: compares numerical and analytical integration
@@ -129,8 +368,42 @@ class PSCMaps
    inline void ensure_using_radial() const ;
    inline void ensure_using_parallel() const ;
 
+   // geometric case of the cap (ellipse only, ellipse+lune or lune only)
+   inline CapCase get_cap_case() const ;
+
+   // statistics of the calling thread for this map and geometric case
+   // (null unless the checking policy is 'Counting', see 'inversion_stats')
+   inline InversionCaseStats * get_case_stats() const ;
+
+   // records an evaluation in the trace of the calling thread, when it took at
+   // least the time threshold, when it did not converge, or when 'trace_inversion'
+   // is set ('area' is normalized, see 'TraceRecord')
+   void trace_evaluation( const TraceKind kind, const T area, const TraceTimer & timer ) const ;
+
+   // times the evaluation in which it is created, and calls 'trace_evaluation'
+   // when it ends (only with the 'Tracing' policy, otherwise it does nothing)
+   struct TraceScope
+   {
+      const PSCMaps &  maps ;
+      const TraceKind  kind ;
+      const T          area ;
+      const TraceTimer timer ;
+
+      TraceScope( const PSCMaps & p_maps, const TraceKind p_kind, const T p_area )
+         : maps( p_maps ), kind( p_kind ), area( p_area ), timer( Check::traces )
+      {
+         if ( Check::traces )
+            trace_scratch().begin_evaluation();
+      }
+      ~TraceScope()
+      {
+         if ( Check::traces )
+            maps.trace_evaluation( kind, area, timer );
+      }
+   } ;
+
    // aux. methods
-   void compute_ELF_xlyl_phi_l();
+   void compute_ELF_yl_phi_l( const T xl );
 
    // --------------------------------------------------------------------------
    // Horizontal map related methods:
@@ -158,6 +431,12 @@ class PSCMaps
    // ('using_radial' must be false, (s,t) must be in [0,1]^2 )
    void hor_map( T s, T t, T &x, T &y ) const; // see equations 18 and 19
 
+   // horizontal map for a single sample, without the per-cap checks
+   void hor_map_sample( T s, T t, T &x, T &y ) const ;
+
+   // last step of the horizontal map, once 'y_pos' has been computed from 't'
+   void hor_map_from_y( T s, bool y_is_neg, T y_pos, T &x, T &y ) const ;
+
    // --------------------------------------------------------------------------
    // Radial map
 
@@ -186,30 +465,99 @@ class PSCMaps
    // ('using_radial' must be true, (s,t) must be in [0,1]^2 )
    void rad_map( T s, T t, T &x, T &y ) const ;
 
+   // radial map for a single sample, without the per-cap checks
+   void rad_map_sample( T s, T t, T &x, T &y ) const ;
+
+   // last step of the radial map, once 'varphi' and [rmin,rmax] have been computed
+   void rad_map_from_angle( T s, bool angle_is_neg, T varphi,
+                            T rmin, T rmax, bool scaled, T &x, T &y ) const ;
+
+   // evaluates one row of the grid in 'eval_grid' (either map), for 't' and 'nx'
+   // samples, with s = (i+jitter_s[i])/nx (or (i+0.5)/nx when 'jitter_s' is nullptr)
+   void grid_row( T t, const size_t nx, const T * jitter_s, T * x, T * y ) const ;
+
+   // converts the (x,y) positions in 'dir_x' and 'dir_y' to directions (in place),
+   // for as many samples as lanes in V (see 'eval_directions')
+   template< class V >
+   void directions_lanes( const T vx[3], const T vy[3], const T normal[3], const T inv_area,
+                          T * dir_x, T * dir_y, T * dir_z, T * pdf ) const ;
+
+   // evaluates 'contains_and_pdf' for as many directions as lanes in V
+   template< class V >
+   void contains_and_pdf_lanes( const T * dir_x, const T * dir_y, const T * dir_z,
+                                const T vx[3], const T vy[3], const T normal[3],
+                                const T inv_area, T * pdf ) const ;
+
+   // radial map for 'n' samples in the ellipse only case (no iteration is needed)
+   void rad_map_ellipse_batch( const T * s, const T * t, T * x, T * y, const size_t n ) const ;
+   template< class V >
+   void rad_map_ellipse_lanes( const T * s, const T * t, T * x, T * y ) const ;
+
+   // --------------------------------------------------------------------------
+   // SIMD versions of the functions above: each one processes as many values
+   // as lanes in V == simd::Pack<T>. Per-lane branches are replaced by blends,
+   // and values slightly off-range are clamped (per-lane checks are not done).
+   // Lanes not in 'active' are padding: they are evaluated, but not counted
+   // in the statistics of the 'Counting' policy
+
+   template< class V > V    eval_xEll_lanes( V y ) const ;
+   template< class V > V    eval_xCir_lanes( V y ) const ;
+   template< class V > void eval_xmin_xmax_lanes( V y, V & xmin, V & xmax ) const ;
+   template< class V > V    eval_Ap_inverse_lanes( V Ap_value, const simd::Mask<T> & active ) const ;
+
+   template< class V > V    eval_rEll_lanes( V theta ) const ;
+   template< class V > V    eval_rCirc_lanes( V theta ) const ;
+   template< class V > void eval_rmin_rmax_lanes( V theta, V & rmin, V & rmax ) const ;
+   template< class V > V    eval_ArE_inverse_lanes( V Ar_value ) const ;
+   template< class V > V    eval_Ar_inverse_lanes( V Ar_value, const simd::Mask<T> & active ) const ;
+
+   // evaluate Ap or Ar along with their integrands (which are their derivatives),
+   // used by the inverse functions. These work both on packs and on scalars
+   // (V == T), and are used by the scalar versions, after checks.
+   template< class V > ValDer<V> eval_Ap_with_integrand_lanes( V y ) const ;
+   template< class V > ValDer<V> eval_Ar_with_integrand_lanes( V theta ) const ;
+   template< class V > void      eval_ArE_half_re_sq_lanes( V theta, V sin_theta, V cos_theta, V & ArE, V & half_re_sq ) const ;
+
+   // evaluate the horizontal map or the radial map (partially visible case
+   // only) for as many samples as lanes in V
+   template< class V > void hor_map_lanes( const T * s, const T * t, T * x, T * y, const simd::Mask<T> & active ) const ;
+   template< class V > void rad_map_lanes( const T * s, const T * t, T * x, T * y, const simd::Mask<T> & active ) const ;
+
+   // evaluate 'n' samples by using the functions above (see 'eval_map_batch')
+   void map_lanes_batch( const T * s, const T * t, T * x, T * y, const size_t n ) const ;
+   void rad_map_grouped_batch( const T * s, const T * t, T * x, T * y, const size_t n ) const ;
+
    // --------------------------------------------------------------------------
 
+   // --------------------------------------------------------------------------
+   // state: the fields read by the maps come first, so all of them are in the
+   // first 64 bytes for T == float, and in the first 128 for T == double (one
+   // or two cache lines, when the object is stored at a 64 bytes aligned
+   // address). Values which are only needed in 'initialize' are not stored.
+   // The class is not declared 'alignas(64)': before C++17, 'operator new'
+   // and 'std::allocator' ignore it, and the objects in a 'std::vector' (or
+   // embedded in other heap objects) would be misaligned.
+
    bool // values defining the spherical cap type, and which map is being used
-      initialized ,      // true if the sampler has been initialized
-      fully_visible,     // true iif r <= cz     (sphere fully visible)
-      partially_visible, // true iif -r < cz < r (sphere partially visible)
-      center_below_hor,  // true iif -r <= cz < 0 (partially visible and sphere center below horizon)
-      invisible ,        // true iif cz <= -r    (sphere completely invisible)
-      using_radial;      // true when using radial map, false when using horizontal map
+      initialized       : 1, // true if the sampler has been initialized
+      fully_visible     : 1, // true iif r <= cz     (sphere fully visible)
+      partially_visible : 1, // true iif -r < cz < r (sphere partially visible)
+      center_below_hor  : 1, // true iif -r <= cz < 0 (partially visible and sphere center below horizon)
+      invisible         : 1, // true iif cz <= -r    (sphere completely invisible)
+      using_radial      : 1, // true when using radial map, false when using horizontal map
+      trace_inversion   : 1; // record all the traced evaluations (see 'InversionConfig')
+
+   uint16_t
+      iN_max_iters ;         // max. number of iterations of the inversions (see 'InversionConfig')
 
    T // areas (form factors)
-      E,      // half of the ellipse area
-      L ,     // half lune area, (it is 0 in the 'ellipse only' case)
-      F ;     // total form factor: it is:
+      F ,     // total form factor: it is:
               //    0 -> when invisible
               //    2E -> when fully_visible (ellipse only)
               //    2L -> when partially_visible and center_below_hor (lune only)
               //    2(E+L) -> otherwise (partially_visible and not center_below_hor)
-
-   T  // sinus and cosine of beta
-      cos_beta,
-      cos_beta_sq,
-      sin_beta,
-      sin_beta_abs ;
+      E,      // half of the ellipse area
+      L ;     // half lune area, (it is 0 in the 'ellipse only' case)
 
    T  // parameters defining the ellipse
       xe ,    // X coord. of ellipse center in the local reference frame
@@ -217,41 +565,23 @@ class PSCMaps
       ay ;    // ellipse semi-major axis (Y direction)
 
    T // some precomputed constants
-      axay2 , // == (ax*ay)/2
-      ay_sq , // == ay^2
-      xe_sq , // == xe^2
-      r1maysq ; // root of (1-ay^2)
+      axay2 ,        // == (ax*ay)/2
+      ay_sq ,        // == ay^2
+      xe_sq ,        // == xe^2
+      cos_beta_sq ,  // == cos(beta)^2
+      sin_beta_abs ; // == |sin(beta)|
 
    T // parameters computed only when partially_visible ( there are tangency points)
-      xl,        // X coord. of tangency point p (>0)
       yl ,       // Y coord. of tangency point p (>0)
       phi_l,     // == arctan(yl/(xe-xl)), only if 'using_radial' (and 'partially_visible')
       AE_phi_l ; // == A_E(phi_l), , only if 'using_radial' (and 'partially_visible')
 
-} ;  // end class PSCMaps
-
-// -----------------------------------------------------------------------------
-// class 'global' vars and constants (all members are static)
-
-template< class T > class Vars
-{
-   public:
-
-   static T
-      iN_tolerance ; // tolerance for inverse newton....
-   static int
-      iN_max_iters ; // max iters. for inv. Newton
-   static bool
-      trace_newton_inversion ;
-
-   static void print_settings();
-} ;
+   T  iN_tolerance ; // tolerance of the inversions (see 'InversionConfig')
 
-// initialization of global vars
+} ;  // end class PSCMaps
 
-template< class T > bool  Vars<T>::trace_newton_inversion = false ;
-template< class T > T     Vars<T>::iN_tolerance           = T(ini_iN_tolerance) ;
-template< class T > int   Vars<T>::iN_max_iters           = ini_iN_max_iters ;
+// the state of a float maps object fits in 64 bytes (a cache line)
+static_assert( sizeof( PSCMaps<float> ) == 64, "PSCMaps<float> state does not fit in a cache line" );
 
 // *****************************************************************************
 // aux. functions
@@ -259,16 +589,53 @@ template< class T > int   Vars<T>::iN_max_iters           = ini_iN_max_iters ;
 // --------------------------------------------------------------------------
 // eval I function, according to expression 17 in the paper
 
-template< class T >
+template< class T, class Math = MathStd, class Check = Checked >
 T eval_I( T u, T w ) ;
 
+// -----------------------------------------------------------------------------
+// Step rules for the inversion (compile-time policies for 'InverseNSB')
+//
+// Each rule computes the next estimation from the current state (the value
+// 'tn', the interval [tn_min,tn_max] known to hold the result, and the
+// differences F(tn)-A at the interval extremes), and updates the interval.
+
+// state of an inversion (shared by all step rules)
+template< class T > struct InverseState
+{
+   T    tn ,           // current best estimation of result value 't'
+        tn_min ,       // current interval: minimum value
+        tn_max ,       // current interval: maximum value
+        diff_tn_min ,  // == F(tn_min) - A, (always negative)
+        diff_tn_max ;  // == F(tn_max) - A, (always positive)
+   int  side ;         // extreme kept in the last two steps (-1 min, +1 max, 0 none), for 'StepSecant'
+   bool interval_step; // true when the last step was computed from the interval (not a newton step)
+} ;
+
+// hybrid: newton steps, and interval midpoint when the newton step is out of
+// the interval (or NaN). This is the default rule
+struct StepHybrid    { static constexpr bool uses_derivative = true ;
+                       template< class T > static T next( InverseState<T> & st, const T diff, const T ftn ); } ;
+
+// newton steps only, the result is just clamped to the initial interval
+struct StepNewton    { static constexpr bool uses_derivative = true ;
+                       template< class T > static T next( InverseState<T> & st, const T diff, const T ftn ); } ;
+
+// interval bisection (always converges, linearly)
+struct StepBisection { static constexpr bool uses_derivative = false ;
+                       template< class T > static T next( InverseState<T> & st, const T diff, const T ftn ); } ;
+
+// regula falsi (secant on the interval extremes), with the 'Illinois'
+// modification to avoid one extreme being kept for ever
+struct StepSecant    { static constexpr bool uses_derivative = false ;
+                       template< class T > static T next( InverseState<T> & st, const T diff, const T ftn ); } ;
+
 // -----------------------------------------------------------------------------
 // InverseNSB
 //
 // evaluate the inverse of a function whose derivative is > 0
 //  Uses Newton method for root finding when possible,
 //  and a combination of Binary search  and Secant methods
-//  (at each step the best option is selected)
+//  (the method is selected by the 'Step' rule, see above)
 //
 // returns the value 't' (in the range [0,t_max]) such that F(t) = Aobj
 // it is assumed that F(t) in [0,A_max] for t in [0,t_max]
@@ -282,10 +649,51 @@ T eval_I( T u, T w ) ;
 //    Aobj : desired value of F(t)
 //    A_max: maximum value for A (minimum is 0.0)
 //
+// F and f can be any callables (T -> T), they are not type-erased, so they are
+// inlined when possible ('f' is not called when the step rule does not use it)
+//
+// With the 'Counting' policy, the iterations, interval steps, NaN steps and
+// exits at 'max_iters' are added to 'stats' (when it is not null)
 
-template< class T >
-T InverseNSB( FuncType<T> F, FuncType<T> f,
-              const T t_max, const T Aobj, const T A_max ) ;
+template< class T, class Step = StepHybrid, class Check = Checked, class FuncF, class Funcf >
+T InverseNSB( const FuncF & F, const Funcf & f,
+              const T t_max, const T Aobj, const T A_max,
+              const InversionConfig<T> & config = InversionConfig<T>(),
+              InversionCaseStats * stats = nullptr ) ;
+
+// -----------------------------------------------------------------------------
+// InverseNSB_fused
+//
+// same as 'InverseNSB', but F and f are evaluated by a single callable 'FD'
+// (T -> ValDer<T>) which returns both values for the same 't', so their common
+// subexpressions are computed once per iteration
+//    FD : callable returning F(t) and f(t) (in 'value' and 'der')
+
+template< class T, class Step = StepHybrid, class Check = Checked, class FuncFD >
+T InverseNSB_fused( const FuncFD & FD,
+                    const T t_max, const T Aobj, const T A_max,
+                    const InversionConfig<T> & config = InversionConfig<T>(),
+                    InversionCaseStats * stats = nullptr ) ;
+
+// -----------------------------------------------------------------------------
+// InverseNSB_lanes
+//
+// lane-parallel version of 'InverseNSB' (with 'StepHybrid' steps): computes
+// the inverse for as many targets 'Aobj' as lanes in a 'simd::Pack<T>', in lockstep.
+// Each lane keeps its own interval [tn_min,tn_max], and lanes are masked off
+// as they converge, so each lane gets the same result as 'InverseNSB' would
+// produce. Iterations stop when all the lanes have converged (or when
+// config.max_iters is exceeded). Lanes not in 'active' are returned as 0.
+// With the 'Counting' policy, each active lane is added to 'stats' as one
+// inversion (when it is not null).
+//    FD : callable from packs to ValDer<Pack> (F and its derivative, see above)
+
+template< class T, class Check = Checked, class FuncFD >
+simd::Pack<T> InverseNSB_lanes( FuncFD FD, const T t_max,
+                                const simd::Pack<T> Aobj, const T A_max,
+                                const simd::Mask<T> active,
+                                const InversionConfig<T> & config = InversionConfig<T>(),
+                                InversionCaseStats * stats = nullptr ) ;
 
 // ---------------------------------------------------------------------
 // numerically integrate a real function on a real interval (x0,x1),
@@ -301,130 +709,142 @@ using namespace std ;
 
 // --------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_area()  const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_area()  const
 {
    ensure_initialized();
    return F ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_xe() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_xe() const
 {
    ensure_initialized();
    return xe ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_ax() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_ax() const
 {
    ensure_initialized();
    return ax ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_ay() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_ay() const
 {
    ensure_initialized();
    return ay ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_xl() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_xl() const
 {
    ensure_initialized();
-   return xl ;
+   // xl == cos(alpha)/cos(beta), and xe == cos(alpha)*cos(beta). When the cap is not
+   // partially visible, cos(beta) can be 0 (beta == pi/2), so 0 is returned instead
+   return partially_visible ? xe/cos_beta_sq : T(0.0) ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_yl() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_yl() const
 {
    ensure_initialized();
    return yl ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline T PSCMaps<T>::get_phi_l() const
+template< class T, class Math, class Check >
+inline T PSCMaps<T,Math,Check>::get_phi_l() const
 {
    ensure_initialized();
-   if ( do_checks )
+   if ( Check::checks )
       assert( partially_visible );
    return phi_l ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_initialized() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_initialized() const
 {
    return initialized ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_invisible() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_invisible() const
 {
    ensure_initialized();
    return invisible ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_partially_visible() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_partially_visible() const
 {
    ensure_initialized();
    return partially_visible ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_fully_visible() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_fully_visible() const
 {
    ensure_initialized();
    return fully_visible ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_center_below_hor() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_center_below_hor() const
 {
    ensure_initialized();
    return center_below_hor ;
 }
 // -------------------------------------------------------------------------
 
-template< class T >
-inline bool PSCMaps<T>::is_using_radial() const
+template< class T, class Math, class Check >
+inline bool PSCMaps<T,Math,Check>::is_using_radial() const
 {
    ensure_initialized();
    return using_radial ;
 }
+// -------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline InversionConfig<T> PSCMaps<T,Math,Check>::get_inversion_config() const
+{
+   return InversionConfig<T>( iN_tolerance, int( iN_max_iters ), trace_inversion );
+}
 
 // --------------------------------------------------------------------------
 // eval I function, according to expression 17 in the paper
 
-template< class T >
+template< class T, class Math, class Check >
 T eval_I( T u, T w )
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( epsilon < w );
       assert( T(0.0) <= u );
    }
-   return 0.5*( w*u*std::sqrt(1.0-u*u) + std::asin(u) ) ; // expresion 17
+   return 0.5*( w*u*std::sqrt(1.0-u*u) + Math::asin(u) ) ; // expresion 17
 }
 // --------------------------------------------------------------------------
 // Creates an uninitialized 'empty' object (not usable)
 
-template< class T >
-PSCMaps<T>::PSCMaps( )
+template< class T, class Math, class Check >
+PSCMaps<T,Math,Check>::PSCMaps( )
 {
-   initialized = false ;
+   initialized     = false ;
+   trace_inversion = false ;
+   iN_max_iters    = uint16_t( ini_iN_max_iters );
+   iN_tolerance    = T(ini_iN_tolerance) ;
    E = 0.0 ;
    L = 0.0 ;
    F = 0.0 ;
@@ -432,18 +852,18 @@ PSCMaps<T>::PSCMaps( )
 // --------------------------------------------------------------------------
 // various checking functions
 
-template< class T >
-inline void PSCMaps<T>::ensure_initialized() const
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::ensure_initialized() const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized );
 }
 // --------------------------------------------------------------------------
 
-template< class T >
-inline void PSCMaps<T>::ensure_using_radial() const
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::ensure_using_radial() const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -452,10 +872,10 @@ inline void PSCMaps<T>::ensure_using_radial() const
 }
 // --------------------------------------------------------------------------
 
-template< class T >
-inline void PSCMaps<T>::ensure_using_parallel() const
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::ensure_using_parallel() const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -463,16 +883,72 @@ inline void PSCMaps<T>::ensure_using_parallel() const
    }
 }
 // --------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline CapCase PSCMaps<T,Math,Check>::get_cap_case() const
+{
+   return fully_visible    ? case_ellipse_only :
+          center_below_hor ? case_lune_only    : case_ellipse_lune ;
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline InversionCaseStats * PSCMaps<T,Math,Check>::get_case_stats() const
+{
+   if ( ! Check::counts )
+      return nullptr ;
+   return &( inversion_stats().cases[using_radial ? 1 : 0][get_cap_case()] );
+}
+// --------------------------------------------------------------------------
+// alpha and beta are not stored, they are recovered from their sines (the
+// sign of beta is the one of 'center_below_hor')
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::trace_evaluation( const TraceKind kind, const T area,
+                                              const TraceTimer & timer ) const
+{
+   const uint32_t       time_ns = timer.elapsed_ns();
+   const TraceScratch & scratch = trace_scratch();
+   const bool           converged = ( scratch.flags & trace_converged ) != 0 ;
+
+   if ( converged && ! trace_inversion && time_ns < get_trace_min_time() )
+      return ;
+
+   const double beta_abs = std::asin( double( sin_beta_abs ) ),
+                nan      = std::numeric_limits<double>::quiet_NaN();
+   const bool   inverse  = kind != trace_initialize ;
+
+   TraceRecord r ;
+   r.alpha      = std::asin( double( ay ) );
+   r.beta       = center_below_hor ? -beta_abs : beta_abs ;
+   r.s          = inverse ? scratch.s : nan ;
+   r.t          = inverse ? scratch.t : nan ;
+   r.area       = double( area );
+   r.residual   = inverse ? scratch.residual : 0.0 ;
+   r.tolerance  = double( iN_tolerance );
+   r.time_ns    = time_ns ;
+   r.iterations = inverse ? scratch.iterations : 0 ;
+   r.max_iters  = iN_max_iters ;
+   r.thread     = 0 ;
+   r.kind       = uint8_t( kind );
+   r.flags      = uint8_t( ( inverse ? scratch.flags : trace_converged ) |
+                           ( using_radial ? trace_radial : 0 ) |
+                           ( std::is_same<T,double>::value ? trace_double : 0 ) |
+                           ( converged && time_ns < get_trace_min_time() ? trace_forced : 0 ) |
+                           ( get_cap_case() << trace_case_shift ) );
+   trace_record( r );
+}
+// --------------------------------------------------------------------------
 // initializes the maps object
 
-template< class T >
-void PSCMaps<T>::initialize( const T p_alpha, const T p_beta,
-                             const bool p_use_radial )
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::initialize( const T p_alpha, const T p_beta,
+                             const bool p_use_radial, const InversionConfig<T> & p_config )
 {
    constexpr T tolerance = 1e-5 ,
                pi2       = T(M_PI)*T(0.5) ;
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       if ( pi2+tolerance < p_alpha )
          cout << "p_alpha == " << p_alpha << ", pi2+tolerance == " << pi2+tolerance << endl ;
@@ -482,8 +958,36 @@ void PSCMaps<T>::initialize( const T p_alpha, const T p_beta,
       assert( -pi2-tolerance  <= p_beta );
    }
 
-   const T alpha = std::max( T(0.0), std::min( pi2, p_alpha ) ),
-           beta  = std::max( -pi2,   std::min( pi2, p_beta  ) );
+   const T alpha     = std::max( T(0.0), std::min( pi2, p_alpha ) ),
+           beta      = std::max( -pi2,   std::min( pi2, p_beta  ) ),
+           sin_alpha = Math::sin( alpha ),
+           sin_beta  = Math::sin( beta );
+
+   initialize_sincos( sin_alpha, std::sqrt( T(1.0)-sin_alpha*sin_alpha ),
+                      sin_beta,  std::sqrt( T(1.0)-sin_beta*sin_beta ), p_use_radial, p_config );
+}
+// --------------------------------------------------------------------------
+// initializes the maps from the sines and cosines of alpha and beta
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::initialize_sincos( const T p_sin_alpha, const T p_cos_alpha,
+                                               const T p_sin_beta, const T p_cos_beta,
+                                               const bool p_use_radial,
+                                               const InversionConfig<T> & p_config )
+{
+   const TraceScope scope( *this, trace_initialize, T(0.0) );
+
+   if ( Check::checks )
+   {
+      assert( T(-1e-5) <= p_sin_alpha && p_sin_alpha <= T(1.0+1e-5) );
+      assert( T(-1e-5) <= p_cos_alpha && p_cos_alpha <= T(1.0+1e-5) );
+      assert( T(-1.0-1e-5) <= p_sin_beta && p_sin_beta <= T(1.0+1e-5) );
+      assert( T(-1e-5) <= p_cos_beta && p_cos_beta <= T(1.0+1e-5) );
+      assert( std::abs( p_sin_alpha*p_sin_alpha + p_cos_alpha*p_cos_alpha - T(1.0) ) < T(1e-4) );
+      assert( std::abs( p_sin_beta*p_sin_beta + p_cos_beta*p_cos_beta - T(1.0) ) < T(1e-4) );
+      assert( T(0.0) < p_config.tolerance );
+      assert( 0 <= p_config.max_iters && p_config.max_iters <= max_iN_max_iters );
+   }
 
    initialized = false ;
 
@@ -491,13 +995,19 @@ void PSCMaps<T>::initialize( const T p_alpha, const T p_beta,
    L = 0.0 ;
    F = 0.0 ;
 
-   ay           = std::sin( alpha );
+   iN_tolerance    = p_config.tolerance ;
+   iN_max_iters    = uint16_t( std::max( 0, std::min( p_config.max_iters, max_iN_max_iters ) ) );
+   trace_inversion = p_config.trace ;
+
+   const T sin_beta = std::max( T(-1.0), std::min( T(1.0), p_sin_beta ) ),
+           cos_beta = std::max( T(0.0),  std::min( T(1.0), p_cos_beta ) ),  // spherical cap center, X coord.
+           r1maysq  = std::max( T(0.0),  std::min( T(1.0), p_cos_alpha ) ); // root of (1-ay^2)
+
+   ay           = std::max( T(0.0), std::min( T(1.0), p_sin_alpha ) );
    ay_sq        = ay*ay ;
-   r1maysq      = std::sqrt( T(1.0)-ay_sq ) ;
-   sin_beta     = std::sin( beta ),
    sin_beta_abs = std::abs( sin_beta );
-   cos_beta_sq  = T(1.0)- sin_beta*sin_beta ;
-   cos_beta     = std::sqrt( cos_beta_sq );  // spherical cap center, X coord.
+   cos_beta_sq  = cos_beta*cos_beta ;
+
    xe           = cos_beta*r1maysq ;     // ellipse center
    ax           = ay*sin_beta_abs ;     // semi-minor axis length (UNSIGNED)
    axay2        = ax*ay*T(0.5);
@@ -524,16 +1034,17 @@ void PSCMaps<T>::initialize( const T p_alpha, const T p_beta,
       initialized = true ;
       return ;
    }
-   if ( do_checks )
+   if ( Check::checks )
       assert( fully_visible || partially_visible );
 
    // mark this instance as already initialized (needed to precompute values)
    initialized = true ;
 
    // pre-compute some values
-   compute_ELF_xlyl_phi_l();
+   const T xl = partially_visible ? r1maysq/cos_beta : T(0.0) ; // X coord. of tangency point p (>0)
+   compute_ELF_yl_phi_l( xl );
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       // check cos_beta is in [0,1], cy == 0, and cos_beta^2+sin_beta^2 == 1
 
@@ -552,13 +1063,67 @@ void PSCMaps<T>::initialize( const T p_alpha, const T p_beta,
       }
    }
 }
+// --------------------------------------------------------------------------
+// initializes the maps from the geometry, and computes the local frame
+//
+// with d = |center|, sin(alpha) = radius/d and cos(alpha) = sqrt(d^2-radius^2)/d,
+// sin(beta) = (normal.center)/d and cos(beta) = |cp|/d, where cp is the
+// component of 'center' perpendicular to 'normal' (the X axis is cp/|cp|).
+// When the center is (almost) along the normal, any perpendicular vector is
+// used as X axis (see Duff et al., "Building an orthonormal basis, revisited",
+// JCGT 2017). When the shading point is inside the sphere, alpha is pi/2
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::initialize_geometric( const T center[3], const T radius, const T normal[3],
+                                                  const bool p_use_radial, T vx[3], T vy[3],
+                                                  const InversionConfig<T> & p_config )
+{
+   if ( Check::checks )
+   {
+      assert( T(0.0) < radius );
+      assert( std::abs( normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2] - T(1.0) ) < T(1e-4) );
+   }
+
+   const T d_sq     = center[0]*center[0] + center[1]*center[1] + center[2]*center[2] ,
+           inv_d    = T(1.0)/std::sqrt( d_sq ),
+           c_n      = center[0]*normal[0] + center[1]*normal[1] + center[2]*normal[2] ,
+           cp[3]    = { center[0]-c_n*normal[0], center[1]-c_n*normal[1], center[2]-c_n*normal[2] },
+           cp_len   = std::sqrt( cp[0]*cp[0] + cp[1]*cp[1] + cp[2]*cp[2] ),
+           sin_alpha= std::min( T(1.0), radius*inv_d ),
+           cos_alpha= std::sqrt( std::max( T(0.0), d_sq-radius*radius ) )*inv_d ;
+
+   // X axis: towards the center, or any perpendicular vector if the center is on the normal
+   if ( cp_len > T(1e-6)*std::sqrt( d_sq ) )
+   {
+      const T inv_len = T(1.0)/cp_len ;
+      for( int k = 0 ; k < 3 ; k++ )
+         vx[k] = cp[k]*inv_len ;
+   }
+   else
+   {
+      const T sign = std::copysign( T(1.0), normal[2] ),
+              a    = T(-1.0)/( sign + normal[2] ),
+              b    = normal[0]*normal[1]*a ;
+      vx[0] = T(1.0) + sign*normal[0]*normal[0]*a ;
+      vx[1] = sign*b ;
+      vx[2] = -sign*normal[0] ;
+   }
+
+   // Y axis: normal x vx
+   vy[0] = normal[1]*vx[2] - normal[2]*vx[1] ;
+   vy[1] = normal[2]*vx[0] - normal[0]*vx[2] ;
+   vy[2] = normal[0]*vx[1] - normal[1]*vx[0] ;
+
+   initialize_sincos( sin_alpha, cos_alpha, std::max( T(-1.0), std::min( T(1.0), c_n*inv_d ) ),
+                      std::min( T(1.0), cp_len*inv_d ), p_use_radial, p_config );
+}
 
 // --------------------------------------------------------------------------
-// compute xl and yl if there area tangency points, and phi_l
+// compute yl if there area tangency points (from their X coord. 'xl'), and phi_l
 // compute areas: E,L and F (they are initialized previously to 0.0)
 
-template< class T > inline
-void PSCMaps<T>::compute_ELF_xlyl_phi_l()
+template< class T, class Math, class Check > inline
+void PSCMaps<T,Math,Check>::compute_ELF_yl_phi_l( const T xl )
 {
    // initialize areas
    E = 0.0 ;
@@ -568,13 +1133,12 @@ void PSCMaps<T>::compute_ELF_xlyl_phi_l()
 
    if ( partially_visible )
    {
-      xl = r1maysq/cos_beta ;
       yl  = std::sqrt(T(1.0)-xl*xl);
 
       // compute L
       if ( using_radial )
       {
-         phi_l    = std::atan2( yl, xl-xe );
+         phi_l    = Math::atan2( yl, xl-xe );
          AE_phi_l = eval_ArE( phi_l );
          L        = eval_ArC( phi_l ) - AE_phi_l ;
       }
@@ -602,10 +1166,10 @@ void PSCMaps<T>::compute_ELF_xlyl_phi_l()
 // it also checks y and truncates if it is slightly off-range (to within epsilon)
 // (the range is [0,max_y])
 
-template< class T > inline
-void PSCMaps<T>::check_y( T & y, const T & max_y ) const
+template< class T, class Math, class Check > inline
+void PSCMaps<T,Math,Check>::check_y( T & y, const T & max_y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized ) ;
       assert( !invisible );
@@ -613,6 +1177,9 @@ void PSCMaps<T>::check_y( T & y, const T & max_y ) const
       assert( -epsilon <= y );
       assert( y <= max_y+epsilon );
    }
+   if ( Check::counts )
+   if ( y < T(0.0) || max_y < y )
+      clamp_counters().y++ ;
    y = std::max( T(0.0), std::min( y, max_y ));
 }
 
@@ -621,10 +1188,10 @@ void PSCMaps<T>::check_y( T & y, const T & max_y ) const
 // eval X on the ellipse and on the circle, for a given y
 // y must be in [0,yl].
 
-template< class T >
-T PSCMaps<T>::eval_xEll( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_xEll( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && ! using_radial );
 
    check_y( y, ay );
@@ -632,10 +1199,10 @@ T PSCMaps<T>::eval_xEll( T y ) const
 }
 // --------------------------------------------------------------------------
 
-template< class T >
-T PSCMaps<T>::eval_xCir( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_xCir( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && ! using_radial && partially_visible );
 
    check_y( y, yl );
@@ -646,38 +1213,38 @@ T PSCMaps<T>::eval_xCir( T y ) const
 // eval ApE according to expression 16 in the paper
 // y must be in [0,ay]
 
-template< class T >
-T PSCMaps<T>::eval_ApE( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_ApE( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && ! using_radial );
 
    check_y( y, ay );
    const T v = std::max( T(0.0), std::min( T(1.0), y/ay ));
-   return ax*ay*eval_I( v, T(1.0) );  // expression 16
+   return ax*ay*eval_I<T,Math,Check>( v, T(1.0) );  // expression 16
 }
 // --------------------------------------------------------------------------
 // eval AcE according to expression 16 in the paper
 // y must be in [0,yl]
 
-template< class T >
-T PSCMaps<T>::eval_ApC( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_ApC( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && ! using_radial && partially_visible );
 
    check_y( y, yl );
-   return eval_I( y, T(1.0) ) - xe*y;    // expresion 16
+   return eval_I<T,Math,Check>( y, T(1.0) ) - xe*y;    // expresion 16
 }
 
 // ---------------------------------------------------------------------------
 // evals the parallel map area (equivalent to eq.15, but optimized)
 // y in [0,ay]
 
-template< class T >
-T PSCMaps<T>::eval_Ap( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_Ap( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -709,10 +1276,10 @@ T PSCMaps<T>::eval_Ap( T y ) const
 // evals the parallel integrand (simpler, unified)
 // y in [0,ay]
 
-template< class T >
-T PSCMaps<T>::eval_par_integrand( T y ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_par_integrand( T y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -737,21 +1304,40 @@ T PSCMaps<T>::eval_par_integrand( T y ) const
          : T(2.0)*eval_xEll( y )  ;
 }
 
+// ---------------------------------------------------------------------------
+// evals the parallel map area along with the parallel integrand (its
+// derivative), this is cheaper than calling 'eval_Ap' and 'eval_par_integrand'
+// y in [0,ay]
+
+template< class T, class Math, class Check >
+ValDer<T> PSCMaps<T,Math,Check>::eval_Ap_with_integrand( T y ) const
+{
+   if ( Check::checks )
+   {
+      assert( initialized );
+      assert( ! invisible );
+      assert( ! using_radial );
+      assert( T(0.0) <= y );
+      assert( y  <= ay+epsilon );
+   }
+   return eval_Ap_with_integrand_lanes( y );
+}
+
 // --------------------------------------------------------------------------
 // for a given y, eval x0 and x1
 // y must be in (0,ay), but if center is below horizon, it must be in (0,yl)
-template< class T >
-void PSCMaps<T>::eval_xmin_xmax( const T y, T & xmin, T & xmax ) const
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_xmin_xmax( const T y, T & xmin, T & xmax ) const
 {
    T yy = y ;
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized && !using_radial );
       const T y_limit = center_below_hor ? yl : ay ;
       check_y( yy, y_limit );
    }
 
-   const float xell = eval_xEll( yy );
+   const T     xell = eval_xEll( yy );
 
    if ( fully_visible ) // ellipse only
    {
@@ -774,12 +1360,13 @@ void PSCMaps<T>::eval_xmin_xmax( const T y, T & xmin, T & xmax ) const
 // evals the parallel map inverse integral
 // I in [0,F/2]
 
-template< class T >
-T PSCMaps<T>::eval_Ap_inverse( T Ap_value ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_Ap_inverse( T Ap_value ) const
 {
-   const T Ap_max_value = T(0.5)*F ;
+   const T          Ap_max_value = T(0.5)*F ;
+   const TraceScope scope( *this, trace_Ap_inverse, Ap_value/Ap_max_value );
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -787,16 +1374,26 @@ T PSCMaps<T>::eval_Ap_inverse( T Ap_value ) const
       assert( T(0.0)-epsilon <= Ap_value );
       assert( Ap_value <= Ap_max_value+epsilon );
    }
+   if ( Check::counts )
+   if ( Ap_value < T(0.0) || Ap_max_value < Ap_value )
+      clamp_counters().Ap_inverse++ ;
    Ap_value = std::max( T(0.0), std::min( Ap_value, Ap_max_value ));
 
    const T ymax = center_below_hor ? yl : ay ;
 
-   // normalized versions of functions: Ap(C(y)) and xmax(y)-xmin(y)
-   auto Ap_func      { [=]( float y ) { return eval_Ap( y )/Ap_max_value;       } } ;
-   auto Ap_integrand { [=]( float y ) { return eval_par_integrand( y )/Ap_max_value ; } } ;
+   // normalized versions of functions: Ap(C(y)) and xmax(y)-xmin(y), evaluated together
+   auto Ap_func_integrand = [=]( T y )
+   {
+      const ValDer<T> Ff = eval_Ap_with_integrand_lanes( y );
+      return ValDer<T>{ Ff.value/Ap_max_value, Ff.der/Ap_max_value } ;
+   } ;
 
    // do inversion, return clamped value
-   const T y_result = InverseNSB<T>( Ap_func, Ap_integrand, ymax, Ap_value/Ap_max_value, T(1.0) );
+   const T y_result = InverseNSB_fused<T,StepHybrid,Check>( Ap_func_integrand, ymax, Ap_value/Ap_max_value, T(1.0),
+                                                           get_inversion_config(), get_case_stats() );
+   if ( Check::counts )
+   if ( y_result < T(0.0) || ymax < y_result )
+      clamp_counters().Ap_inverse++ ;
    const T result = std::max( T(0.0), std::min( y_result, ymax ));
 
    return result ;
@@ -805,28 +1402,47 @@ T PSCMaps<T>::eval_Ap_inverse( T Ap_value ) const
 
 // ---------------------------------------------------------------------------
 // horizontal map: computes (x,y) from (s,t)
-template< class T >
-void PSCMaps<T>::hor_map( T s, T t, T &x, T &y ) const
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::hor_map( T s, T t, T &x, T &y ) const
 {
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( !invisible );
       assert( !using_radial );
       assert( fully_visible || partially_visible );
+   }
+   hor_map_sample( s, t, x, y );
+}
+// ---------------------------------------------------------------------------
+// horizontal map for a single sample (the cap state is not checked here)
+
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::hor_map_sample( T s, T t, T &x, T &y ) const
+{
+   if ( Check::checks )
+   {
       assert( T(0.0) <= s && s <= T(1.0) );
       assert( T(0.0) <= t && t <= T(1.0) );
    }
 
    // compute 'u' by scaling and translating 't'
    const bool  y_is_neg = t < T(0.5)   ;
-   const float u        = y_is_neg ? T(1.0)-T(2.0)*t
+   const T     u        = y_is_neg ? T(1.0)-T(2.0)*t
                                    : T(2.0)*t - T(1.0) ;
 
    // compute the 'y' (positive), by inverting Ap function
    const T y_pos = eval_Ap_inverse( u*T(0.5)*F );
 
+   hor_map_from_y( s, y_is_neg, y_pos, x, y );
+}
+// ---------------------------------------------------------------------------
+// horizontal map, last step: computes (x,y) from 's' and 'y_pos' (== Ap^{-1}(u))
+
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::hor_map_from_y( T s, bool y_is_neg, T y_pos, T &x, T &y ) const
+{
    // compute x's interval
    T xmin, xmax ;
    eval_xmin_xmax( y_pos, xmin, xmax );
@@ -842,30 +1458,33 @@ void PSCMaps<T>::hor_map( T s, T t, T &x, T &y ) const
 // and that 'theta' is in the range (0,phi_l) (computes phi_l)
 // truncates 'theta' if it is slightly off-range (to within epsilon)
 
-template< class T > inline
-void PSCMaps<T>::check_theta( T & theta, const T & max_theta ) const
+template< class T, class Math, class Check > inline
+void PSCMaps<T,Math,Check>::check_theta( T & theta, const T & max_theta ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( using_radial );
       assert( -epsilon  <= theta );
       assert( theta <= max_theta+epsilon );
    }
+   if ( Check::counts )
+   if ( theta < T(0.0) || max_theta < theta )
+      clamp_counters().theta++ ;
    theta = std::max( T(0.0), std::min( theta, max_theta )); // trunc
 }
 // ---------------------------------------------------------------------------
 // eval 're(theta)' according to equation 45
 
-template< class T >
-T PSCMaps<T>::eval_rEll( T theta ) const   // theta in [0,pi/2]
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_rEll( T theta ) const   // theta in [0,pi/2]
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && using_radial );
 
    check_theta( theta, T(M_PI) );
 
-   const T sin_theta    = sin(theta),
+   const T sin_theta    = Math::sin(theta),
            sin_theta_sq = sin_theta*sin_theta ;
    return ax / std::sqrt( T(1.0)-cos_beta_sq* sin_theta_sq );
 }
@@ -873,39 +1492,39 @@ T PSCMaps<T>::eval_rEll( T theta ) const   // theta in [0,pi/2]
 // ---------------------------------------------------------------------------
 // eval 'rc(theta)' according to equation 48
 
-template< class T >
-T PSCMaps<T>::eval_rCirc( T theta ) const   // theta in [0,phi_l]
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_rCirc( T theta ) const   // theta in [0,phi_l]
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && using_radial && partially_visible );
 
    check_theta( theta, phi_l );
 
-   const T sin_theta    = sin(theta),
-           sin_theta_sq = sin_theta*sin_theta ,
-           cos_theta    = std::sqrt( T(1.0) - sin_theta_sq ); // sign is positive because theta < phi_l < PI/2
+   T sin_theta, cos_theta ; // cos. is positive because theta < phi_l < PI/2
+   Math::sincos( theta, sin_theta, cos_theta );
+   const T sin_theta_sq = sin_theta*sin_theta ;
    return std::sqrt( T(1.0)- xe_sq * sin_theta_sq ) - xe*cos_theta ;
 }
 // ---------------------------------------------------------------------------
 // evaluate Re according to expression 50  (sec.4)
 // theta in [0,pi]
-template< class T >
-T PSCMaps<T>::eval_ArE( T theta ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_ArE( T theta ) const
 {
 
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && using_radial );
 
    check_theta( theta, T(M_PI) );
 
-   const T tt = std::abs(std::tan(theta));
+   const T tt = std::abs(Math::tan(theta));
 
    constexpr T pi2 = T(0.5)*M_PI ;
    T result ;
    if ( theta <= pi2 )
-      result = axay2*std::atan( sin_beta_abs*tt );
+      result = axay2*Math::atan( sin_beta_abs*tt );
    else
-      result = axay2*( M_PI - std::atan( sin_beta_abs*tt ));
+      result = axay2*( M_PI - Math::atan( sin_beta_abs*tt ));
 
    return result ;
 }
@@ -914,18 +1533,18 @@ T PSCMaps<T>::eval_ArE( T theta ) const
 // evaluate ArC according to equation 25
 // theta in [0,phi_l]
 
-template< class T >
-T PSCMaps<T>::eval_ArC( T theta ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_ArC( T theta ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized && using_radial && partially_visible );
 
    check_theta( theta, phi_l );
 
-   if ( do_checks )
+   if ( Check::checks )
       assert( T(0.0) <= theta && theta <= T(M_PI)*T(0.5) );
 
-   const T z      = std::sin( theta ), // z == asin(theta)
+   const T z      = Math::sin( theta ), // z == asin(theta)
            xez    = xe*z,
            z_sq   = z*z,
            xe_sq  = xe*xe ;
@@ -938,7 +1557,7 @@ T PSCMaps<T>::eval_ArC( T theta ) const
    // (an 'asin' call is saved)
    return T(0.5)*
            ( theta
-             - std::asin(xez)
+             - Math::asin(xez)
              + xe_sq*z*std::sqrt( T(1.0)-z_sq )
              - xez*std::sqrt( T(1.0)- xe_sq*z_sq)
            );
@@ -949,10 +1568,10 @@ T PSCMaps<T>::eval_ArC( T theta ) const
 // evals the radial integral, an optimized version of equation 25
 // theta in [0,pi]
 
-template< class T >
-T PSCMaps<T>::eval_Ar( T theta ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_Ar( T theta ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -980,10 +1599,10 @@ T PSCMaps<T>::eval_Ar( T theta ) const
 // ---------------------------------------------------------------------------
 // evals the radial integrand, as defined in equation 20,
 //   it is implemented in terms of 'eval_rEll' and 'eval_rCirc'
-template< class T >
-T PSCMaps<T>::eval_rad_integrand( T theta ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_rad_integrand( T theta ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -1018,11 +1637,29 @@ T PSCMaps<T>::eval_rad_integrand( T theta ) const
 
 }
 // ---------------------------------------------------------------------------
+// evals the radial map area along with the radial integrand (its derivative),
+// this is cheaper than calling 'eval_Ar' and 'eval_rad_integrand'
+// theta in [0,pi]
 
-template< class T >
-void PSCMaps<T>::eval_rmin_rmax( const T theta, T & rmin, T & rmax ) const
+template< class T, class Math, class Check >
+ValDer<T> PSCMaps<T,Math,Check>::eval_Ar_with_integrand( T theta ) const
+{
+   if ( Check::checks )
+   {
+      assert( initialized );
+      assert( ! invisible );
+      assert( using_radial );
+      assert( T(0.0) <= theta );
+      assert( theta  <= T(M_PI) );
+   }
+   return eval_Ar_with_integrand_lanes( theta );
+}
+// ---------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_rmin_rmax( const T theta, T & rmin, T & rmax ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -1032,6 +1669,9 @@ void PSCMaps<T>::eval_rmin_rmax( const T theta, T & rmin, T & rmax ) const
          cout << "theta-PI == " << theta-T(M_PI) << endl ;
       assert( theta  <= T(M_PI)+epsilon );
    }
+   if ( Check::counts )
+   if ( T(M_PI) < theta )
+      clamp_counters().theta++ ;
    const T theta_c = std::min( theta, T(M_PI) );
 
    // ellipse only, or: ellipse+lune and theta above phi_l
@@ -1042,14 +1682,14 @@ void PSCMaps<T>::eval_rmin_rmax( const T theta, T & rmin, T & rmax ) const
    }
    else if ( center_below_hor ) // lune only
    {
-      if ( do_checks )
+      if ( Check::checks )
          assert( theta <= phi_l );
       rmin = eval_rEll( theta_c );
       rmax = eval_rCirc( theta_c );
    }
    else // ellipse+lune (theta is for sure below phi_l, see above)
    {
-      if ( do_checks )
+      if ( Check::checks )
          assert( theta <= phi_l );
       rmin = T(0.0);
       rmax = eval_rCirc( theta_c ) ;
@@ -1058,16 +1698,13 @@ void PSCMaps<T>::eval_rmin_rmax( const T theta, T & rmin, T & rmax ) const
 }
 // ---------------------------------------------------------------------------
 
-template< class T >
-T PSCMaps<T>::eval_Ar_inverse( T Ar_value ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_Ar_inverse( T Ar_value ) const
 {
+   const T          Ar_max_value = T(0.5)*F ;
+   const TraceScope scope( *this, trace_Ar_inverse, Ar_value/Ar_max_value );
 
-   if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-      cout << "eval_Ar_inverse: Ar_value == " << Ar_value << endl ;
-
-   const T Ar_max_value = T(0.5)*F ;
-
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( ! invisible );
@@ -1076,6 +1713,9 @@ T PSCMaps<T>::eval_Ar_inverse( T Ar_value ) const
       assert( Ar_value <= Ar_max_value+epsilon );
    }
 
+   if ( Check::counts )
+   if ( Ar_value < T(0.0) || Ar_max_value < Ar_value )
+      clamp_counters().Ar_inverse++ ;
    Ar_value = std::max( T(0.0), std::min( Ar_value, Ar_max_value ));
 
    // for the ellipse only case, just do analytical inversion of the integral
@@ -1096,8 +1736,10 @@ T PSCMaps<T>::eval_Ar_inverse( T Ar_value ) const
    if ( center_below_hor )  // !fully visible and center below hor., --> lune only
    if ( L < 1e-5 )          // small lune area
    {
-      if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-         cout << "eval_Ar_inverse: doing parabola approximation" << endl ;
+      if ( Check::traces )
+         trace_scratch().flags |= trace_parabola ;
+      if ( Check::counts )
+         get_case_stats()->parabola++ ;
       return phi_l*( T(1.0)-std::sqrt( T(1.0)-A_frac ) );  // inverse parabola
    }
 
@@ -1105,17 +1747,21 @@ T PSCMaps<T>::eval_Ar_inverse( T Ar_value ) const
    // cases involving the lune: either lune only or ellipse+lune and Ar_value <= Ar_phi_l
    // do numerical iterative inversion:
 
-   if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-      cout << "eval_Ar_inverse: doing numeric inversion" << endl ;
-
-   // normalized versions of Ar(C(\phi)) and the integrand (r_max^2-r_min^2)/2
-   auto Ar_func      { [=]( float theta ) { return eval_Ar( theta )/Ar_max_value;       } } ;
-   auto Ar_integrand { [=]( float theta ) { return eval_rad_integrand( theta )/Ar_max_value ; } } ;
+   // normalized versions of Ar(C(\phi)) and the integrand (r_max^2-r_min^2)/2, evaluated together
+   auto Ar_func_integrand = [=]( T theta )
+   {
+      const ValDer<T> Ff = eval_Ar_with_integrand_lanes( theta );
+      return ValDer<T>{ Ff.value/Ar_max_value, Ff.der/Ar_max_value } ;
+   } ;
 
    const T
       theta_max    = center_below_hor ? phi_l : T(M_PI) ,
-      theta_result = InverseNSB<T>( Ar_func, Ar_integrand,
-                                   theta_max, A_frac, T(1.0));
+      theta_result = InverseNSB_fused<T,StepHybrid,Check>( Ar_func_integrand,
+                                          theta_max, A_frac, T(1.0), get_inversion_config(),
+                                          get_case_stats() );
+   if ( Check::counts )
+   if ( theta_result < T(0.0) || theta_max < theta_result )
+      clamp_counters().Ar_inverse++ ;
    const T result = std::max( T(0.0), std::min( theta_result, theta_max ));
 
    return result ;
@@ -1125,12 +1771,12 @@ T PSCMaps<T>::eval_Ar_inverse( T Ar_value ) const
 // evaluation of the inverse area integral, for the radial map, in the ellipse
 // only (full visible) case
 //
-template< class T >
-T PSCMaps<T>::eval_ArE_inverse( T Ar_value ) const
+template< class T, class Math, class Check >
+T PSCMaps<T,Math,Check>::eval_ArE_inverse( T Ar_value ) const
 {
    const T Ar_max_value = E ;
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( !invisible );
@@ -1139,35 +1785,49 @@ T PSCMaps<T>::eval_ArE_inverse( T Ar_value ) const
       assert( Ar_value <= Ar_max_value +epsilon );
       assert( T(0.0)-epsilon <= Ar_value );
    }
+   if ( Check::counts )
+   if ( Ar_value < T(0.0) || Ar_max_value < Ar_value )
+      clamp_counters().ArE_inverse++ ;
    Ar_value = std::max( T(0.0), std::min( Ar_value, Ar_max_value ) );
 
    const T ang = Ar_value/axay2 ;
    constexpr T pi2 = T(0.5)*T(M_PI) ;
 
    if ( ang <= pi2 )
-      return std::atan(std::tan(ang)/sin_beta_abs);
+      return Math::atan(Math::tan(ang)/sin_beta_abs);
    else
-      return T(M_PI) + std::atan(std::tan(ang)/sin_beta_abs);
+      return T(M_PI) + Math::atan(Math::tan(ang)/sin_beta_abs);
 }
 // ---------------------------------------------------------------------------
 // radial map: computes (x,y) from (s,t)
-template< class T >
-void PSCMaps<T>::rad_map( T s, T t, T &x, T &y ) const
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::rad_map( T s, T t, T &x, T &y ) const
 {
 
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( initialized );
       assert( using_radial );
       assert( !invisible );
       assert( fully_visible || partially_visible );
+   }
+   rad_map_sample( s, t, x, y );
+}
+// ---------------------------------------------------------------------------
+// radial map for a single sample (the cap state is not checked here)
+
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::rad_map_sample( T s, T t, T &x, T &y ) const
+{
+   if ( Check::checks )
+   {
       assert( T(0.0) <= s && s <= T(1.0) );
       assert( T(0.0) <= t && t <= T(1.0) );
    }
 
    // compute 'u' by scaling and translating 't'
    const bool  angle_is_neg = t < T(0.5)   ;
-   const float u            = angle_is_neg ? T(1.0)-T(2.0)*t
+   const T     u            = angle_is_neg ? T(1.0)-T(2.0)*t
                                            : T(2.0)*t - T(1.0) ;
 
    // compute varphi in [0,1] from U by using inverse of Er, Lr or Ur
@@ -1190,11 +1850,23 @@ void PSCMaps<T>::rad_map( T s, T t, T &x, T &y ) const
       eval_rmin_rmax( varphi, rmin, rmax );
    }
 
+   rad_map_from_angle( s, angle_is_neg, varphi, rmin, rmax, scaled, x, y );
+}
+// ---------------------------------------------------------------------------
+// radial map, last step: computes (x,y) from 's', the angle 'varphi' (== Ar^{-1}(u))
+// and the radius interval. When 'scaled' is true, the angle and radius are in
+// the ellipse scaled to the unit disk
+
+template< class T, class Math, class Check >
+inline void PSCMaps<T,Math,Check>::rad_map_from_angle( T s, bool angle_is_neg, T varphi,
+                                            T rmin, T rmax, bool scaled, T &x, T &y ) const
+{
    // compute x' and y'
 
-   const T si  = angle_is_neg ? -(std::sin(varphi)) : std::sin( varphi ),
-           co  = std::sqrt( T(1.0) - si*si )
-                     * ( varphi <= T(M_PI)*T(0.5) ? T(1.0) : T(-1.0) ), // note sign correction
+   T sin_varphi, co ;
+   Math::sincos( varphi, sin_varphi, co );
+
+   const T si  = angle_is_neg ? -sin_varphi : sin_varphi ,
            rad = std::sqrt( s*(rmax*rmax) + (T(1.0)-s)*(rmin*rmin)  ),
            xp  = rad*co ,
            yp  = rad*si ;
@@ -1211,32 +1883,906 @@ void PSCMaps<T>::rad_map( T s, T t, T &x, T &y ) const
       y = yp ;
    }
 }
+// ---------------------------------------------------------------------------
+// radial map in the ellipse only case, for 'n' samples
+// (this is 'rad_map_sample' with 'fully_visible' == true)
+//
+// As there is no iteration, samples are processed in SIMD packs (8 floats or
+// 4 doubles with AVX2), with sin/cos of 'varphi' evaluated by a polynomial
+// on 'varphi-pi/2' (see 'simd::sincos_pi2'). The remaining samples (less than
+// a pack) are evaluated with the same expressions on scalars.
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::rad_map_ellipse_batch( const T * s, const T * t, T * x, T * y,
+                                        const size_t n ) const
+{
+   typedef simd::Pack<T> V ;
+   constexpr size_t w = V::width ;
+
+   const size_t n_packs = n - n % w ; // number of samples processed in packs
+
+   for( size_t i = 0 ; i < n_packs ; i += w )
+      rad_map_ellipse_lanes<V>( s+i, t+i, x+i, y+i );
+   for( size_t i = n_packs ; i < n ; i++ )
+      rad_map_ellipse_lanes<T>( s+i, t+i, x+i, y+i );
+}
+// ---------------------------------------------------------------------------
+// radial map in the ellipse only case, for as many samples as lanes in 'V'
+// ('V' is either 'T' or 'simd::Pack<T>')
+
+template< class T, class Math, class Check >
+template< class V >
+inline void PSCMaps<T,Math,Check>::rad_map_ellipse_lanes( const T * s, const T * t, T * x, T * y ) const
+{
+   // u == |2t-1|, so varphi == PI*u, and w == varphi-PI/2 is in [-PI/2,PI/2]
+   const V tv  = simd::load_lanes<V>( t ),
+           wv  = simd::abs( simd::fma( V( T(2.0*M_PI) ), tv, V( T(-M_PI) ) ) ) - V( T(0.5*M_PI) ),
+           rad = simd::sqrt( simd::load_lanes<V>( s ) );
+   V sin_w, cos_w ;
+   simd::sincos_pi2( wv, sin_w, cos_w );
+
+   // sin(varphi) == cos(w) (negated when t < 1/2), cos(varphi) == -sin(w)
+   const V si = simd::flip_sign( cos_w, tv < V( T(0.5) ) ),
+           co = -sin_w ;
+
+   simd::store_lanes( x, simd::fma( V(ax), rad*co, V(xe) ) );
+   simd::store_lanes( y, V(ay)*(rad*si) );
+}
 
 // --------------------------------------------------------------------------
 // evaluates the map, according to 'using_radial'
 
-template< class T >
-void PSCMaps<T>::eval_map( T s, T t, T &x, T &y ) const
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_map( T s, T t, T &x, T &y ) const
 {
-   if ( do_checks )
+   if ( Check::checks )
       assert( initialized );
 
+   // the inversions record the sample when they are traced
+   if ( Check::traces )
+   {
+      trace_scratch().s = double( s );
+      trace_scratch().t = double( t );
+   }
+
    if ( using_radial )
       rad_map( s,t,x,y );
    else
       hor_map( s,t,x,y );
-}
 
-// ****************************************************************************
+   if ( Check::traces )
+      trace_scratch().s = trace_scratch().t = std::numeric_limits<double>::quiet_NaN();
+}
+// --------------------------------------------------------------------------
+// evaluates the map for a sample and its antithetic sample (mirrored)
 
-inline std::string b2s( const bool b  )
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_map_pair( T s, T t, T &x0, T &y0, T &x1, T &y1 ) const
 {
-   return b ? "true" : "false" ;
+   eval_map( s, t, x0, y0 );
+   x1 = x0 ;
+   y1 = -y0 ;
 }
-// ---------------------------------------------------------------------------
-template< class T > void PSCMaps<T>::debug( )
+// --------------------------------------------------------------------------
+// evaluates the map for a batch of samples and their antithetic samples
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_map_antithetic( const T * s, const T * t, T * x, T * y,
+                                                 const size_t n ) const
 {
-   const std::string
+   eval_map_batch( s, t, x, y, n );
+   for( size_t i = 0 ; i < n ; i++ )
+   {
+      x[n+i] = x[i] ;
+      y[n+i] = -y[i] ;
+   }
+}
+// --------------------------------------------------------------------------
+// evaluates the map for a batch of samples, according to 'using_radial'
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_map_batch( const T * s, const T * t, T * x, T * y,
+                                 const size_t n ) const
+{
+   if ( Check::checks )
+   {
+      assert( initialized );
+      assert( ! invisible );
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         assert( T(0.0) <= s[i] && s[i] <= T(1.0) );
+         assert( T(0.0) <= t[i] && t[i] <= T(1.0) );
+      }
+   }
+
+   // ellipse only and radial map: straight arithmetic
+   if ( using_radial && fully_visible )
+   {
+      rad_map_ellipse_batch( s, t, x, y, n );
+      return ;
+   }
+
+   // ellipse+lune and radial map: analytic and iterative samples are grouped apart
+   if ( using_radial && ! center_below_hor )
+   {
+      rad_map_grouped_batch( s, t, x, y, n );
+      return ;
+   }
+
+   // other cases: iterative inversion, run in lockstep for packs of samples
+   map_lanes_batch( s, t, x, y, n );
+}
+// --------------------------------------------------------------------------
+// evaluates the map for a part of a sequence. The blocks of points are small
+// enough to stay in the L1 cache, so this is as fast as generating the points
+// and evaluating them in the same loop
+
+template< class T, class Math, class Check >
+template< class Seq >
+void PSCMaps<T,Math,Check>::eval_map_sequence( const Seq & seq, const size_t first, const size_t n,
+                                               T * x, T * y ) const
+{
+   constexpr size_t block_size = 64 ;
+   T s[block_size], t[block_size] ;
+
+   for( size_t i = 0 ; i < n ; i += block_size )
+   {
+      const size_t count = std::min( block_size, n-i );
+      seq.generate( first+i, count, s, t );
+      eval_map_batch( s, t, x+i, y+i, count );
+   }
+}
+// --------------------------------------------------------------------------
+// evaluates the map for a stratified grid, row by row. In the ellipse only case
+// with the radial map there is no inversion to share, so the (s,t) values of
+// the whole grid are written in 'x' and 'y', and then evaluated in place by a
+// single 'eval_map_batch' call ('rad_map_ellipse_batch' reads each pack of
+// samples before writing it)
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_grid( const size_t nx, const size_t ny, const T * jitter_s,
+                                       const T * jitter_t, T * x, T * y ) const
+{
+   if ( Check::checks )
+   {
+      assert( initialized );
+      assert( ! invisible );
+      for( size_t i = 0 ; jitter_s != nullptr && i < nx*ny ; i++ )
+         assert( T(0.0) <= jitter_s[i] && jitter_s[i] <= T(1.0) );
+      for( size_t j = 0 ; jitter_t != nullptr && j < ny ; j++ )
+         assert( T(0.0) <= jitter_t[j] && jitter_t[j] <= T(1.0) );
+   }
+
+   const T dx = T(1.0)/T(nx) ,
+           dy = T(1.0)/T(ny) ;
+
+   if ( ! ( using_radial && fully_visible ) )
+   {
+      for( size_t j = 0 ; j < ny ; j++ )
+      {
+         const T t = std::min( ( T(j) + ( jitter_t != nullptr ? jitter_t[j] : T(0.5) ) )*dy, T(1.0) );
+         grid_row( t, nx, jitter_s != nullptr ? jitter_s + j*nx : nullptr, x + j*nx, y + j*nx );
+      }
+      return ;
+   }
+
+   // the test on 'jitter_s' is out of the loops over the samples, so they can
+   // be vectorized
+   for( size_t j = 0 ; j < ny ; j++ )
+   {
+      const T t  = std::min( ( T(j) + ( jitter_t != nullptr ? jitter_t[j] : T(0.5) ) )*dy, T(1.0) );
+      T *     xr = x + j*nx ,
+          *   yr = y + j*nx ;
+      if ( jitter_s != nullptr )
+         for( size_t i = 0 ; i < nx ; i++ )
+            xr[i] = std::min( ( T(i) + jitter_s[j*nx+i] )*dx, T(1.0) );
+      else
+         for( size_t i = 0 ; i < nx ; i++ )
+            xr[i] = ( T(i) + T(0.5) )*dx ;
+      for( size_t i = 0 ; i < nx ; i++ )
+         yr[i] = t ;
+   }
+   eval_map_batch( x, y, x, y, nx*ny );
+}
+// --------------------------------------------------------------------------
+// evaluates a row of a grid: 'u' is inverted once (as in 'hor_map_sample' or
+// 'rad_map_sample'), and then only the interpolation in the x or radius
+// interval is done for each sample (for the radial map, sin and cos of the
+// angle are also computed once). The 's' values are first written in 'x', so
+// the loops over the samples have no branches (and can be vectorized). This is
+// not used in the ellipse only case with the radial map (see 'eval_grid')
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::grid_row( T t, const size_t nx, const T * jitter_s, T * x, T * y ) const
+{
+   const T    dx     = T(1.0)/T(nx) ;
+   const bool is_neg = t < T(0.5) ;
+   const T    u      = is_neg ? T(1.0)-T(2.0)*t : T(2.0)*t - T(1.0) ;
+
+   if ( jitter_s != nullptr )
+      for( size_t i = 0 ; i < nx ; i++ )
+         x[i] = std::min( ( T(i) + jitter_s[i] )*dx, T(1.0) );
+   else
+      for( size_t i = 0 ; i < nx ; i++ )
+         x[i] = ( T(i) + T(0.5) )*dx ;
+
+   if ( ! using_radial )
+   {
+      const T y_pos = eval_Ap_inverse( u*T(0.5)*F ),
+              y_row = is_neg ? -y_pos : y_pos ;
+      T xmin, xmax ;
+      eval_xmin_xmax( y_pos, xmin, xmax );
+
+      for( size_t i = 0 ; i < nx ; i++ )
+      {
+         const T s = x[i] ;
+         x[i] = (T(1.0)-s)*xmin + s*xmax ;
+         y[i] = y_row ;
+      }
+      return ;
+   }
+
+   // radial map (ellipse+lune or lune only): angle, radius interval and direction of the row
+   T rmin, rmax, cx, cy ;
+   const T varphi = std::max( T(0.0), std::min( T(M_PI), eval_Ar_inverse( u*T(0.5)*F ) ));
+   eval_rmin_rmax( varphi, rmin, rmax );
+   Math::sincos( varphi, cy, cx );
+   if ( is_neg )
+      cy = -cy ;
+
+   const T rmin_sq = rmin*rmin ,
+           rmax_sq = rmax*rmax ;
+   for( size_t i = 0 ; i < nx ; i++ )
+   {
+      const T s   = x[i] ,
+              rad = std::sqrt( s*rmax_sq + (T(1.0)-s)*rmin_sq );
+      x[i] = xe + rad*cx ;
+      y[i] = rad*cy ;
+   }
+}
+// --------------------------------------------------------------------------
+// evaluates the map for a batch of samples and converts them to directions.
+// The (x,y) positions are written in 'dir_x' and 'dir_y' by 'eval_map_batch',
+// and then converted in place, in SIMD packs (the remaining samples are
+// converted with the same expressions on scalars)
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::eval_directions( const T * s, const T * t, const size_t n,
+                                             const T vx[3], const T vy[3], const T normal[3],
+                                             T * dir_x, T * dir_y, T * dir_z, T * pdf ) const
+{
+   typedef simd::Pack<T> V ;
+   constexpr size_t w = V::width ;
+
+   eval_map_batch( s, t, dir_x, dir_y, n );
+
+   const T      inv_area = T(1.0)/F ;
+   const size_t n_packs  = n - n % w ; // number of samples processed in packs
+
+   for( size_t i = 0 ; i < n_packs ; i += w )
+      directions_lanes<V>( vx, vy, normal, inv_area, dir_x+i, dir_y+i, dir_z+i,
+                           pdf != nullptr ? pdf+i : nullptr );
+   for( size_t i = n_packs ; i < n ; i++ )
+      directions_lanes<T>( vx, vy, normal, inv_area, dir_x+i, dir_y+i, dir_z+i,
+                           pdf != nullptr ? pdf+i : nullptr );
+}
+// --------------------------------------------------------------------------
+// converts (x,y) positions to directions, for as many samples as lanes in 'V'
+// ('V' is either 'T' or 'simd::Pack<T>'). The direction is normalized again,
+// as the axes are unit length only up to rounding
+
+template< class T, class Math, class Check >
+template< class V >
+inline void PSCMaps<T,Math,Check>::directions_lanes( const T vx[3], const T vy[3], const T normal[3],
+                                                     const T inv_area, T * dir_x, T * dir_y,
+                                                     T * dir_z, T * pdf ) const
+{
+   const V x   = simd::load_lanes<V>( dir_x ),
+           y   = simd::load_lanes<V>( dir_y ),
+           z   = simd::sqrt( simd::max( V( T(0.0) ), V( T(1.0) ) - x*x - y*y ) ),
+           d0  = simd::fma( x, V( vx[0] ), simd::fma( y, V( vy[0] ), z*V( normal[0] ) ) ),
+           d1  = simd::fma( x, V( vx[1] ), simd::fma( y, V( vy[1] ), z*V( normal[1] ) ) ),
+           d2  = simd::fma( x, V( vx[2] ), simd::fma( y, V( vy[2] ), z*V( normal[2] ) ) ),
+           inv = V( T(1.0) )/simd::sqrt( simd::fma( d0, d0, simd::fma( d1, d1, d2*d2 ) ) );
+
+   simd::store_lanes( dir_x, d0*inv );
+   simd::store_lanes( dir_y, d1*inv );
+   simd::store_lanes( dir_z, d2*inv );
+   if ( pdf != nullptr )
+      simd::store_lanes( pdf, z*V( inv_area ) );
+}
+// --------------------------------------------------------------------------
+// initializes the maps from the geometry, and evaluates a batch of directions
+
+template< class T, class Math, class Check >
+bool PSCMaps<T,Math,Check>::sample_directions( const T center[3], const T radius, const T normal[3],
+                                               const bool p_use_radial, const T * s, const T * t,
+                                               const size_t n, T * dir_x, T * dir_y, T * dir_z,
+                                               T * pdf, const InversionConfig<T> & p_config )
+{
+   T vx[3], vy[3] ;
+   initialize_geometric( center, radius, normal, p_use_radial, vx, vy, p_config );
+   if ( invisible )
+      return false ;
+   eval_directions( s, t, n, vx, vy, normal, dir_x, dir_y, dir_z, pdf );
+   return true ;
+}
+// --------------------------------------------------------------------------
+// inverse of the maps: 'u' is the normalized area below |y| (parallel map) or
+// below the angle with the X axis (radial map), so t == (1+u)/2 when y >= 0,
+// and t == (1-u)/2 otherwise. 's' is the relative position of x (parallel map)
+// or of r^2 (radial map) in its interval, which is computed as in the maps
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::inverse_map( T x, T y, T &s, T &t ) const
+{
+   if ( Check::checks )
+   {
+      assert( initialized );
+      assert( ! invisible );
+   }
+
+   const bool y_is_neg = y < T(0.0) ;
+   const T    y_abs    = std::abs( y );
+   T          u ;
+
+   if ( ! using_radial )
+   {
+      const T y_pos = std::min( y_abs, center_below_hor ? yl : ay );
+      T xmin, xmax ;
+      eval_xmin_xmax( y_pos, xmin, xmax );
+      u = eval_Ap( y_pos )/( T(0.5)*F );
+      s = ( xmin < xmax ) ? ( x - xmin )/( xmax - xmin ) : T(0.5) ;
+   }
+   else if ( fully_visible )
+   {
+      // ellipse only: the radial map works on the ellipse scaled to the unit disk
+      const T xp = ( x - xe )/ax ,
+              yp = y_abs/ay ;
+      u = Math::atan2( yp, xp )/T(M_PI) ;
+      s = xp*xp + yp*yp ;
+   }
+   else
+   {
+      const T dx     = x - xe ,
+              varphi = std::max( T(0.0), std::min( Math::atan2( y_abs, dx ),
+                                          center_below_hor ? phi_l : T(M_PI) ) );
+      T rmin, rmax ;
+      eval_rmin_rmax( varphi, rmin, rmax );
+      const T rmin_sq = rmin*rmin ,
+              rmax_sq = rmax*rmax ;
+      u = eval_Ar( varphi )/( T(0.5)*F );
+      s = ( rmin_sq < rmax_sq ) ? ( dx*dx + y*y - rmin_sq )/( rmax_sq - rmin_sq ) : T(0.5) ;
+   }
+
+   u = std::max( T(0.0), std::min( u, T(1.0) ) );
+   s = std::max( T(0.0), std::min( s, T(1.0) ) );
+   t = y_is_neg ? T(0.5)*( T(1.0) - u ) : T(0.5)*( T(1.0) + u );
+}
+// --------------------------------------------------------------------------
+// pdf of a batch of directions, in SIMD packs (the remaining directions are
+// processed with the same expressions on scalars)
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::contains_and_pdf( const T * dir_x, const T * dir_y, const T * dir_z,
+                                              const size_t n, const T vx[3], const T vy[3],
+                                              const T normal[3], T * pdf ) const
+{
+   typedef simd::Pack<T> V ;
+   constexpr size_t w = V::width ;
+
+   if ( Check::checks )
+      assert( initialized );
+
+   if ( invisible )
+   {
+      for( size_t i = 0 ; i < n ; i++ )
+         pdf[i] = T(0.0) ;
+      return ;
+   }
+
+   const T      inv_area = T(1.0)/F ;
+   const size_t n_packs  = n - n % w ; // number of directions processed in packs
+
+   for( size_t i = 0 ; i < n_packs ; i += w )
+      contains_and_pdf_lanes<V>( dir_x+i, dir_y+i, dir_z+i, vx, vy, normal, inv_area, pdf+i );
+   for( size_t i = n_packs ; i < n ; i++ )
+      contains_and_pdf_lanes<T>( dir_x+i, dir_y+i, dir_z+i, vx, vy, normal, inv_area, pdf+i );
+}
+// --------------------------------------------------------------------------
+// pdf of as many directions as lanes in 'V' ('V' is either 'T' or 'simd::Pack<T>').
+// The projection (x,y) of a direction above the horizon is in the cap when:
+//   ellipse only : it is in the ellipse,
+//   ellipse+lune : it is in the ellipse, or in the lune side (|y| <= yl and x >= xe),
+//   lune only    : it is in the lune side, but not in the ellipse.
+// (the unit circle bounds the lune, and it holds for all the directions)
+
+template< class T, class Math, class Check >
+template< class V >
+inline void PSCMaps<T,Math,Check>::contains_and_pdf_lanes( const T * dir_x, const T * dir_y,
+                                                           const T * dir_z, const T vx[3],
+                                                           const T vy[3], const T normal[3],
+                                                           const T inv_area, T * pdf ) const
+{
+   typedef decltype( V() < V() ) M ;
+
+   const V dx = simd::load_lanes<V>( dir_x ),
+           dy = simd::load_lanes<V>( dir_y ),
+           dz = simd::load_lanes<V>( dir_z ),
+           x  = simd::fma( dx, V( vx[0] ), simd::fma( dy, V( vx[1] ), dz*V( vx[2] ) ) ),
+           y  = simd::fma( dx, V( vy[0] ), simd::fma( dy, V( vy[1] ), dz*V( vy[2] ) ) ),
+           z  = simd::fma( dx, V( normal[0] ), simd::fma( dy, V( normal[1] ), dz*V( normal[2] ) ) ),
+           ex = x - V( xe ) ,
+           ax_sq = V( ax*ax ) ;
+
+   // in the ellipse: (x-xe)^2/ax^2 + y^2/ay^2 <= 1 (without divisions, as ax may be 0)
+   const M in_ell = simd::fma( ex*ex, V( ay_sq ), y*y*ax_sq ) <= ax_sq*V( ay_sq ) ;
+   M inside ;
+   if ( fully_visible )
+      inside = in_ell ;
+   else
+   {
+      const M in_lune_side = ( simd::abs( y ) <= V( yl ) ) & ( V( T(0.0) ) <= ex ) ;
+      inside = center_below_hor ? M( in_lune_side & ! in_ell ) : M( in_ell | in_lune_side ) ;
+   }
+   inside = inside & ( V( T(0.0) ) < z ) ;
+
+   simd::store_lanes( pdf, simd::select( inside, z*V( inv_area ), V( T(0.0) ) ) );
+}
+// --------------------------------------------------------------------------
+// evaluates the map ('hor_map_lanes' or 'rad_map_lanes') for a batch of samples,
+// in SIMD packs. The remaining samples are processed in a pack padded with (1/2,1/2),
+// where only the lanes with samples are active
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::map_lanes_batch( const T * s, const T * t, T * x, T * y,
+                                  const size_t n ) const
+{
+   typedef simd::Pack<T> V ;
+   constexpr size_t w = V::width ;
+   const size_t n_packs = n - n % w ; // number of samples processed in full packs
+
+   const simd::Mask<T> all_lanes = simd::true_mask<T>() ;
+
+   if ( using_radial )
+      for( size_t i = 0 ; i < n_packs ; i += w )
+         rad_map_lanes<V>( s+i, t+i, x+i, y+i, all_lanes );
+   else
+      for( size_t i = 0 ; i < n_packs ; i += w )
+         hor_map_lanes<V>( s+i, t+i, x+i, y+i, all_lanes );
+
+   if ( n_packs < n )
+   {
+      const size_t n_rem = n - n_packs ;
+      T sp[w], tp[w], xp[w], yp[w] ;
+      for( size_t k = 0 ; k < w ; k++ )
+      {
+         sp[k] = k < n_rem ? s[n_packs+k] : T(0.5) ;
+         tp[k] = k < n_rem ? t[n_packs+k] : T(0.5) ;
+      }
+      const simd::Mask<T> rem_lanes = simd::first_lanes_mask<T>( int( n_rem ) );
+      if ( using_radial )
+         rad_map_lanes<V>( sp, tp, xp, yp, rem_lanes );
+      else
+         hor_map_lanes<V>( sp, tp, xp, yp, rem_lanes );
+      for( size_t k = 0 ; k < n_rem ; k++ )
+      {
+         x[n_packs+k] = xp[k] ;
+         y[n_packs+k] = yp[k] ;
+      }
+   }
+}
+// --------------------------------------------------------------------------
+// radial map, ellipse+lune case, for a batch of samples
+//
+// samples whose angle is above phi_l are inverted analytically, while the
+// others need iterations. In order to avoid mixing both kinds in the same pack
+// (all lanes would wait for the iterative ones), the samples are split in two
+// groups, which are evaluated separately (in chunks of 'chunk_size' samples)
+
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::rad_map_grouped_batch( const T * s, const T * t, T * x, T * y,
+                                        const size_t n ) const
+{
+   constexpr size_t chunk_size = 64 ;
+   const T          Ar_half    = T(0.5)*F ;
+
+   T      s_grp[2][chunk_size], t_grp[2][chunk_size],
+          x_grp[2][chunk_size], y_grp[2][chunk_size] ;
+   size_t i_grp[2][chunk_size] ; // index of each grouped sample in the batch
+
+   for( size_t c = 0 ; c < n ; c += chunk_size )
+   {
+      const size_t m = std::min( chunk_size, n-c );
+      size_t       count[2] = { 0, 0 };
+
+      // group 0: analytic inversion (as in 'eval_Ar_inverse_lanes'), group 1: iterative
+      for( size_t i = c ; i < c+m ; i++ )
+      {
+         const T      u = std::abs( T(2.0)*t[i] - T(1.0) );
+         const size_t g = ( AE_phi_l + L < u*Ar_half ) ? 0 : 1 ;
+         s_grp[g][count[g]] = s[i] ;
+         t_grp[g][count[g]] = t[i] ;
+         i_grp[g][count[g]] = i ;
+         count[g]++ ;
+      }
+      for( size_t g = 0 ; g < 2 ; g++ )
+      {
+         map_lanes_batch( s_grp[g], t_grp[g], x_grp[g], y_grp[g], count[g] );
+         for( size_t k = 0 ; k < count[g] ; k++ )
+         {
+            x[i_grp[g][k]] = x_grp[g][k] ;
+            y[i_grp[g][k]] = y_grp[g][k] ;
+         }
+      }
+   }
+}
+
+// *****************************************************************************
+// SIMD (lanes) versions of the map evaluation functions
+// (see the scalar version of each function for details)
+
+// --------------------------------------------------------------------------
+// eval I function (expression 17 in the paper), for each lane
+
+template< class V, class Math = MathStd >
+inline V eval_I_lanes( const V u, const V w )
+{
+   typedef typename simd::ScalarOf<V>::type T ;
+   return V(T(0.5))*( w*u*simd::sqrt( V(T(1.0))-u*u ) + Math::asin( u ) );
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_xEll_lanes( V y ) const
+{
+   y = simd::clamp( y, V(T(0.0)), V(ay) );
+   return V(ax)*simd::sqrt( V(T(1.0)) - (y*y)/V(ay_sq) );
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_xCir_lanes( V y ) const
+{
+   y = simd::clamp( y, V(T(0.0)), V(yl) );
+   return simd::sqrt( V(T(1.0)) - y*y ) - V(xe) ;
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline void PSCMaps<T,Math,Check>::eval_xmin_xmax_lanes( V y, V & xmin, V & xmax ) const
+{
+   y = simd::clamp( y, V(T(0.0)), V( center_below_hor ? yl : ay ) );
+
+   const V xell = eval_xEll_lanes( y );
+
+   if ( fully_visible ) // ellipse only
+   {
+      xmin = V(xe) - xell ;
+      xmax = V(xe) + xell ;
+   }
+   else if ( center_below_hor )  // lune only
+   {
+      xmin = V(xe) + xell ;
+      xmax = V(xe) + eval_xCir_lanes( y );
+   }
+   else // ellipse plus lune
+   {
+      xmin = V(xe) - xell ;
+      xmax = V(xe) + simd::select( y <= V(yl), eval_xCir_lanes( y ), xell );
+   }
+}
+// --------------------------------------------------------------------------
+
+// Ap and the parallel integrand together: only two square roots and two arc
+// sines are needed (instead of four square roots and two arc sines)
+
+template< class T, class Math, class Check > template< class V >
+inline ValDer<V> PSCMaps<T,Math,Check>::eval_Ap_with_integrand_lanes( V y ) const
+{
+   // lune only, y above yl in all lanes
+   if ( center_below_hor && ! simd::any( y <= V(yl) ) )
+      return ValDer<V>{ V(L), V(T(0.0)) } ;
+
+   // ellipse terms: ApE (eq. 16) and xEll share sqrt(1-v^2), with v = y/ay
+   const V v      = simd::clamp( y/V(ay), V(T(0.0)), V(T(1.0)) ),
+           root_v = simd::sqrt( V(T(1.0)) - v*v ),
+           ApE    = V(axay2)*( v*root_v + Math::asin( v ) ),
+           xEll   = V(ax)*root_v ;
+
+   // ellipse only
+   if ( fully_visible )
+      return ValDer<V>{ V(T(2.0))*ApE, V(T(2.0))*xEll } ;
+
+   // values for y above yl
+   const auto      below_yl = y <= V(yl) ;
+   const ValDer<V> above    = center_below_hor
+                            ? ValDer<V>{ V(L), V(T(0.0)) }
+                            : ValDer<V>{ V(T(2.0))*ApE + V(L), V(T(2.0))*xEll } ;
+   if ( ! simd::any( below_yl ) )
+      return above ;
+
+   // circle terms: ApC (eq. 16) and xCir share sqrt(1-y^2)
+   const V yc     = simd::clamp( y, V(T(0.0)), V(yl) ),
+           root_y = simd::sqrt( V(T(1.0)) - yc*yc ),
+           ApC    = V(T(0.5))*( yc*root_y + Math::asin( yc ) ) - V(xe)*yc ,
+           xCir   = root_y - V(xe) ;
+
+   // values for y below yl
+   const ValDer<V> below = center_below_hor
+                         ? ValDer<V>{ ApC - ApE, xCir - xEll }
+                         : ValDer<V>{ ApC + ApE, xCir + xEll } ;
+   if ( simd::all( below_yl ) )
+      return below ;
+
+   return ValDer<V>{ simd::select( below_yl, below.value, above.value ),
+                     simd::select( below_yl, below.der,   above.der   ) } ;
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_Ap_inverse_lanes( V Ap_value, const simd::Mask<T> & active ) const
+{
+   const T Ap_max_value = T(0.5)*F ,
+           ymax         = center_below_hor ? yl : ay ;
+
+   Ap_value = simd::clamp( Ap_value, V(T(0.0)), V(Ap_max_value) );
+
+   // normalized versions of functions: Ap(C(y)) and xmax(y)-xmin(y), evaluated together
+   auto Ap_func_integrand = [=]( V y )
+   {
+      const ValDer<V> Ff = eval_Ap_with_integrand_lanes( y );
+      return ValDer<V>{ Ff.value/V(Ap_max_value), Ff.der/V(Ap_max_value) } ;
+   } ;
+
+   const V y_result = InverseNSB_lanes<T,Check>( Ap_func_integrand, ymax,
+                         Ap_value/V(Ap_max_value), T(1.0), active,
+                         get_inversion_config(), get_case_stats() );
+   return simd::clamp( y_result, V(T(0.0)), V(ymax) );
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_rEll_lanes( V theta ) const
+{
+   theta = simd::clamp( theta, V(T(0.0)), V(T(M_PI)) );
+   const V sin_theta = Math::sin( theta );
+   return V(ax) / simd::sqrt( V(T(1.0)) - V(cos_beta_sq)*(sin_theta*sin_theta) );
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_rCirc_lanes( V theta ) const
+{
+   theta = simd::clamp( theta, V(T(0.0)), V(phi_l) );
+   V sin_theta, cos_theta ;
+   Math::sincos( theta, sin_theta, cos_theta );
+   const V sin_theta_sq = sin_theta*sin_theta ;
+   return simd::sqrt( V(T(1.0)) - V(xe_sq)*sin_theta_sq ) - V(xe)*cos_theta ;
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline void PSCMaps<T,Math,Check>::eval_rmin_rmax_lanes( V theta, V & rmin, V & rmax ) const
+{
+   const V theta_c = simd::min( theta, V(T(M_PI)) );
+
+   if ( fully_visible ) // ellipse only
+   {
+      rmin = V(T(0.0));
+      rmax = eval_rEll_lanes( theta_c );
+   }
+   else if ( center_below_hor ) // lune only
+   {
+      rmin = eval_rEll_lanes( theta_c );
+      rmax = eval_rCirc_lanes( theta_c );
+   }
+   else // ellipse+lune
+   {
+      const auto above_phi_l = V(phi_l) <= theta_c ;
+      rmin = V(T(0.0));
+      rmax = simd::all( above_phi_l )   ? eval_rEll_lanes( theta_c ) :
+             ! simd::any( above_phi_l ) ? eval_rCirc_lanes( theta_c ) :
+             simd::select( above_phi_l, eval_rEll_lanes( theta_c ), eval_rCirc_lanes( theta_c ) );
+   }
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline void PSCMaps<T,Math,Check>::eval_ArE_half_re_sq_lanes( V theta, V sin_theta, V cos_theta,
+                                                        V & ArE, V & half_re_sq ) const
+{
+   // ArE (eq. 50), with tan(theta) obtained from sin(theta) and cos(theta)
+   const V at = Math::atan( V(sin_beta_abs)*simd::abs( sin_theta/cos_theta ) );
+   ArE = V(axay2)*simd::select( theta <= V(T(0.5*M_PI)), at, V(T(M_PI)) - at );
+
+   // re^2/2 (eq. 45), the square root is not needed
+   half_re_sq = V(T(0.5)*ax*ax)/( V(T(1.0)) - V(cos_beta_sq)*(sin_theta*sin_theta) );
+}
+// --------------------------------------------------------------------------
+// Ar and the radial integrand together: all the terms share sin(theta) and
+// cos(theta) (evaluated together), and the circle terms share
+// sqrt(1-xe^2 sin(theta)^2). In the lune only case
+// this is about half of the transcendental calls needed by 'eval_Ar' plus
+// 'eval_rad_integrand'
+
+template< class T, class Math, class Check > template< class V >
+inline ValDer<V> PSCMaps<T,Math,Check>::eval_Ar_with_integrand_lanes( V theta ) const
+{
+   theta = simd::clamp( theta, V(T(0.0)), V(T(M_PI)) );
+
+   // lune only, theta above phi_l in all lanes
+   if ( center_below_hor && ! simd::any( theta <= V(phi_l) ) )
+      return ValDer<V>{ V(L), V(T(0.0)) } ;
+
+   V sin_theta, cos_theta ;
+   Math::sincos( theta, sin_theta, cos_theta );
+   V ArE        = V(T(0.0)),
+     half_re_sq = V(T(0.0));
+
+   // ellipse only
+   if ( fully_visible )
+   {
+      eval_ArE_half_re_sq_lanes( theta, sin_theta, cos_theta, ArE, half_re_sq );
+      return ValDer<V>{ ArE, half_re_sq } ;
+   }
+
+   // the ellipse terms are needed below phi_l (lune only) or above it (ellipse+lune)
+   const auto below_phi_l = theta <= V(phi_l) ;
+   if ( center_below_hor || ! simd::all( below_phi_l ) )
+      eval_ArE_half_re_sq_lanes( theta, sin_theta, cos_theta, ArE, half_re_sq );
+
+   // values for theta above phi_l
+   const ValDer<V> above = center_below_hor
+                         ? ValDer<V>{ V(L), V(T(0.0)) }
+                         : ValDer<V>{ ArE + V(L), half_re_sq } ;
+   if ( ! simd::any( below_phi_l ) )
+      return above ;
+
+   // circle terms: ArC (eq. 25, as in 'eval_ArC') and rc (eq. 48),
+   // cos(theta) is positive below phi_l < PI/2
+   const V z        = sin_theta ,
+           z_sq     = z*z ,
+           cos_th   = cos_theta ,
+           root_xez = simd::sqrt( V(T(1.0)) - V(xe_sq)*z_sq ),
+           xez      = V(xe)*z ,
+           ArC      = V(T(0.5))*( theta - Math::asin( xez ) + V(xe_sq)*z*cos_th - xez*root_xez ),
+           rc       = root_xez - V(xe)*cos_th ;
+
+   // values for theta below phi_l
+   const ValDer<V> below = center_below_hor
+                         ? ValDer<V>{ ArC - ArE, V(T(0.5))*(rc*rc) - half_re_sq }
+                         : ValDer<V>{ ArC, V(T(0.5))*(rc*rc) } ;
+   if ( simd::all( below_phi_l ) )
+      return below ;
+
+   return ValDer<V>{ simd::select( below_phi_l, below.value, above.value ),
+                     simd::select( below_phi_l, below.der,   above.der   ) } ;
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_ArE_inverse_lanes( V Ar_value ) const
+{
+   Ar_value = simd::clamp( Ar_value, V(T(0.0)), V(E) );
+
+   const V ang = Ar_value/V(axay2) ,
+           at  = Math::atan( Math::tan( ang )/V(sin_beta_abs) );
+
+   return simd::select( ang <= V(T(0.5*M_PI)), at, V(T(M_PI)) + at );
+}
+// --------------------------------------------------------------------------
+
+template< class T, class Math, class Check > template< class V >
+inline V PSCMaps<T,Math,Check>::eval_Ar_inverse_lanes( V Ar_value, const simd::Mask<T> & active ) const
+{
+   const T Ar_max_value = T(0.5)*F ;
+
+   Ar_value = simd::clamp( Ar_value, V(T(0.0)), V(Ar_max_value) );
+
+   // ellipse only: analytical inversion
+   if ( fully_visible )
+      return eval_ArE_inverse_lanes( Ar_value );
+
+   const V A_frac = Ar_value/V(Ar_max_value) ;
+
+   // lune only, small lune area: parabola approximation
+   if ( center_below_hor && L < 1e-5 )
+   {
+      if ( Check::counts )
+         get_case_stats()->parabola += simd::count( active ) ;
+      return V(phi_l)*( V(T(1.0)) - simd::sqrt( V(T(1.0)) - A_frac ) );
+   }
+
+   // normalized versions of Ar(C(\phi)) and the integrand (r_max^2-r_min^2)/2, evaluated together
+   auto Ar_func_integrand = [=]( V theta )
+   {
+      const ValDer<V> Ff = eval_Ar_with_integrand_lanes( theta );
+      return ValDer<V>{ Ff.value/V(Ar_max_value), Ff.der/V(Ar_max_value) } ;
+   } ;
+
+   const T theta_max = center_below_hor ? phi_l : T(M_PI) ;
+
+   // lune only: numerical inversion in all lanes
+   if ( center_below_hor )
+   {
+      const V theta_result = InverseNSB_lanes<T,Check>( Ar_func_integrand, theta_max,
+                                                        A_frac, T(1.0), active,
+                                                        get_inversion_config(), get_case_stats() );
+      return simd::clamp( theta_result, V(T(0.0)), V(theta_max) );
+   }
+
+   // ellipse+lune: analytical inversion in lanes with results above phi_l,
+   // numerical inversion in the other lanes
+   const auto above_phi_l = V(AE_phi_l + L) < Ar_value ;
+   if ( simd::all( above_phi_l | ! active ) )
+      return eval_ArE_inverse_lanes( Ar_value - V(L) );
+
+   const V theta_num = InverseNSB_lanes<T,Check>( Ar_func_integrand, theta_max,
+                                                  A_frac, T(1.0), active & ! above_phi_l,
+                                                  get_inversion_config(), get_case_stats() );
+   return simd::select( above_phi_l, eval_ArE_inverse_lanes( Ar_value - V(L) ),
+                        simd::clamp( theta_num, V(T(0.0)), V(theta_max) ) );
+}
+// --------------------------------------------------------------------------
+// horizontal map, for as many samples as lanes in V
+
+template< class T, class Math, class Check > template< class V >
+inline void PSCMaps<T,Math,Check>::hor_map_lanes( const T * s, const T * t, T * x, T * y,
+                                                  const simd::Mask<T> & active ) const
+{
+   const V sv = simd::load_lanes<V>( s ),
+           tv = simd::load_lanes<V>( t ),
+           u  = simd::abs( V(T(2.0))*tv - V(T(1.0)) );
+
+   // compute the 'y' (positive), by inverting Ap function
+   const V y_pos = eval_Ap_inverse_lanes( u*V(T(0.5)*F), active );
+
+   // compute x's interval
+   V xmin, xmax ;
+   eval_xmin_xmax_lanes( y_pos, xmin, xmax );
+
+   // compute x and y
+   simd::store_lanes( x, (V(T(1.0))-sv)*xmin + sv*xmax );
+   simd::store_lanes( y, simd::flip_sign( y_pos, tv < V(T(0.5)) ) );
+}
+// --------------------------------------------------------------------------
+// radial map (partially visible case), for as many samples as lanes in V
+
+template< class T, class Math, class Check > template< class V >
+inline void PSCMaps<T,Math,Check>::rad_map_lanes( const T * s, const T * t, T * x, T * y,
+                                                  const simd::Mask<T> & active ) const
+{
+   const V sv = simd::load_lanes<V>( s ),
+           tv = simd::load_lanes<V>( t ),
+           u  = simd::abs( V(T(2.0))*tv - V(T(1.0)) );
+
+   // compute varphi by inverting Ar function
+   const V varphi = simd::clamp( eval_Ar_inverse_lanes( u*V(T(0.5)*F), active ),
+                                 V(T(0.0)), V(T(M_PI)) );
+   V rmin, rmax ;
+   eval_rmin_rmax_lanes( varphi, rmin, rmax );
+
+   // compute x and y
+   V sin_varphi, co ;
+   Math::sincos( varphi, sin_varphi, co );
+   const V si  = simd::flip_sign( sin_varphi, tv < V(T(0.5)) ),
+           rad = simd::sqrt( sv*(rmax*rmax) + (V(T(1.0))-sv)*(rmin*rmin) );
+
+   simd::store_lanes( x, V(xe) + rad*co );
+   simd::store_lanes( y, rad*si );
+}
+
+// ****************************************************************************
+
+inline std::string b2s( const bool b  )
+{
+   return b ? "true" : "false" ;
+}
+// ---------------------------------------------------------------------------
+template< class T, class Math, class Check > void PSCMaps<T,Math,Check>::debug( )
+{
+   const std::string
       T_descr = std::is_same<T,float>::value ? "float" :
                   std::is_same<T,double>::value ? "double" :
                      "other" ;
@@ -1251,8 +2797,8 @@ template< class T > void PSCMaps<T>::debug( )
    if ( invisible )
       return ;
 
-   cout << "     cos_beta          == " << cos_beta << endl
-        << "     sin_beta          == " << sin_beta << endl
+   cout << "     cos_beta_sq       == " << cos_beta_sq << endl
+        << "     sin_beta_abs      == " << sin_beta_abs << endl
         << "     ax                == " << ax << endl
         << "     ay                == " << ay << endl ;
    cout << "     E                 == " << E << endl
@@ -1261,7 +2807,7 @@ template< class T > void PSCMaps<T>::debug( )
 
    if ( partially_visible )
    {
-      cout << "     xl                == " << xl << endl
+      cout << "     xl                == " << get_xl() << endl
            << "     yl                == " << yl << endl ;
       if ( using_radial  )
       {
@@ -1271,13 +2817,99 @@ template< class T > void PSCMaps<T>::debug( )
    }
 }
 
+// -----------------------------------------------------------------------------
+// step rules (see declarations above)
+
+template< class T >
+inline T StepHybrid::next( InverseState<T> & st, const T diff, const T ftn )
+{
+   const T tn_next = st.tn - diff/ftn ;
+
+   st.interval_step = std::isnan( tn_next ) || tn_next < st.tn_min || st.tn_max < tn_next ;
+   if ( ! st.interval_step )
+      return tn_next ;
+
+   // tn_next out of range: update interval
+   if ( T(0.0) < diff )
+   {
+      // move to the left (current F(yn) is higher than desired)
+      st.tn_max      = st.tn ;
+      st.diff_tn_max = diff ;
+   }
+   else
+   {
+      // move to the right (current F(yn) is smaller than desired )
+      st.tn_min      = st.tn ;
+      st.diff_tn_min = diff ;
+   }
+   // use the interval midpoint
+   return T(0.5)*st.tn_max + T(0.5)*st.tn_min ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T StepNewton::next( InverseState<T> & st, const T diff, const T ftn )
+{
+   // the interval is never updated, so it is the initial one: [0,t_max]
+   st.interval_step = false ;
+   return std::max( st.tn_min, std::min( st.tn - diff/ftn, st.tn_max ) );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T StepBisection::next( InverseState<T> & st, const T diff, const T ftn )
+{
+   if ( T(0.0) < diff )
+   {
+      st.tn_max      = st.tn ;
+      st.diff_tn_max = diff ;
+   }
+   else
+   {
+      st.tn_min      = st.tn ;
+      st.diff_tn_min = diff ;
+   }
+   st.interval_step = true ;
+   return T(0.5)*st.tn_max + T(0.5)*st.tn_min ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T StepSecant::next( InverseState<T> & st, const T diff, const T ftn )
+{
+   // replace the extreme with the same sign as 'diff', when the other
+   // extreme is kept twice in a row, its difference is halved (Illinois)
+   if ( T(0.0) < diff )
+   {
+      st.tn_max      = st.tn ;
+      st.diff_tn_max = diff ;
+      if ( st.side == -1 )
+         st.diff_tn_min *= T(0.5) ;
+      st.side = -1 ;
+   }
+   else
+   {
+      st.tn_min      = st.tn ;
+      st.diff_tn_min = diff ;
+      if ( st.side == +1 )
+         st.diff_tn_max *= T(0.5) ;
+      st.side = +1 ;
+   }
+   st.interval_step = true ;
+
+   const T den = st.diff_tn_max - st.diff_tn_min ;
+   if ( ! ( T(0.0) < den ) )
+      return T(0.5)*st.tn_max + T(0.5)*st.tn_min ;
+   return ( st.tn_min*st.diff_tn_max - st.tn_max*st.diff_tn_min )/den ;
+}
+
 // -----------------------------------------------------------------------------
 // function InverseNSB
 //
 // evaluate the inverse of a function whose derivative is > 0
 //  Uses Newton method for root finding when possible,
 //  and a combination of Binary search  and Secant methods
-//  (at each step the best option is selected)
+//  (the method is selected by the 'Step' rule)
 //
 // returns the value 't' (in the range [0,t_max]) such that F(t) = Aobj
 // it is assumed that F(t) in [0,A_max] for t in [0,t_max]
@@ -1293,21 +2925,13 @@ template< class T > void PSCMaps<T>::debug( )
 //
 
 
-template< class T >
-T InverseNSB( FuncType<T> F, FuncType<T> f,
-              const T t_max, const T Aobj, const T A_max )
+template< class T, class Step, class Check, class FuncF, class Funcf >
+T InverseNSB( const FuncF & F, const Funcf & f,
+              const T t_max, const T Aobj, const T A_max,
+              const InversionConfig<T> & config,
+              InversionCaseStats * stats )
 {
-   using namespace std ;
-
-   if ( do_checks )
-   if ( Vars<T>::trace_newton_inversion )
-   {
-      // set precision (see: http://en.cppreference.com/w/cpp/io/manip/setprecision)
-      cout << fixed << showpoint << showpos << setprecision( 8 );
-      cout << endl << "begins InverseNSB, t_max = " << t_max << ", Aobj == " << Aobj << ", A_max == " << A_max << endl << endl ;
-   }
-
-   if ( do_checks )
+   if ( Check::checks )
    {
       assert( -epsilon <= Aobj );
       assert( Aobj <= A_max+epsilon );
@@ -1318,116 +2942,190 @@ T InverseNSB( FuncType<T> F, FuncType<T> f,
 
    const T
       A      = std::max( T(0.0), std::min( Aobj, A_max ) ); // A is always positive
-   T
-      tn     = (A/A_max)*t_max, // current best estimation of result value 't'
-      tn_min = T(0.0) ,         // current interval: minimum value
-      tn_max = t_max ,          // current interval: maximum value
-      diff_tn_min = T(0.0)-A ,  // == F(tn_min) - A, (always negative) current difference at the left extreme of the interval
-      diff_tn_max = A_max-A ;   // == F(tn_max) - A, (always positive) current difference at the right extreme of the interval
 
+   InverseState<T> st ;
+   st.tn            = (A/A_max)*t_max ; // current best estimation of result value 't'
+   st.tn_min        = T(0.0) ;          // current interval: minimum value
+   st.tn_max        = t_max ;           // current interval: maximum value
+   st.diff_tn_min   = T(0.0)-A ;        // == F(tn_min) - A, (always negative) current difference at the left extreme of the interval
+   st.diff_tn_max   = A_max-A ;         // == F(tn_max) - A, (always positive) current difference at the right extreme of the interval
+   st.side          = 0 ;
+   st.interval_step = false ;
 
-   int num_iters = 0 ;  // number of iterations so far
+   int  num_iters = 0 ;      // number of iterations so far
+   bool converged = false ;  // true when the exit is due to the tolerance
 
 
    T diff ;
 
    while( true )
    {
-      if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-      {
-         if ( num_iters < 10 ) cout << " " ;
-         cout << "  (" << num_iters  << "): tn_min " << tn_min << ", tn " << tn << ", tn_max " << tn_max  ;
-      }
-      const T Ftn  = F(tn) ;
-
-      if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-         cout << ",  F(tn) " << F(tn)  ;
+      const T Ftn  = F(st.tn) ;
 
       diff = Ftn - A ;
 
-      if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-         cout <<", diff " << diff  ;
-
       // exit when done
-      if ( std::abs( diff ) <= Vars<T>::iN_tolerance )
+      if ( std::abs( diff ) <= config.tolerance )
       {
-         if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-            cout << endl << endl << "end iterations, diff <= tolerance == " << Vars<T>::iN_tolerance << endl ;
+         converged = true ;
          break ;
       }
 
-      // compute derivative, we must trunc it so it there are no out-of-range instabilities
-      const T ftn = f(tn) ;   // we know f(yn) is never negative
+      // compute derivative (only if the step rule uses it)
+      // we know f(yn) is never negative
+      const T ftn = Step::uses_derivative ? f(st.tn) : T(0.0) ;
 
-      if ( do_checks )
-      if ( Vars<T>::trace_newton_inversion )
-         cout << ", f(tn) " << ftn  ;
+      const T tn_next = Step::next( st, diff, ftn );
 
-      const T delta = -diff/ftn ;
+      if ( Check::counts ) if ( stats != nullptr )
+      {
+         if ( st.interval_step )
+            stats->interval_steps++ ;
+         if ( Step::uses_derivative ) if ( std::isnan( st.tn - diff/ftn ) )
+            stats->nan_steps++ ;
+      }
 
-      if ( do_checks )
-      if ( Vars<T>::trace_newton_inversion )
-         cout << ", -diff/ftn " << delta ;
+      st.tn = tn_next ;
+      num_iters++ ;
 
-      T tn_next = tn + delta ;
+      // exit when the max number of iterations is exceeded
+      if ( config.max_iters < num_iters   )
+         break ;
+   }
 
-      if ( std::isnan(tn_next) || (tn_next < tn_min || tn_max < tn_next) )
-      {
-         // tn_next out of range
+   if ( Check::traces )
+   {
+      TraceScratch & scratch = trace_scratch();
+      scratch.iterations = uint16_t( std::min( num_iters, max_iN_max_iters ) );
+      scratch.residual   = double( std::abs( diff ) );
+      scratch.flags      = uint8_t( trace_iterative | ( converged ? trace_converged : 0 ) );
+   }
+   if ( Check::counts ) if ( stats != nullptr )
+   {
+      stats->inversions++ ;
+      stats->iters[std::min( num_iters, num_iters_bins-1 )]++ ;
+      if ( ! converged )
+         stats->max_iters_exits++ ;
+   }
+   // done
+   return st.tn ;
+}
+// -----------------------------------------------------------------------------
+// function InverseNSB_fused
+//
+// 'InverseNSB' always evaluates f(tn) (when it does) right after F(tn), for
+// the same 'tn', so the derivative computed along with F is just kept for it
+
+template< class T, class Step, class Check, class FuncFD >
+T InverseNSB_fused( const FuncFD & FD,
+                    const T t_max, const T Aobj, const T A_max,
+                    const InversionConfig<T> & config,
+                    InversionCaseStats * stats )
+{
+   T der_tn = T(0.0) ; // derivative at the last point F was evaluated
 
-         // update interval
-         if ( 0.0 < diff )
-         {
-            // move to the left (current F(yn) is higher than desired)
-            tn_max      = tn ;
-            diff_tn_max = diff ;
-         }
-         else
-         {
-            // move to the right (current F(yn) is smaller than desired )
-            tn_min      = tn ;
-            diff_tn_min = diff ;
-         }
+   auto F = [&]( const T t ) { const ValDer<T> Ff = FD( t ); der_tn = Ff.der ; return Ff.value ; } ;
+   auto f = [&]( const T )   { return der_tn ; } ;
+
+   return InverseNSB<T,Step,Check>( F, f, t_max, Aobj, A_max, config, stats );
+}
+// -----------------------------------------------------------------------------
+// function InverseNSB_lanes
+//
+// lane-parallel version of 'InverseNSB' (see above), each lane does exactly the
+// same steps as 'InverseNSB' does, until the lane converges
+
+template< class T, class Check, class FuncFD >
+simd::Pack<T> InverseNSB_lanes( FuncFD FD, const T t_max,
+                                const simd::Pack<T> Aobj, const T A_max,
+                                const simd::Mask<T> active,
+                                const InversionConfig<T> & config,
+                                InversionCaseStats * stats )
+{
+   typedef simd::Pack<T> V ;
 
-         // update 'tn' according to the secant rule
-         // 'tn' is in the range [tn_min,tn_max]
-         // tn_next = ( tn_min*diff_tn_max - tn_max*diff_tn_min )/( diff_tn_max - diff_tn_min );
+   const V
+      A      = simd::clamp( Aobj, V(T(0.0)), V(A_max) ); // A is always positive
+   V
+      tn     = (A/V(A_max))*V(t_max), // current best estimation of result value 't'
+      tn_min = V(T(0.0)) ,            // current interval: minimum value
+      tn_max = V(t_max) ;             // current interval: maximum value
+   simd::Mask<T>
+      done   = ! active ;             // lanes already converged (or not active)
 
-         // update tn by using current inteval midpoint
-         tn_next = T(0.5)*tn_max + T(0.5)*tn_min;
+   int num_iters = 0 ;  // number of iterations so far
 
-         if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-            cout << ", (interval) delta = " << (tn_next-tn) ;
-      }
-      else
-      {
-         if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-            cout << ", (newton) delta = " << delta  ;
+   // per lane counts of iterations, interval steps and NaN steps (only with 'Counting')
+   V  lane_iters    = V(T(0.0)) ,
+      lane_interval = V(T(0.0)) ,
+      lane_nan      = V(T(0.0)) ;
+
+   if ( ! simd::any( active ) )
+      return V(T(0.0)) ;
 
+   while( true )
+   {
+      const ValDer<V> Ff   = FD(tn) ;
+      const V         diff = Ff.value - A ;
+
+      // mask off lanes which are done, exit when all of them are done
+      done = done | ( simd::abs( diff ) <= V(config.tolerance) );
+      if ( simd::all( done ) )
+         break ;
+
+      // newton step (the comparisons are false for NaNs, so NaN steps are out of range)
+      const V delta   = -diff/Ff.der ;
+      V       tn_next = tn + delta ;
+
+      const simd::Mask<T>
+         out_of_range = ! ( (tn_min <= tn_next) & (tn_next <= tn_max) ),
+         update       = out_of_range & ! done ,
+         move_left    = V(T(0.0)) < diff ;
+
+      // update intervals and use their midpoint when the newton step is out of range
+      tn_max  = simd::select( update & move_left,   tn, tn_max );
+      tn_min  = simd::select( update & ! move_left, tn, tn_min );
+      if ( Check::counts )
+      {
+         const V one = V(T(1.0)), zero = V(T(0.0)) ;
+         lane_iters    = lane_iters    + simd::select( done, zero, one );
+         lane_interval = lane_interval + simd::select( update, one, zero );
+         lane_nan      = lane_nan      + simd::select( update & ! ( delta <= delta ), one, zero );
       }
 
-      tn = tn_next ;
-      num_iters++ ;
+      tn_next = simd::select( out_of_range, V(T(0.5))*tn_max + V(T(0.5))*tn_min, tn_next );
+      tn      = simd::select( done, tn, tn_next );
 
-      if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-         cout << endl ;
+      num_iters++ ;
 
       // exit when the max number of iterations is exceeded
-      if ( Vars<T>::iN_max_iters < num_iters   )
-      {
-         if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
-            cout << endl << "end iterations: num_iters exceeded max ==  " << Vars<T>::iN_max_iters << endl ;
+      if ( config.max_iters < num_iters )
          break ;
-      }
    }
 
-   if ( do_checks ) if ( Vars<T>::trace_newton_inversion )
+   if ( Check::counts ) if ( stats != nullptr )
    {
-      cout << "ends InverseNSB: tn == " << tn << ", diff == " << diff << endl << endl ;
-      cout << std::defaultfloat ;
+      constexpr int w = V::width ;
+      const V one = V(T(1.0)), zero = V(T(0.0)) ;
+      T is_active[w], is_done[w], iters[w], interval[w], nan[w] ;
+      simd::store( is_active, simd::select( active, one, zero ) );
+      simd::store( is_done, simd::select( done, one, zero ) );
+      simd::store( iters, lane_iters );
+      simd::store( interval, lane_interval );
+      simd::store( nan, lane_nan );
+      for( int i = 0 ; i < w ; i++ )
+      {
+         if ( is_active[i] == T(0.0) )
+            continue ;
+         stats->inversions++ ;
+         stats->iters[std::min( int( iters[i] ), num_iters_bins-1 )]++ ;
+         stats->interval_steps += (unsigned long long)( interval[i] );
+         stats->nan_steps      += (unsigned long long)( nan[i] );
+         if ( is_done[i] == T(0.0) )
+            stats->max_iters_exits++ ;
+      }
    }
-   // done
-   return tn ;
+   return simd::select( active, tn, V(T(0.0)) );
 }
 // ---------------------------------------------------------------------
 // numerically integrate a real function on a real interval (x0,x1),
@@ -1451,8 +3149,8 @@ T numeric_integral( const std::function<T(T)> & f, T x0, T x1, int n )
 // -----------------------------------------------------------------
 // test the integrals
 
-template< class T >
-void PSCMaps<T>::run_test_integrals(  )
+template< class T, class Math, class Check >
+void PSCMaps<T,Math,Check>::run_test_integrals(  )
 {
    using namespace std ;
 
@@ -1516,11 +3214,11 @@ void PSCMaps<T>::run_test_integrals(  )
 
 
 // *****************************************************************************
-// debug functions in template class Vars<T>
+// debug functions in template class InversionConfig<T>
 // -----------------------------------------------------------------------------
 
 template<class T>
-void Vars<T>::print_settings()
+void InversionConfig<T>::print() const
 {
       const std::string
          T_descr = std::is_same<T,float>::value ? "float" :
@@ -1528,11 +3226,135 @@ void Vars<T>::print_settings()
                         "other" ;
    using namespace std ;
    cout << "" << endl
-        << "Global settings " << endl
+        << "Inversion settings " << endl
         << "     T             == " << T_descr << endl
         << "     do_checks     == " << (do_checks ? "true" : "false" ) << endl
-        << "     tolerance     == " << iN_tolerance << endl
-        << "     max. iters.   == " << iN_max_iters << endl ;
+        << "     tolerance     == " << tolerance << endl
+        << "     max. iters.   == " << max_iters << endl
+        << "     trace         == " << (trace ? "true" : "false" ) << endl ;
+}
+
+// *****************************************************************************
+// inversion statistics (see 'InversionStats')
+// -----------------------------------------------------------------------------
+
+inline void InversionCaseStats::add( const InversionCaseStats & other )
+{
+   inversions      += other.inversions ;
+   interval_steps  += other.interval_steps ;
+   nan_steps       += other.nan_steps ;
+   max_iters_exits += other.max_iters_exits ;
+   parabola        += other.parabola ;
+   for( int i = 0 ; i < num_iters_bins ; i++ )
+      iters[i] += other.iters[i] ;
+}
+// -----------------------------------------------------------------------------
+
+inline double InversionCaseStats::mean_iters() const
+{
+   if ( inversions == 0 )
+      return 0.0 ;
+   double sum = 0.0 ;
+   for( int i = 0 ; i < num_iters_bins ; i++ )
+      sum += double( i )*double( iters[i] );
+   return sum/double( inversions );
+}
+// -----------------------------------------------------------------------------
+
+inline void InversionStats::add( const InversionStats & other )
+{
+   for( int m = 0 ; m < 2 ; m++ )
+      for( int c = 0 ; c < num_cap_cases ; c++ )
+         cases[m][c].add( other.cases[m][c] );
+}
+// -----------------------------------------------------------------------------
+
+inline void InversionStats::print( std::ostream & os ) const
+{
+   using namespace std ;
+   const char * case_names[num_cap_cases] = { "ellipse only", "ellipse+lune", "lune only" } ;
+
+   os << "   " << setw(13) << left << "case" << setw(9) << "map" << right
+      << setw(12) << "inversions" << setw(8) << "mean" << setw(11) << "interval"
+      << setw(8) << "NaN" << setw(10) << "max.it." << setw(10) << "parabola" << endl ;
+   for( int m = 0 ; m < 2 ; m++ )
+      for( int c = 0 ; c < num_cap_cases ; c++ )
+      {
+         const InversionCaseStats & cs = cases[m][c] ;
+         if ( cs.inversions == 0 && cs.parabola == 0 )
+            continue ;
+         os << "   " << setw(13) << left << case_names[c] << setw(9) << ( m == 1 ? "radial" : "parallel" ) << right
+            << setw(12) << cs.inversions << fixed << setprecision(2) << setw(8) << cs.mean_iters() << defaultfloat
+            << setw(11) << cs.interval_steps << setw(8) << cs.nan_steps
+            << setw(10) << cs.max_iters_exits << setw(10) << cs.parabola << endl ;
+
+         // histogram: 'iterations:count' for the non-empty bins
+         if ( cs.inversions == 0 )
+            continue ;
+         os << "      iterations:" ;
+         for( int i = 0 ; i < num_iters_bins ; i++ )
+            if ( cs.iters[i] > 0 )
+               os << " " << i << ( i == num_iters_bins-1 ? "+" : "" ) << ":" << cs.iters[i] ;
+         os << endl ;
+      }
+}
+// -----------------------------------------------------------------------------
+// the totals and the mutex which protects them (only used when flushing or
+// reading the totals, never in the evaluations)
+
+inline InversionStats & inversion_stats_totals()
+{
+   static InversionStats totals = InversionStats() ;
+   return totals ;
+}
+inline std::mutex & inversion_stats_mutex()
+{
+   static std::mutex mutex ;
+   return mutex ;
+}
+// -----------------------------------------------------------------------------
+// the statistics of each thread are flushed to the totals when the thread ends
+
+struct ThreadInversionStats
+{
+   InversionStats stats ;
+
+   ThreadInversionStats() : stats() {}
+   ~ThreadInversionStats()
+   {
+      std::lock_guard<std::mutex> lock( inversion_stats_mutex() );
+      inversion_stats_totals().add( stats );
+   }
+} ;
+// -----------------------------------------------------------------------------
+
+inline InversionStats & inversion_stats()
+{
+   static thread_local ThreadInversionStats thread_stats ;
+   return thread_stats.stats ;
+}
+// -----------------------------------------------------------------------------
+
+inline void flush_inversion_stats()
+{
+   InversionStats & own = inversion_stats();
+   std::lock_guard<std::mutex> lock( inversion_stats_mutex() );
+   inversion_stats_totals().add( own );
+   own.reset();
+}
+// -----------------------------------------------------------------------------
+
+inline InversionStats total_inversion_stats()
+{
+   std::lock_guard<std::mutex> lock( inversion_stats_mutex() );
+   return inversion_stats_totals() ;
+}
+// -----------------------------------------------------------------------------
+
+inline void reset_total_inversion_stats()
+{
+   std::lock_guard<std::mutex> lock( inversion_stats_mutex() );
+   inversion_stats_totals().reset();
 }
 // *****************************************************************************
 
@@ -0,0 +1,617 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** baked inverse area tables (memory mapped files), and
+// ** template class 'PSCMapsBaked' (maps which use them)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_BAKED_H
+#define PSCMAPS_BAKED_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>     // open
+#include <unistd.h>    // close
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // fstat
+
+#include "PSCMaps.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// The inverse area functions, normalized, only depend on alpha, beta, the map
+// (parallel or radial) and the target area fraction 'u', so a table of them is
+// valid for any light and shading point. The table is baked once to a file
+// (see 'BakeTable.cpp'), and then it is memory mapped (read only and shared, so
+// the pages are shared by all the processes using the same file).
+//
+// Values stored are w = t/t_max (t is 'y' or 'theta', t_max is the maximum
+// value of t for the cap), as 32 bits floats, for:
+//
+//   - partially visible caps, for each map: a 3D grid on (alpha, b, u), where
+//     b == beta/alpha in [-1,1] (b == 0 is a node, so no cell includes both
+//     lune only and ellipse+lune caps), and 'u' nodes are graded towards u == 1,
+//     where the inverse has an infinite slope. For the radial map, in the
+//     ellipse+lune case, 'u' is relative to the area where the analytic
+//     inversion begins (see 'eval_Ar_inverse'),
+//
+//   - fully visible caps, parallel map: a 1D table on 'u' (the normalized
+//     inverse does not depend on alpha or beta). The radial map does not
+//     iterate in this case, so it needs no table.
+
+// version of the file format, increase it when the format or the values change
+constexpr uint32_t baked_table_version = 1 ;
+
+// default grid sizes (the number of 'b' values must be odd)
+constexpr uint32_t baked_ini_num_alpha = 64 ,
+                   baked_ini_num_b     = 65 ,
+                   baked_ini_num_u     = 129 ;
+
+// maximum number of values in each dimension of a grid, checked when loading
+// (so the table sizes computed from the header never overflow)
+constexpr uint32_t baked_max_num_nodes = 1u << 16 ;
+
+// alignment (in bytes) of the tables offsets in the file
+constexpr uint64_t baked_table_align = 64 ;
+
+// alpha range covered by the tables (other caps use the iterative inversion)
+constexpr double baked_alpha_min = 0.01 ,
+                 baked_alpha_max = 0.5*M_PI - 0.01 ;
+
+// 'b' values used at the extremes of its range (b == +-1 are not partially visible)
+constexpr double baked_b_limit = 0.999 ;
+
+// -----------------------------------------------------------------------------
+// header at the start of a baked table file
+
+struct BakedTableHeader
+{
+   char     magic[8] ;       // == "PSCMTAB" (with the final 0)
+   uint32_t version ,        // == baked_table_version
+            header_size ,    // == sizeof(BakedTableHeader)
+            endian_check ,   // == 0x01020304 (as written by the baking machine)
+            num_alpha ,      // number of alpha values in the partially visible tables
+            num_b ,          // number of b values in the partially visible tables
+            num_u ;          // number of u values in all the tables
+   double   alpha_min ,      // alpha range of the partially visible tables
+            alpha_max ;
+   uint64_t offset_par ,     // offsets (in bytes, from file start) of the tables:
+            offset_rad ,     //   parallel and radial maps (partially visible),
+            offset_ell ,     //   parallel map (fully visible)
+            file_size ;      // total file size in bytes
+} ;
+
+// -----------------------------------------------------------------------------
+// A baked table, memory mapped (read only)
+
+class BakedInverseTable
+{
+   public:
+
+   // creates an empty table (not loaded)
+   BakedInverseTable() ;
+
+   // unmaps the file (if loaded)
+   ~BakedInverseTable() ;
+
+   BakedInverseTable( const BakedInverseTable & ) = delete ;
+   BakedInverseTable & operator = ( const BakedInverseTable & ) = delete ;
+
+   // maps the file, and checks its header, returns false (and the table is not
+   // loaded) if the file cannot be mapped or if it is not a valid table with
+   // the current version (see 'get_error')
+   bool load( const std::string & file_name );
+
+   // unmaps the file (if loaded)
+   void unload();
+
+   // true iif the table has been loaded
+   inline bool is_loaded() const ;
+
+   // message describing why the last call to 'load' failed
+   inline const std::string & get_error() const ;
+
+   // header (only when loaded)
+   inline const BakedTableHeader & get_header() const ;
+
+   // normalized inverse (w = t/t_max) for a partially visible cap
+   // (trilinear interpolation, alpha and b are clamped to the table range)
+   template< class T >
+   T lookup_partial( const bool radial, const T alpha, const T b, const T u ) const ;
+
+   // normalized inverse (w = y/ay) for a fully visible cap, parallel map
+   // (linear interpolation)
+   template< class T >
+   T lookup_ellipse( const T u ) const ;
+
+   // bakes a table to a file, by using iterative inversion with a tight
+   // tolerance, returns false if the file cannot be written
+   static bool bake( const std::string & file_name,
+                     const uint32_t num_alpha, const uint32_t num_b, const uint32_t num_u );
+
+   // 'u' value for the k-th node (out of 'num_u'), nodes are graded towards 1
+   static inline double u_node( const uint32_t k, const uint32_t num_u );
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // position of 'u' on the graded 'u' nodes: node index and fraction
+   inline void u_cell( double u, uint32_t & k, double & f ) const ;
+
+   void *                   mapped ;      // mapped memory (nullptr when not loaded)
+   size_t                   mapped_size ; // size of mapped memory, in bytes
+   const BakedTableHeader * header ;      // header (at the start of mapped memory)
+   const float *            par ;         // tables (within mapped memory)
+   const float *            rad ;
+   const float *            ell ;
+   std::string              error ;       // reason of last failed load
+} ;
+
+// -----------------------------------------------------------------------------
+// A class for projected spherical cap maps which uses a baked table (shared
+// by all instances) to get an initial estimation of the inverse area
+// function, which is improved with a single Newton step.
+//
+// When there is no table, or the cap is not covered by it, 'eval_map' just
+// uses 'PSCMaps::eval_map'.
+
+template< typename T >
+class PSCMapsBaked
+{
+   public:
+
+   // Creates an uninitialized 'empty' object (not usable)
+   PSCMapsBaked();
+
+   // Initializes the maps object (see 'PSCMaps::initialize'), 'p_table' is
+   // the baked table to use (it can be nullptr or not loaded), 'p_config' is
+   // used when the table is not
+   void initialize( const T p_alpha, const T p_beta, const bool p_use_radial,
+                    const BakedInverseTable * p_table,
+                    const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // evaluates one of the two maps (according to 'using_radial')
+   // (s,t) must be in [0,1]^2
+   void eval_map( T s, T t, T &x, T &y ) const ;
+
+   // the underlying maps object
+   inline const PSCMaps<T> & get_maps() const ;
+
+   // true when the baked table is used by 'eval_map'
+   inline bool is_using_table() const ;
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // evaluates the inverse area function (t in [0,t_max]) for 'u' in [0,1]
+   // (only when the table is used), from the table and a Newton step
+   T eval_inverse( const T u ) const ;
+
+   PSCMaps<T> maps ;                  // maps object (initialized)
+   const BakedInverseTable * table ;  // table in use, or nullptr when not used
+
+   T  alpha ,    // cap parameters (clamped as in 'PSCMaps::initialize')
+      b ,        // == beta/alpha
+      t_max ,    // maximum value for the inverse (yl, ay, or phi_l)
+      u_split ;  // radial map: 'u' where the analytic inversion begins (1 otherwise)
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// -----------------------------------------------------------------------------
+
+inline BakedInverseTable::BakedInverseTable()
+{
+   mapped      = nullptr ;
+   mapped_size = 0 ;
+   header      = nullptr ;
+   par         = nullptr ;
+   rad         = nullptr ;
+   ell         = nullptr ;
+}
+// -----------------------------------------------------------------------------
+
+inline BakedInverseTable::~BakedInverseTable()
+{
+   unload();
+}
+// -----------------------------------------------------------------------------
+
+inline void BakedInverseTable::unload()
+{
+   if ( mapped != nullptr )
+      munmap( mapped, mapped_size );
+
+   mapped      = nullptr ;
+   mapped_size = 0 ;
+   header      = nullptr ;
+   par         = nullptr ;
+   rad         = nullptr ;
+   ell         = nullptr ;
+}
+// -----------------------------------------------------------------------------
+
+inline bool BakedInverseTable::is_loaded() const
+{
+   return mapped != nullptr ;
+}
+// -----------------------------------------------------------------------------
+
+inline const std::string & BakedInverseTable::get_error() const
+{
+   return error ;
+}
+// -----------------------------------------------------------------------------
+
+inline const BakedTableHeader & BakedInverseTable::get_header() const
+{
+   if ( do_checks )
+      assert( is_loaded() );
+   return *header ;
+}
+// -----------------------------------------------------------------------------
+
+inline bool BakedInverseTable::load( const std::string & file_name )
+{
+   unload();
+
+   const int fd = open( file_name.c_str(), O_RDONLY );
+   if ( fd < 0 )
+   {
+      error = "cannot open file '" + file_name + "'" ;
+      return false ;
+   }
+
+   struct stat st ;
+   if ( fstat( fd, &st ) != 0 || size_t( st.st_size ) < sizeof(BakedTableHeader) )
+   {
+      close( fd );
+      error = "file '" + file_name + "' is too small" ;
+      return false ;
+   }
+
+   // the mapping is kept after closing the file
+   const size_t size = size_t( st.st_size );
+   void *       mem  = mmap( nullptr, size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if ( mem == MAP_FAILED )
+   {
+      error = "cannot map file '" + file_name + "'" ;
+      return false ;
+   }
+
+   // check the header (the file is not trusted: the dimensions are bounded
+   // before computing the sizes, and the offsets are checked without overflow)
+   const BakedTableHeader * h = static_cast<const BakedTableHeader *>( mem );
+   const bool dims_ok = 2 <= h->num_alpha && h->num_alpha <= baked_max_num_nodes &&
+                        2 <= h->num_b     && h->num_b     <= baked_max_num_nodes &&
+                        2 <= h->num_u     && h->num_u     <= baked_max_num_nodes ;
+   const uint64_t par_size = dims_ok ? uint64_t(h->num_alpha)*uint64_t(h->num_b)*uint64_t(h->num_u)*sizeof(float) : 0 ,
+                  ell_size = dims_ok ? uint64_t(h->num_u)*sizeof(float) : 0 ;
+   auto fits = [&]( uint64_t offset, uint64_t table_size )
+   {
+      return offset % baked_table_align == 0 && offset <= size && table_size <= size - offset ;
+   } ;
+
+   if ( std::strncmp( h->magic, "PSCMTAB", sizeof(h->magic) ) != 0 )
+      error = "file '" + file_name + "' is not a baked table" ;
+   else if ( h->version != baked_table_version )
+      error = "file '" + file_name + "' has version " + std::to_string( h->version ) +
+              ", expected " + std::to_string( baked_table_version ) ;
+   else if ( h->header_size != sizeof(BakedTableHeader) || h->endian_check != 0x01020304 )
+      error = "file '" + file_name + "' was baked on an incompatible machine" ;
+   else if ( h->file_size != size || ! dims_ok ||
+             ! fits( h->offset_par, par_size ) || ! fits( h->offset_rad, par_size ) ||
+             ! fits( h->offset_ell, ell_size ) )
+      error = "file '" + file_name + "' has wrong sizes" ;
+   else if ( ! ( 0.0 < h->alpha_min && h->alpha_min < h->alpha_max && h->alpha_max <= 0.5*M_PI ) )
+      error = "file '" + file_name + "' has a wrong alpha range" ;
+   else
+      error.clear();
+
+   if ( ! error.empty() )
+   {
+      munmap( mem, size );
+      return false ;
+   }
+
+   const char * bytes = static_cast<const char *>( mem );
+   mapped      = mem ;
+   mapped_size = size ;
+   header      = h ;
+   par         = reinterpret_cast<const float *>( bytes + h->offset_par );
+   rad         = reinterpret_cast<const float *>( bytes + h->offset_rad );
+   ell         = reinterpret_cast<const float *>( bytes + h->offset_ell );
+   return true ;
+}
+// -----------------------------------------------------------------------------
+// u_k = 1-(1-k/(n-1))^2
+
+inline double BakedInverseTable::u_node( const uint32_t k, const uint32_t num_u )
+{
+   const double w = 1.0 - double(k)/double(num_u-1) ;
+   return 1.0 - w*w ;
+}
+// -----------------------------------------------------------------------------
+
+inline void BakedInverseTable::u_cell( double u, uint32_t & k, double & f ) const
+{
+   const uint32_t n  = header->num_u ;
+   u = std::max( 0.0, std::min( u, 1.0 ));
+   const double   fu = double(n-1)*( 1.0 - std::sqrt( 1.0-u ) );
+   k = std::min( uint32_t( fu ), n-2 );
+   f = fu - double(k) ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+T BakedInverseTable::lookup_partial( const bool radial, const T alpha, const T b, const T u ) const
+{
+   if ( do_checks )
+      assert( is_loaded() );
+
+   const BakedTableHeader & h = *header ;
+   const float *            v = radial ? rad : par ;
+
+   // alpha and b cells
+   const double fa = double(h.num_alpha-1)*( double(alpha)-h.alpha_min )/( h.alpha_max-h.alpha_min ),
+                fb = double(h.num_b-1)*T(0.5)*( double(b) + 1.0 ),
+                fac = std::max( 0.0, std::min( fa, double(h.num_alpha-1) )),
+                fbc = std::max( 0.0, std::min( fb, double(h.num_b-1) ));
+   const uint32_t ia = std::min( uint32_t( fac ), h.num_alpha-2 ),
+                  ib = std::min( uint32_t( fbc ), h.num_b-2 );
+   const double   wa = fac - double(ia),
+                  wb = fbc - double(ib);
+   uint32_t ku ;
+   double   wu ;
+   u_cell( double(u), ku, wu );
+
+   // trilinear interpolation
+   auto at = [&]( uint32_t i, uint32_t j ) // linear interpolation on u, at (i,j)
+   {
+      const float * p = v + ( size_t(i)*h.num_b + j )*h.num_u + ku ;
+      return (1.0-wu)*double( p[0] ) + wu*double( p[1] ) ;
+   } ;
+   const double w0 = (1.0-wb)*at( ia,   ib ) + wb*at( ia,   ib+1 ),
+                w1 = (1.0-wb)*at( ia+1, ib ) + wb*at( ia+1, ib+1 );
+
+   return T( (1.0-wa)*w0 + wa*w1 );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+T BakedInverseTable::lookup_ellipse( const T u ) const
+{
+   if ( do_checks )
+      assert( is_loaded() );
+
+   uint32_t ku ;
+   double   wu ;
+   u_cell( double(u), ku, wu );
+   return T( (1.0-wu)*double( ell[ku] ) + wu*double( ell[ku+1] ) );
+}
+// -----------------------------------------------------------------------------
+
+inline bool BakedInverseTable::bake( const std::string & file_name,
+                                     const uint32_t num_alpha, const uint32_t num_b, const uint32_t num_u )
+{
+   assert( 2 <= num_alpha && 3 <= num_b && 2 <= num_u );
+   assert( num_b % 2 == 1 );
+
+   // header, tables start at multiples of 64 bytes
+   auto align = []( uint64_t offset ) { return (offset + baked_table_align-1)/baked_table_align*baked_table_align ; } ;
+   const uint64_t par_size = uint64_t(num_alpha)*num_b*num_u*sizeof(float) ;
+
+   BakedTableHeader h ;
+   std::memset( &h, 0, sizeof(h) );
+   std::strncpy( h.magic, "PSCMTAB", sizeof(h.magic) );
+   h.version      = baked_table_version ;
+   h.header_size  = sizeof(BakedTableHeader) ;
+   h.endian_check = 0x01020304 ;
+   h.num_alpha    = num_alpha ;
+   h.num_b        = num_b ;
+   h.num_u        = num_u ;
+   h.alpha_min    = baked_alpha_min ;
+   h.alpha_max    = baked_alpha_max ;
+   h.offset_par   = align( sizeof(h) );
+   h.offset_rad   = align( h.offset_par + par_size );
+   h.offset_ell   = align( h.offset_rad + par_size );
+   h.file_size    = h.offset_ell + num_u*sizeof(float) ;
+
+   std::vector<char> bytes( h.file_size, 0 );
+   std::memcpy( bytes.data(), &h, sizeof(h) );
+   float * par = reinterpret_cast<float *>( bytes.data() + h.offset_par ),
+         * rad = reinterpret_cast<float *>( bytes.data() + h.offset_rad ),
+         * ell = reinterpret_cast<float *>( bytes.data() + h.offset_ell );
+
+   // tight tolerance for the inversions
+   const InversionConfig<double> config( 1e-12, 100 );
+
+   PSCMaps<double> maps ;
+
+   for( uint32_t i = 0 ; i < num_alpha ; i++ )
+   for( uint32_t j = 0 ; j < num_b ; j++ )
+   {
+      const double alpha = h.alpha_min + (h.alpha_max-h.alpha_min)*double(i)/double(num_alpha-1),
+                   b     = std::max( -baked_b_limit, std::min( -1.0 + 2.0*double(j)/double(num_b-1), baked_b_limit ));
+
+      for( const bool radial : { false, true } )
+      {
+         maps.initialize( alpha, b*alpha, radial, config );
+         assert( maps.partially_visible );
+
+         float * v = ( radial ? rad : par ) + ( size_t(i)*num_b + j )*num_u ;
+         for( uint32_t k = 0 ; k < num_u ; k++ )
+         {
+            const double u = u_node( k, num_u );
+            double w ;
+            if ( ! radial )
+               w = maps.eval_Ap_inverse( u*0.5*maps.F )/( maps.center_below_hor ? maps.yl : maps.ay );
+            else
+            {
+               const double u_split = maps.center_below_hor ? 1.0 : (maps.AE_phi_l + maps.L)/(0.5*maps.F) ;
+               w = maps.eval_Ar_inverse( u*u_split*0.5*maps.F )/maps.phi_l ;
+            }
+            v[k] = float( std::max( 0.0, std::min( w, 1.0 )) );
+         }
+      }
+   }
+
+   // fully visible, parallel map (any fully visible cap gives the same values)
+   maps.initialize( 0.5, 1.0, false, config );
+   for( uint32_t k = 0 ; k < num_u ; k++ )
+      ell[k] = float( maps.eval_Ap_inverse( u_node( k, num_u )*0.5*maps.F )/maps.ay );
+
+   // write the file
+   std::FILE * file = std::fopen( file_name.c_str(), "wb" );
+   if ( file == nullptr )
+      return false ;
+   const bool ok = std::fwrite( bytes.data(), 1, bytes.size(), file ) == bytes.size() ;
+   return ( std::fclose( file ) == 0 ) && ok ;
+}
+
+// -----------------------------------------------------------------------------
+// Creates an uninitialized 'empty' object (not usable)
+
+template< class T >
+PSCMapsBaked<T>::PSCMapsBaked( )
+{
+   table = nullptr ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline const PSCMaps<T> & PSCMapsBaked<T>::get_maps() const
+{
+   return maps ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline bool PSCMapsBaked<T>::is_using_table() const
+{
+   return table != nullptr ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsBaked<T>::initialize( const T p_alpha, const T p_beta, const bool p_use_radial,
+                                  const BakedInverseTable * p_table,
+                                  const InversionConfig<T> & p_config )
+{
+   maps.initialize( p_alpha, p_beta, p_use_radial, p_config );
+   table = nullptr ;
+
+   if ( p_table == nullptr || ! p_table->is_loaded() || maps.invisible )
+      return ;
+
+   // the radial map does not iterate for fully visible caps
+   if ( maps.fully_visible )
+   {
+      if ( ! maps.using_radial )
+      {
+         t_max   = maps.ay ;
+         u_split = T(1.0) ;
+         table   = p_table ;
+      }
+      return ;
+   }
+
+   // partially visible, alpha must be in the table range
+   const BakedTableHeader & h = p_table->get_header();
+   alpha = std::min( T(0.5*M_PI), p_alpha );
+   if ( alpha < T(h.alpha_min) || T(h.alpha_max) < alpha )
+      return ;
+
+   b = std::max( T(-1.0), std::min( p_beta/alpha, T(1.0) ));
+
+   if ( ! maps.using_radial )
+   {
+      t_max   = maps.center_below_hor ? maps.yl : maps.ay ;
+      u_split = T(1.0) ;
+   }
+   else
+   {
+      t_max   = maps.phi_l ;
+      u_split = maps.center_below_hor ? T(1.0) : (maps.AE_phi_l + maps.L)/(T(0.5)*maps.F) ;
+   }
+   table = p_table ;
+}
+// --------------------------------------------------------------------------
+// the Newton step is discarded when it goes out of [0,t_max] (or is NaN)
+
+template< class T >
+T PSCMapsBaked<T>::eval_inverse( const T u ) const
+{
+   const T w  = maps.fully_visible
+              ? table->lookup_ellipse( u )
+              : table->lookup_partial( maps.using_radial, alpha, b, u/u_split ),
+           t0 = w*t_max ;
+
+   const ValDer<T> Ff = maps.using_radial
+                      ? maps.eval_Ar_with_integrand_lanes( t0 )
+                      : maps.eval_Ap_with_integrand_lanes( t0 ) ;
+   const T t1 = t0 - ( Ff.value - u*T(0.5)*maps.F )/Ff.der ;
+
+   return ( T(0.0) <= t1 && t1 <= t_max ) ? t1 : t0 ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsBaked<T>::eval_map( T s, T t, T &x, T &y ) const
+{
+   if ( table == nullptr )
+   {
+      maps.eval_map( s, t, x, y );
+      return ;
+   }
+
+   if ( do_checks )
+   {
+      assert( T(0.0) <= s && s <= T(1.0) );
+      assert( T(0.0) <= t && t <= T(1.0) );
+   }
+
+   // compute 'u' by scaling and translating 't' (as in 'PSCMaps')
+   const bool t_is_neg = t < T(0.5) ;
+   const T    u        = t_is_neg ? T(1.0)-T(2.0)*t
+                                  : T(2.0)*t - T(1.0) ;
+
+   if ( ! maps.using_radial )
+   {
+      maps.hor_map_from_y( s, t_is_neg, eval_inverse( u ), x, y );
+      return ;
+   }
+
+   // radial map (partially visible)
+   const T varphi = ( u <= u_split )
+                  ? eval_inverse( u )
+                  : std::max( T(0.0), std::min( maps.eval_ArE_inverse( u*T(0.5)*maps.F - maps.L ), T(M_PI) ));
+   T rmin, rmax ;
+   maps.eval_rmin_rmax( varphi, rmin, rmax );
+   maps.rad_map_from_angle( s, t_is_neg, varphi, rmin, rmax, false, x, y );
+}
+
+} // end namespace PSCM
+
+#endif
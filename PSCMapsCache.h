@@ -0,0 +1,255 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'PSCMapsCache' (LRU cache of initialized maps)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_CACHE_H
+#define PSCMAPS_CACHE_H
+
+#include <cstdint>
+#include <cmath>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+#include "PSCMaps.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// constants (evaluated at compile time)
+
+// default max. number of maps objects in a cache
+constexpr size_t cache_ini_capacity = 1024 ;
+
+// default max. error in alpha and beta (radians) for the cached maps
+constexpr double cache_ini_angle_error = 1e-3 ;
+
+// -----------------------------------------------------------------------------
+// A cache of initialized maps objects, with 'least recently used' replacement.
+//
+// Many (light, shading point) pairs have nearly the same alpha and beta, so
+// they can share an initialized maps object. Alpha and beta are quantized with
+// a step which is twice 'max_angle_error', and the maps objects are initialized
+// for the quantized values, so the error in the angles is never larger than
+// 'max_angle_error' (and the result does not depend on the order of requests).
+// Caps with alpha below the quantization step are not cached (the relative
+// error would be too large), they are initialized for the exact angles. Nor
+// are caps with angles too large w.r.t. the step for their quantized values to
+// fit in the 64-bit keys (which only happens with very small steps).
+//
+// The cache is not thread safe, each thread should have its own cache (with its
+// own inversion settings, if needed), e.g.:
+//
+//    thread_local PSCMapsCache<float> cache ;
+//    const PSCMaps<float> & pscm = cache.get( alpha, beta, true );
+
+template< typename T >
+class PSCMapsCache
+{
+   public:
+
+   // creates an empty cache with 'p_capacity' entries at most, the maps objects
+   // are initialized with 'p_config' (see 'PSCMaps::initialize')
+   PSCMapsCache( const size_t               p_capacity        = cache_ini_capacity,
+                 const T                    p_max_angle_error = T(cache_ini_angle_error),
+                 const InversionConfig<T> & p_config          = InversionConfig<T>() );
+
+   // returns a maps object initialized for angles within 'max_angle_error' of
+   // (p_alpha,p_beta), with 'p_use_radial' (see 'PSCMaps::initialize').
+   // The reference is valid until the next call to 'get' or 'clear'
+   const PSCMaps<T> & get( const T p_alpha, const T p_beta, const bool p_use_radial );
+
+   // removes all the entries (the counters are not reset)
+   void clear();
+
+   // sets the counters to 0
+   void reset_counters();
+
+   // query the cache status and counters
+   inline size_t get_num_hits() const ;     // number of calls to 'get' which found a cached object
+   inline size_t get_num_misses() const ;   // number of calls to 'get' which initialized an object
+   inline size_t get_num_entries() const ;  // number of objects in the cache
+   inline size_t get_capacity() const ;     // max. number of objects in the cache
+   inline T      get_max_angle_error() const ;
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // a quantized (alpha,beta,map) triple
+   struct Key
+   {
+      int64_t ia, ib ;   // alpha and beta, divided by the step (rounded)
+      bool    radial ;   // using radial map
+      bool operator == ( const Key & k ) const
+         { return ia == k.ia && ib == k.ib && radial == k.radial ; }
+   } ;
+   struct KeyHash
+   {
+      size_t operator() ( const Key & k ) const
+         { return size_t( ( uint64_t(k.ia)*73856093u ) ^ ( uint64_t(k.ib)*19349663u ) ^ uint64_t(k.radial) ) ; }
+   } ;
+
+   typedef std::pair< Key, PSCMaps<T> >                      Entry ;
+   typedef std::list< Entry >                                List ;
+
+   size_t capacity ;      // max. number of entries
+   T      step ,          // quantization step (== 2*max_angle_error)
+          max_angle ;     // larger angles (in absolute value) are not cached
+   size_t num_hits ,      // counters
+          num_misses ;
+   InversionConfig<T>
+          config ;        // inversion settings of the maps objects
+
+   List   entries ;       // cached objects, most recently used first
+   std::unordered_map< Key, typename List::iterator, KeyHash >
+          index ;         // position of each key in 'entries'
+   PSCMaps<T>
+          uncached ;      // object returned for caps which are not cached
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// -----------------------------------------------------------------------------
+
+template< class T >
+PSCMapsCache<T>::PSCMapsCache( const size_t p_capacity, const T p_max_angle_error,
+                               const InversionConfig<T> & p_config )
+{
+   if ( do_checks )
+   {
+      assert( 0 < p_capacity );
+      assert( T(0.0) < p_max_angle_error );
+   }
+   capacity   = p_capacity ;
+   step       = T(2.0)*p_max_angle_error ;
+   max_angle  = T(1e18)*step ; // (so the keys are below 2^63 in absolute value)
+   num_hits   = 0 ;
+   num_misses = 0 ;
+   config     = p_config ;
+   index.reserve( capacity );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+const PSCMaps<T> & PSCMapsCache<T>::get( const T p_alpha, const T p_beta, const bool p_use_radial )
+{
+   // small caps are not cached, nor caps whose keys would overflow
+   if ( p_alpha < step || max_angle < p_alpha || max_angle < std::abs( p_beta ) )
+   {
+      num_misses++ ;
+      uncached.initialize( p_alpha, p_beta, p_use_radial, config );
+      return uncached ;
+   }
+
+   const Key key = { int64_t( std::llround( p_alpha/step ) ),
+                     int64_t( std::llround( p_beta/step ) ),
+                     p_use_radial } ;
+
+   // hit on the most recently used entry (frequent, for coherent requests)
+   if ( ! entries.empty() && entries.front().first == key )
+   {
+      num_hits++ ;
+      return entries.front().second ;
+   }
+
+   // hit: move the entry to the front
+   const auto found = index.find( key );
+   if ( found != index.end() )
+   {
+      num_hits++ ;
+      entries.splice( entries.begin(), entries, found->second );
+      return found->second->second ;
+   }
+
+   // miss: reuse the least recently used entry when the cache is full
+   num_misses++ ;
+   if ( entries.size() < capacity )
+      entries.emplace_front( key, PSCMaps<T>() );
+   else
+   {
+      index.erase( entries.back().first );
+      entries.splice( entries.begin(), entries, std::prev( entries.end() ) );
+      entries.front().first = key ;
+   }
+   index[key] = entries.begin() ;
+
+   // initialize for the quantized angles (within the valid range)
+   const T pi2 = T(0.5*M_PI) ;
+   PSCMaps<T> & maps = entries.front().second ;
+   maps.initialize( std::min( T(key.ia)*step, pi2 ),
+                    std::max( -pi2, std::min( T(key.ib)*step, pi2 )),
+                    p_use_radial, config );
+   return maps ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsCache<T>::clear()
+{
+   entries.clear();
+   index.clear();
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsCache<T>::reset_counters()
+{
+   num_hits   = 0 ;
+   num_misses = 0 ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsCache<T>::get_num_hits() const
+{
+   return num_hits ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsCache<T>::get_num_misses() const
+{
+   return num_misses ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsCache<T>::get_num_entries() const
+{
+   return entries.size() ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsCache<T>::get_capacity() const
+{
+   return capacity ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T PSCMapsCache<T>::get_max_angle_error() const
+{
+   return T(0.5)*step ;
+}
+
+} // end namespace PSCM
+
+#endif
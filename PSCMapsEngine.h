@@ -0,0 +1,360 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'PSCMapsEngine' (multithreaded evaluation of many caps)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_ENGINE_H
+#define PSCMAPS_ENGINE_H
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include "PSCMaps.h"
+#include "PSCSequences.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// constants (evaluated at compile time)
+
+// default max. number of samples in a chunk (the unit of work of the engine)
+constexpr size_t engine_ini_chunk_size = 1024 ;
+
+// -----------------------------------------------------------------------------
+// A job for the engine: 'num_samples' samples of one spherical cap
+
+template< typename T >
+struct SampleJob
+{
+   T        alpha ,        // cap angles (see 'PSCMaps::initialize')
+            beta ;
+   bool     use_radial ;   // map to use (see 'PSCMaps::initialize')
+   size_t   num_samples ;  // number of samples
+   const T  * s ,          // input coordinates (in [0,1]), or nullptr: the engine
+            * t ;          //    generates the samples (see below)
+   T        * x ,          // output coordinates (in the local frame), 'num_samples' values each
+            * y ;          //    (they are set to 0 when the cap is invisible)
+} ;
+
+// -----------------------------------------------------------------------------
+// An engine which evaluates the maps for a list of jobs, using several threads.
+//
+// The jobs are split in chunks of at most 'chunk_size' samples (small jobs are
+// a chunk each), and each thread initially owns a contiguous range of chunks.
+// A thread takes chunks from the front of its own range, and when it is empty,
+// it steals the back half of the range of another thread. Thus, the threads
+// holding caps which need iterations (lune only, ellipse+lune) are helped by
+// those holding caps which do not (ellipse only, radial map).
+//
+// Each thread uses its own maps object (initialized once for each run of
+// chunks of the same job), and writes only to the outputs of its chunks: the
+// only shared mutable state are the ranges, each one with its own mutex.
+//
+// When a job has no input coordinates, sample 'i' of job 'j' is point 'i' of
+// a sequence (uniform random by default, see 'set_sequence' and 'PSCSequences.h')
+// whose seed is a hash of (seed,j), so the results do not depend on the number
+// of threads or on the order in which the chunks are evaluated.
+
+template< typename T, class Math = MathStd, class Check = Checked >
+class PSCMapsEngine
+{
+   public:
+
+   // creates an engine with 'p_num_threads' threads (0: one for each hardware
+   // thread), the maps are initialized with 'p_config', and 'p_seed' is used
+   // to generate the samples
+   PSCMapsEngine( const unsigned             p_num_threads = 0,
+                  const size_t               p_chunk_size  = engine_ini_chunk_size,
+                  const InversionConfig<T> & p_config      = InversionConfig<T>(),
+                  const uint64_t             p_seed        = 0 );
+
+   // evaluates all the samples in 'jobs' (an array with 'num_jobs' jobs), and
+   // writes the area of the cap of job 'j' in 'areas[j]' (when 'areas' is not
+   // nullptr). Returns when all the samples have been evaluated
+   void run( const SampleJob<T> * jobs, const size_t num_jobs, T * areas = nullptr );
+
+   // enables or disables work stealing (when disabled, each thread just
+   // evaluates its initial range of chunks)
+   inline void set_work_stealing( const bool p_work_stealing );
+
+   // selects the sequence used to generate the samples of the jobs without
+   // input coordinates (each job gets its own scrambling or random shift)
+   inline void set_sequence( const SequenceKind p_sequence );
+
+   // query the engine settings and the statistics of the last run
+   inline unsigned get_num_threads() const ;
+   inline size_t   get_chunk_size() const ;
+   inline size_t   get_num_chunks() const ;  // chunks evaluated
+   inline size_t   get_num_steals() const ;  // ranges stolen
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // part of a job
+   struct Chunk
+   {
+      size_t job ,    // index of the job
+             first ,  // index of the first sample in the job
+             count ;  // number of samples
+   } ;
+
+   // range of chunks owned by a thread (padded, so ranges are in different cache lines)
+   struct Range
+   {
+      std::mutex mutex ;
+      size_t     begin ,
+                 end ;
+      char       padding[64] ;
+   } ;
+
+   // evaluates the chunks of thread 'w' (and those it steals) until there are none left
+   void worker( const unsigned w, const SampleJob<T> * jobs, T * areas,
+                std::vector<Range> & ranges, size_t & num_steals ) const ;
+
+   // evaluates a chunk with 'maps', which is initialized for the chunk's job unless
+   // 'maps_job' is that job already. 's_buf' and 't_buf' have room for a chunk
+   void eval_chunk( const Chunk & chunk, const SampleJob<T> * jobs, T * areas,
+                    PSCMaps<T,Math,Check> & maps, size_t & maps_job,
+                    T * s_buf, T * t_buf ) const ;
+
+   unsigned           num_threads ;
+   size_t             chunk_size ;
+   InversionConfig<T> config ;
+   uint64_t           seed ;
+   bool               work_stealing ;
+   SequenceKind       sequence ;
+
+   std::vector<Chunk> chunks ;     // chunks of the last run
+   size_t             num_steals ; // ranges stolen in the last run
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+PSCMapsEngine<T,Math,Check>::PSCMapsEngine( const unsigned p_num_threads, const size_t p_chunk_size,
+                                            const InversionConfig<T> & p_config, const uint64_t p_seed )
+{
+   if ( Check::checks )
+      assert( 0 < p_chunk_size );
+
+   num_threads   = ( p_num_threads > 0 ) ? p_num_threads
+                                         : std::max( 1u, std::thread::hardware_concurrency() );
+   chunk_size    = p_chunk_size ;
+   config        = p_config ;
+   seed          = p_seed ;
+   work_stealing = true ;
+   sequence      = sequence_uniform ;
+   num_steals    = 0 ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+void PSCMapsEngine<T,Math,Check>::run( const SampleJob<T> * jobs, const size_t num_jobs, T * areas )
+{
+   if ( Check::checks )
+      for( size_t j = 0 ; j < num_jobs ; j++ )
+      {
+         assert( jobs[j].num_samples == 0 || ( jobs[j].x != nullptr && jobs[j].y != nullptr ));
+         assert( ( jobs[j].s == nullptr ) == ( jobs[j].t == nullptr ) );
+      }
+
+   // split the jobs in chunks
+   chunks.clear();
+   for( size_t j = 0 ; j < num_jobs ; j++ )
+   {
+      const size_t n = jobs[j].num_samples ;
+      if ( n == 0 ) // evaluated only for its area
+         chunks.push_back( Chunk{ j, 0, 0 } );
+      for( size_t first = 0 ; first < n ; first += chunk_size )
+         chunks.push_back( Chunk{ j, first, std::min( chunk_size, n-first ) } );
+   }
+
+   // initial ranges: contiguous, with the same number of chunks
+   std::vector<Range> ranges( num_threads );
+   for( unsigned w = 0 ; w < num_threads ; w++ )
+   {
+      ranges[w].begin = ( chunks.size()*w )/num_threads ;
+      ranges[w].end   = ( chunks.size()*(w+1) )/num_threads ;
+   }
+
+   // run the workers (the calling thread is worker 0)
+   std::vector<size_t>      steals( num_threads, 0 );
+   std::vector<std::thread> threads ;
+   for( unsigned w = 1 ; w < num_threads ; w++ )
+      threads.emplace_back( [=,&ranges,&steals]() { worker( w, jobs, areas, ranges, steals[w] ); } );
+   worker( 0, jobs, areas, ranges, steals[0] );
+   for( std::thread & thread : threads )
+      thread.join();
+
+   num_steals = 0 ;
+   for( const size_t s : steals )
+      num_steals += s ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+void PSCMapsEngine<T,Math,Check>::worker( const unsigned w, const SampleJob<T> * jobs, T * areas,
+                                          std::vector<Range> & ranges, size_t & p_num_steals ) const
+{
+   PSCMaps<T,Math,Check> maps ;
+   size_t                maps_job = size_t(-1) ; // job 'maps' is initialized for (none)
+   std::vector<T>        s_buf( chunk_size ), t_buf( chunk_size );
+   Range &               own = ranges[w] ;
+
+   while( true )
+   {
+      // take the first chunk of the own range
+      size_t c = size_t(-1) ;
+      {
+         std::lock_guard<std::mutex> lock( own.mutex );
+         if ( own.begin < own.end )
+            c = own.begin++ ;
+      }
+
+      // the own range is empty: steal the back half of the first non-empty range
+      if ( c == size_t(-1) )
+      {
+         if ( ! work_stealing )
+            return ;
+
+         size_t stolen_begin = 0, stolen_end = 0 ;
+         for( unsigned k = 1 ; k < num_threads && stolen_begin == stolen_end ; k++ )
+         {
+            Range & victim = ranges[(w+k) % num_threads] ;
+            std::lock_guard<std::mutex> lock( victim.mutex );
+            const size_t n = victim.end - victim.begin ;
+            if ( n > 0 )
+            {
+               stolen_end   = victim.end ;
+               stolen_begin = victim.end - (n+1)/2 ;
+               victim.end   = stolen_begin ;
+            }
+         }
+         if ( stolen_begin == stolen_end ) // all the ranges are empty
+            return ;
+
+         p_num_steals++ ;
+         c = stolen_begin ;
+         std::lock_guard<std::mutex> lock( own.mutex );
+         own.begin = stolen_begin+1 ;
+         own.end   = stolen_end ;
+      }
+
+      eval_chunk( chunks[c], jobs, areas, maps, maps_job, s_buf.data(), t_buf.data() );
+   }
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+void PSCMapsEngine<T,Math,Check>::eval_chunk( const Chunk & chunk, const SampleJob<T> * jobs, T * areas,
+                                              PSCMaps<T,Math,Check> & maps, size_t & maps_job,
+                                              T * s_buf, T * t_buf ) const
+{
+   const SampleJob<T> & job = jobs[chunk.job] ;
+
+   if ( maps_job != chunk.job )
+   {
+      maps.initialize( job.alpha, job.beta, job.use_radial, config );
+      maps_job = chunk.job ;
+   }
+   if ( areas != nullptr && chunk.first == 0 )
+      areas[chunk.job] = maps.get_area();
+
+   T * x = job.x + chunk.first ,
+     * y = job.y + chunk.first ;
+
+   if ( maps.is_invisible() )
+   {
+      for( size_t i = 0 ; i < chunk.count ; i++ )
+         x[i] = y[i] = T(0.0) ;
+      return ;
+   }
+
+   const T * s = job.s + chunk.first ,
+           * t = job.t + chunk.first ;
+   if ( job.s == nullptr )
+   {
+      const uint64_t job_seed = hash64( seed ^ hash64( uint64_t( chunk.job ) ) );
+      switch( sequence )
+      {
+         case sequence_uniform :
+            UniformSequence<T>( job_seed ).generate( chunk.first, chunk.count, s_buf, t_buf );
+            break ;
+         case sequence_sobol :
+            SobolSequence<T>( job_seed ).generate( chunk.first, chunk.count, s_buf, t_buf );
+            break ;
+         case sequence_r2 :
+            R2Sequence<T>( job_seed ).generate( chunk.first, chunk.count, s_buf, t_buf );
+            break ;
+      }
+      s = s_buf ;
+      t = t_buf ;
+   }
+   maps.eval_map_batch( s, t, x, y, chunk.count );
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline void PSCMapsEngine<T,Math,Check>::set_work_stealing( const bool p_work_stealing )
+{
+   work_stealing = p_work_stealing ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline void PSCMapsEngine<T,Math,Check>::set_sequence( const SequenceKind p_sequence )
+{
+   sequence = p_sequence ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline unsigned PSCMapsEngine<T,Math,Check>::get_num_threads() const
+{
+   return num_threads ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline size_t PSCMapsEngine<T,Math,Check>::get_chunk_size() const
+{
+   return chunk_size ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline size_t PSCMapsEngine<T,Math,Check>::get_num_chunks() const
+{
+   return chunks.size() ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T, class Math, class Check >
+inline size_t PSCMapsEngine<T,Math,Check>::get_num_steals() const
+{
+   return num_steals ;
+}
+
+} // end namespace PSCM
+
+#endif
@@ -0,0 +1,284 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'PSCMapsMixed' (float evaluation, double refinement)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_MIXED_H
+#define PSCMAPS_MIXED_H
+
+#include <algorithm>
+
+#include "PSCMaps.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// constants (evaluated at compile time)
+
+// default error bound for the mixed precision maps (normalized area)
+constexpr double mixed_ini_error_bound = 1e-4 ;
+
+// smallest tolerance used for the inversions in float: below it, the float
+// iterations stall against the rounding errors in the lune areas, so tighter
+// error bounds are met by the double refinement step instead
+constexpr double mixed_min_float_tolerance = 2e-5 ;
+
+// -----------------------------------------------------------------------------
+// Maps evaluated in mixed precision: the state of the cap is computed and kept
+// in double (a 'PSCMaps<double>' object), and a 'PSCMaps<float>' object is
+// initialized from the same sines and cosines, so the bulk of the evaluation
+// (including the iterative inversions) runs in float SIMD lanes (8 per pack
+// with AVX2, instead of 4 doubles).
+//
+// The inputs and outputs are doubles. When the requested error bound is below
+// what the float inversion can reach ('mixed_min_float_tolerance'), each float
+// result is refined with one Newton step on the area function, in double (and
+// in double SIMD lanes), and then the position is computed in double from the
+// refined 'y' or angle. The float result is within the float tolerance of the
+// solution, so one step usually gives about its square. The area is evaluated
+// again at the refined value, and the few samples still off the bound (near the
+// end of the lune, where the derivative of the area goes to 0 and Newton steps
+// overshoot) are evaluated again with the iterative inversion in double.
+//
+// The radial map is not refined: the angle would have to be recovered from
+// the float position (with 'atan2'), which makes the refinement slower than
+// the iterative inversion in double, so with a tight bound the samples of the
+// radial map are evaluated directly in double.
+
+template< class Math = MathStd >
+class PSCMapsMixed
+{
+   public:
+
+   // Creates an uninitialized 'empty' object (not usable)
+   PSCMapsMixed();
+
+   // Initializes both maps objects (see 'PSCMaps::initialize'), the double one
+   // with 'p_error_bound' as inversion tolerance and the float one with the
+   // larger of it and 'mixed_min_float_tolerance'
+   void initialize( const double p_alpha, const double p_beta, const bool p_use_radial,
+                    const double p_error_bound = mixed_ini_error_bound,
+                    const int    p_max_iters   = ini_iN_max_iters );
+
+   // evaluates the map for one sample, (s,t) must be in [0,1]^2
+   void eval_map( const double s, const double t, double &x, double &y ) const ;
+
+   // evaluates the map for 'n' samples in structure-of-arrays form
+   // (see 'PSCMaps::eval_map_batch')
+   void eval_map_batch( const double * s, const double * t, double * x, double * y,
+                        const size_t n ) const ;
+
+   // true when the float results are refined in double
+   inline bool is_refining() const ;
+
+   // error bound given to 'initialize'
+   inline double get_error_bound() const ;
+
+   // area of the projected spherical cap (computed in double)
+   inline double get_area() const ;
+
+   // the underlying maps objects
+   inline const PSCMaps<double,Math> & get_maps() const ;
+   inline const PSCMaps<float,Math>  & get_float_maps() const ;
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // refines, in place, the float results of the parallel map already
+   // written in 'x' and 'y' (converted to double), for as many samples as
+   // lanes in V (either 'double' or 'simd::Pack<double>'), and writes the
+   // normalized area error after the refinement in 'res'
+   template< class V >
+   void refine_lanes( const double * s, const double * t, double * x, double * y,
+                      double * res ) const ;
+
+   PSCMaps<double,Math> maps ;    // state in double
+   PSCMaps<float,Math>  maps_f ;  // state in float, used for the bulk of the evaluation
+
+   bool   refining ;              // true when the error bound needs the double refinement
+   double error_bound ;           // error bound given to 'initialize'
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// --------------------------------------------------------------------------
+// Creates an uninitialized 'empty' object (not usable)
+
+template< class Math >
+PSCMapsMixed<Math>::PSCMapsMixed()
+{
+   refining    = false ;
+   error_bound = mixed_ini_error_bound ;
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+inline bool PSCMapsMixed<Math>::is_refining() const
+{
+   return refining ;
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+inline double PSCMapsMixed<Math>::get_error_bound() const
+{
+   return error_bound ;
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+inline double PSCMapsMixed<Math>::get_area() const
+{
+   return maps.get_area();
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+inline const PSCMaps<double,Math> & PSCMapsMixed<Math>::get_maps() const
+{
+   return maps ;
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+inline const PSCMaps<float,Math> & PSCMapsMixed<Math>::get_float_maps() const
+{
+   return maps_f ;
+}
+// --------------------------------------------------------------------------
+// both objects are initialized from the same sines and cosines (computed in
+// double), so they describe the same cap
+
+template< class Math >
+void PSCMapsMixed<Math>::initialize( const double p_alpha, const double p_beta,
+                                     const bool p_use_radial, const double p_error_bound,
+                                     const int p_max_iters )
+{
+   if ( do_checks )
+      assert( 0.0 < p_error_bound );
+
+   const double pi2       = 0.5*M_PI ,
+                alpha     = std::max( 0.0, std::min( pi2, p_alpha ) ),
+                beta      = std::max( -pi2, std::min( pi2, p_beta ) ),
+                sin_alpha = std::sin( alpha ), cos_alpha = std::cos( alpha ),
+                sin_beta  = std::sin( beta ),  cos_beta  = std::cos( beta ),
+                tol_f     = std::max( p_error_bound, mixed_min_float_tolerance );
+
+   error_bound = p_error_bound ;
+   refining    = p_error_bound < mixed_min_float_tolerance ;
+
+   maps.initialize_sincos( sin_alpha, cos_alpha, sin_beta, cos_beta, p_use_radial,
+                           InversionConfig<double>( p_error_bound, p_max_iters ) );
+   maps_f.initialize_sincos( float( sin_alpha ), float( cos_alpha ), float( sin_beta ),
+                             float( cos_beta ), p_use_radial,
+                             InversionConfig<float>( float( tol_f ), p_max_iters ) );
+}
+// --------------------------------------------------------------------------
+
+template< class Math >
+void PSCMapsMixed<Math>::eval_map( const double s, const double t, double &x, double &y ) const
+{
+   eval_map_batch( &s, &t, &x, &y, 1 );
+}
+// --------------------------------------------------------------------------
+// the samples are converted to float in small blocks (which stay in the L1
+// cache), evaluated with 'PSCMaps<float>::eval_map_batch', and then refined
+// (when needed) in double packs, the remaining samples in scalars. Samples
+// whose area error is above the bound after the refinement are evaluated
+// with 'PSCMaps<double>::eval_map'
+
+template< class Math >
+void PSCMapsMixed<Math>::eval_map_batch( const double * s, const double * t, double * x,
+                                         double * y, const size_t n ) const
+{
+   typedef simd::Pack<double> V ;
+   constexpr size_t w = V::width ;
+
+   // radial map: refining is slower than the double inversion (see above)
+   if ( refining && maps.using_radial )
+   {
+      maps.eval_map_batch( s, t, x, y, n );
+      return ;
+   }
+
+   constexpr size_t block_size = 64 ;
+   float  sf[block_size], tf[block_size], xf[block_size], yf[block_size] ;
+   double res[block_size] ;
+
+   for( size_t i = 0 ; i < n ; i += block_size )
+   {
+      const size_t count = std::min( block_size, n-i );
+      for( size_t k = 0 ; k < count ; k++ )
+      {
+         sf[k] = float( s[i+k] );
+         tf[k] = float( t[i+k] );
+      }
+      maps_f.eval_map_batch( sf, tf, xf, yf, count );
+      for( size_t k = 0 ; k < count ; k++ )
+      {
+         x[i+k] = double( xf[k] );
+         y[i+k] = double( yf[k] );
+      }
+      if ( ! refining )
+         continue ;
+
+      const size_t n_packs = count - count % w ;
+      for( size_t k = 0 ; k < n_packs ; k += w )
+         refine_lanes<V>( s+i+k, t+i+k, x+i+k, y+i+k, res+k );
+      for( size_t k = n_packs ; k < count ; k++ )
+         refine_lanes<double>( s+i+k, t+i+k, x+i+k, y+i+k, res+k );
+      for( size_t k = 0 ; k < count ; k++ )
+         if ( ! ( res[k] <= error_bound ) )
+            maps.eval_map( s[i+k], t[i+k], x[i+k], y[i+k] );
+   }
+}
+// --------------------------------------------------------------------------
+// one Newton step on the normalized area function of the parallel map, from
+// the float solution 'y'. The step is not taken where the derivative is 0
+// (at the end of the lune), and the result is clamped to the valid range.
+// The area is evaluated again at the result, to check it
+
+template< class Math >
+template< class V >
+inline void PSCMapsMixed<Math>::refine_lanes( const double * s, const double * t,
+                                              double * x, double * y, double * res ) const
+{
+   const V   sv     = simd::load_lanes<V>( s ),
+             tv     = simd::load_lanes<V>( t ),
+             yv     = simd::load_lanes<V>( y ),
+             zero   = V( 0.0 ),
+             u      = simd::abs( simd::fma( V( 2.0 ), tv, V( -1.0 ) ) ),
+             inv_A  = V( 2.0/maps.F ) ;
+   const auto is_neg = tv < V( 0.5 ) ;
+
+   const V         y_max = V( maps.center_below_hor ? maps.yl : maps.ay ),
+                   y0    = simd::abs( yv );
+   const ValDer<V> Ff    = maps.eval_Ap_with_integrand_lanes( y0 );
+   const V         y1    = simd::clamp( simd::select( zero < Ff.der, y0 - ( Ff.value*inv_A - u )/( Ff.der*inv_A ), y0 ),
+                                        zero, y_max );
+   V xmin, xmax ;
+   maps.eval_xmin_xmax_lanes( y1, xmin, xmax );
+   simd::store_lanes( res, simd::abs( maps.eval_Ap_with_integrand_lanes( y1 ).value*inv_A - u ) );
+   simd::store_lanes( x, simd::fma( sv, xmax - xmin, xmin ) );
+   simd::store_lanes( y, simd::flip_sign( y1, is_neg ) );
+}
+
+} // ends namespace PSCM
+
+#endif // ends #ifndef PSCMAPS_MIXED_H
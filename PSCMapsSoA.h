@@ -0,0 +1,430 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'PSCMapsSoA' (state of many caps, stored column-wise)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_SOA_H
+#define PSCMAPS_SOA_H
+
+#include <cstdint>
+#include <vector>
+
+#include "PSCMaps.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// The state of 'n' maps objects (one for each spherical cap), stored column-wise:
+// there is an array for each field of 'PSCMaps', with the values of all caps.
+//
+// It is meant for a renderer with thousands of caps (e.g. one for each light,
+// as seen from a shading point): the caps are initialized in a single call,
+// the areas of all the caps (used to choose a cap) are contiguous, and each
+// column is read with unit stride. A sample of cap 'i' is evaluated by loading
+// the state of cap 'i' into a maps object (only once for a run of consecutive
+// samples of the same cap), and then using the same code as 'PSCMaps'.
+
+template< typename T >
+class PSCMapsSoA
+{
+   public:
+
+   // creates an empty container (no caps)
+   PSCMapsSoA();
+
+   // initializes 'n' caps: cap 'i' is initialized with angles 'p_alpha[i]' and
+   // 'p_beta[i]' (see 'PSCMaps::initialize'), all of them with 'p_use_radial'
+   // and 'p_config'
+   void initialize( const T * p_alpha, const T * p_beta, const size_t n,
+                    const bool p_use_radial,
+                    const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // the same as 'initialize', but the caps are processed in groups of as many
+   // caps as lanes in a 'simd::Pack<T>', and the cases are blended in each group
+   // (there are no per-cap branches). The values are the same up to rounding.
+   void initialize_batch( const T * p_alpha, const T * p_beta, const size_t n,
+                          const bool p_use_radial,
+                          const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // number of caps
+   inline size_t size() const ;
+
+   // area of cap 'i'
+   inline T get_area( const size_t i ) const ;
+
+   // areas of all the caps (an array with 'size()' values)
+   inline const T * get_areas() const ;
+
+   // evaluates the map of cap 'i' (see 'PSCMaps::eval_map')
+   void eval_map( const size_t i, const T s, const T t, T &x, T &y ) const ;
+
+   // evaluates 'n' samples, sample 'k' is (s[k],t[k]) --> (x[k],y[k]) for cap 'cap[k]'.
+   // Runs of consecutive samples of the same cap are evaluated as a batch
+   // (see 'PSCMaps::eval_map_batch'), so samples should be grouped by cap
+   void eval_map( const size_t * cap, const T * s, const T * t, T * x, T * y,
+                  const size_t n ) const ;
+
+   // copies the state of cap 'i' into 'maps' (which can then be used as usual)
+   void get_maps( const size_t i, PSCMaps<T> & maps ) const ;
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // columns, in the same order as the fields in 'PSCMaps'
+   enum Column { col_F, col_E, col_L, col_xe, col_ax, col_ay, col_axay2, col_ay_sq,
+                 col_xe_sq, col_cos_beta_sq, col_sin_beta_abs, col_yl, col_phi_l,
+                 col_AE_phi_l, num_columns } ;
+
+   // bits in 'flags' (one for each boolean field in 'PSCMaps')
+   enum Flag { flag_fully_visible = 1, flag_partially_visible = 2, flag_center_below_hor = 4,
+               flag_invisible = 8, flag_using_radial = 16 } ;
+
+   inline const T * column( const Column c ) const ;
+   inline T *       column( const Column c ) ;
+
+   // copies the state of 'maps' into cap 'i'
+   void set_maps( const size_t i, const PSCMaps<T> & maps );
+
+   // initializes caps 'i' to 'i+w-1' (w is the number of lanes in V, which can be
+   // 'T' or a 'simd::Pack<T>'), as in 'PSCMaps::initialize', see 'initialize_batch'
+   template< class V > void initialize_lanes( const T * p_alpha, const T * p_beta,
+                                              const size_t i, const bool p_use_radial );
+
+   // resizes the arrays for 'n' caps
+   void resize( const size_t n );
+
+   size_t               num_caps ; // number of caps
+   InversionConfig<T>   config ;   // inversion settings, the same for all the caps
+   std::vector<uint8_t> flags ;    // case flags, one byte per cap
+   std::vector<T>       values ;   // 'num_columns' arrays of 'num_caps' values each
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// -----------------------------------------------------------------------------
+
+template< class T >
+PSCMapsSoA<T>::PSCMapsSoA()
+{
+   num_caps = 0 ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::initialize( const T * p_alpha, const T * p_beta, const size_t n,
+                                const bool p_use_radial, const InversionConfig<T> & p_config )
+{
+   if ( do_checks )
+      assert( n == 0 || ( p_alpha != nullptr && p_beta != nullptr ));
+
+   resize( n );
+   config = p_config ;
+
+   PSCMaps<T> maps ;
+   for( size_t i = 0 ; i < n ; i++ )
+   {
+      maps.initialize( p_alpha[i], p_beta[i], p_use_radial, p_config );
+      set_maps( i, maps );
+   }
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::initialize_batch( const T * p_alpha, const T * p_beta, const size_t n,
+                                      const bool p_use_radial, const InversionConfig<T> & p_config )
+{
+   constexpr size_t width = simd::Pack<T>::width ;
+
+   if ( do_checks )
+   {
+      assert( n == 0 || ( p_alpha != nullptr && p_beta != nullptr ));
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         assert( T(-1e-5) <= p_alpha[i] && p_alpha[i] <= T(0.5*M_PI + 1e-5) );
+         assert( T(-0.5*M_PI - 1e-5) <= p_beta[i] && p_beta[i] <= T(0.5*M_PI + 1e-5) );
+      }
+   }
+
+   resize( n );
+   config = p_config ;
+
+   size_t i = 0 ;
+   for( ; i + width <= n ; i += width )
+      initialize_lanes< simd::Pack<T> >( p_alpha, p_beta, i, p_use_radial );
+   for( ; i < n ; i++ )
+      initialize_lanes<T>( p_alpha, p_beta, i, p_use_radial );
+}
+// -----------------------------------------------------------------------------
+
+template< class T > template< class V >
+void PSCMapsSoA<T>::initialize_lanes( const T * p_alpha, const T * p_beta,
+                                      const size_t i, const bool p_use_radial )
+{
+   using simd::select ;
+   constexpr T pi2 = T(M_PI)*T(0.5) ;
+   const V zero = V(T(0.0)),
+           one  = V(T(1.0));
+
+   // angles (clamped), and values defining the ellipse (as in 'PSCMaps::initialize')
+   const V alpha = simd::clamp( simd::load_lanes<V>( p_alpha+i ), zero, V(pi2) ),
+           beta  = simd::clamp( simd::load_lanes<V>( p_beta+i ), V(-pi2), V(pi2) );
+
+   // (cos(alpha) is the root of 1-ay^2)
+   V ay, r1maysq, sin_beta, cos_beta ;
+   simd::sincos_pi2( alpha, ay, r1maysq );
+   simd::sincos_pi2( beta, sin_beta, cos_beta );
+
+   const V ay_sq        = ay*ay ,
+           sin_beta_abs = simd::abs( sin_beta ),
+           cos_beta_sq  = cos_beta*cos_beta ,
+           xe           = cos_beta*r1maysq ,
+           ax           = ay*sin_beta_abs ,
+           axay2        = ax*ay*V(T(0.5)) ;
+
+   // cases, for all lanes
+   const auto fully_visible     = ay <= sin_beta ,
+              partially_visible = ( ! fully_visible ) & ( -ay < sin_beta ) ,
+              invisible         = ! ( fully_visible | partially_visible ) ,
+              center_below_hor  = sin_beta < zero ;
+
+   // tangency points and the lune area (as in 'PSCMaps::compute_ELF_yl_phi_l'),
+   // these are computed for all the lanes, and then discarded in lanes which
+   // are not partially visible (where they can be infinite or NaN)
+   V xl = zero, yl = zero, phi_l = zero, AE_phi_l = zero, L = zero ;
+   if ( simd::any( partially_visible ) )
+   {
+      xl = r1maysq/cos_beta ;
+      yl = simd::sqrt( simd::max( zero, one - xl*xl ));
+      V lune ;
+      if ( p_use_radial )
+      {
+         // eval_ArE and eval_ArC at phi_l, by using the point (xl-xe,yl) instead of
+         // phi_l for its sine and cosine, since A_E(phi) == axay2*atan(|sin_beta|*tan(phi))
+         // (with the angle in [0,pi]), and phi_l is in [0,pi/2] (cosine is positive)
+         const V dx = xl-xe ,
+                 hyp = simd::sqrt( yl*yl + dx*dx );
+         phi_l    = simd::atan2( yl, dx );
+         AE_phi_l = axay2*simd::atan2( sin_beta_abs*yl, dx );
+
+         const V z     = yl/hyp ,
+                 cos_z = dx/hyp ,
+                 xez   = xe*z ,
+                 xe_sq = xe*xe ,
+                 ArC   = V(T(0.5))*( phi_l - simd::asin( simd::clamp( xez, -one, one ))
+                                     + xe_sq*z*cos_z
+                                     - xez*simd::sqrt( simd::max( zero, one - xez*xez ))) ;
+         lune     = ArC - AE_phi_l ;
+      }
+      else
+      {
+         // eval_ApC and eval_ApE at yl (eval_I is expression 17)
+         const V v   = simd::clamp( yl/ay, zero, one ),
+                 IE  = V(T(0.5))*( v*simd::sqrt( one - v*v ) + simd::asin( v ) ),
+                 IC  = V(T(0.5))*( yl*simd::sqrt( one - yl*yl ) + simd::asin( yl ) );
+         lune = ( IC - xe*yl ) - ax*ay*IE ;
+      }
+      L        = select( partially_visible, simd::max( zero, lune ), zero );
+      yl       = select( partially_visible, yl, zero );
+      if ( p_use_radial )
+      {
+         phi_l    = select( partially_visible, phi_l, zero );
+         AE_phi_l = select( partially_visible, AE_phi_l, zero );
+      }
+   }
+
+   const V E = select( invisible | ( partially_visible & center_below_hor ),
+                       zero, V(T(M_PI))*axay2 ),
+           F = V(T(2.0))*(E+L) ;
+
+   // flags, as bits in a value of type T
+   const V fv = select( fully_visible,     V(T(flag_fully_visible)), zero )
+              + select( partially_visible, V(T(flag_partially_visible)), zero )
+              + select( center_below_hor,  V(T(flag_center_below_hor)), zero )
+              + select( invisible,         V(T(flag_invisible)), zero )
+              + V( p_use_radial ? T(flag_using_radial) : T(0.0) ) ;
+   T fv_lanes[ sizeof(V)/sizeof(T) ] ;
+   simd::store_lanes( fv_lanes, fv );
+   for( size_t k = 0 ; k < sizeof(V)/sizeof(T) ; k++ )
+      flags[i+k] = uint8_t( fv_lanes[k] );
+
+   simd::store_lanes( column( col_F )+i,            F );
+   simd::store_lanes( column( col_E )+i,            E );
+   simd::store_lanes( column( col_L )+i,            L );
+   simd::store_lanes( column( col_xe )+i,           xe );
+   simd::store_lanes( column( col_ax )+i,           ax );
+   simd::store_lanes( column( col_ay )+i,           ay );
+   simd::store_lanes( column( col_axay2 )+i,        axay2 );
+   simd::store_lanes( column( col_ay_sq )+i,        ay_sq );
+   simd::store_lanes( column( col_xe_sq )+i,        xe*xe );
+   simd::store_lanes( column( col_cos_beta_sq )+i,  cos_beta_sq );
+   simd::store_lanes( column( col_sin_beta_abs )+i, sin_beta_abs );
+   simd::store_lanes( column( col_yl )+i,           yl );
+   simd::store_lanes( column( col_phi_l )+i,        phi_l );
+   simd::store_lanes( column( col_AE_phi_l )+i,     AE_phi_l );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::resize( const size_t n )
+{
+   num_caps = n ;
+   flags.resize( n );
+   values.resize( n*size_t(num_columns) );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsSoA<T>::size() const
+{
+   return num_caps ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T PSCMapsSoA<T>::get_area( const size_t i ) const
+{
+   if ( do_checks )
+      assert( i < num_caps );
+   return column( col_F )[i] ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline const T * PSCMapsSoA<T>::get_areas() const
+{
+   return column( col_F );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::eval_map( const size_t i, const T s, const T t, T &x, T &y ) const
+{
+   PSCMaps<T> maps ;
+   get_maps( i, maps );
+   maps.eval_map( s, t, x, y );
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::eval_map( const size_t * cap, const T * s, const T * t, T * x, T * y,
+                              const size_t n ) const
+{
+   PSCMaps<T> maps ;
+   size_t k = 0 ;
+   while ( k < n )
+   {
+      // find the run of samples for the same cap
+      size_t k_end = k+1 ;
+      while ( k_end < n && cap[k_end] == cap[k] )
+         k_end++ ;
+
+      get_maps( cap[k], maps );
+      maps.eval_map_batch( s+k, t+k, x+k, y+k, k_end-k );
+      k = k_end ;
+   }
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::get_maps( const size_t i, PSCMaps<T> & maps ) const
+{
+   if ( do_checks )
+      assert( i < num_caps );
+
+   const uint8_t f = flags[i] ;
+   maps.initialized       = true ;
+   maps.fully_visible     = ( f & flag_fully_visible ) != 0 ;
+   maps.partially_visible = ( f & flag_partially_visible ) != 0 ;
+   maps.center_below_hor  = ( f & flag_center_below_hor ) != 0 ;
+   maps.invisible         = ( f & flag_invisible ) != 0 ;
+   maps.using_radial      = ( f & flag_using_radial ) != 0 ;
+
+   maps.F            = column( col_F )[i] ;
+   maps.E            = column( col_E )[i] ;
+   maps.L            = column( col_L )[i] ;
+   maps.xe           = column( col_xe )[i] ;
+   maps.ax           = column( col_ax )[i] ;
+   maps.ay           = column( col_ay )[i] ;
+   maps.axay2        = column( col_axay2 )[i] ;
+   maps.ay_sq        = column( col_ay_sq )[i] ;
+   maps.xe_sq        = column( col_xe_sq )[i] ;
+   maps.cos_beta_sq  = column( col_cos_beta_sq )[i] ;
+   maps.sin_beta_abs = column( col_sin_beta_abs )[i] ;
+   maps.yl           = column( col_yl )[i] ;
+   maps.phi_l        = column( col_phi_l )[i] ;
+   maps.AE_phi_l     = column( col_AE_phi_l )[i] ;
+
+   maps.iN_tolerance    = config.tolerance ;
+   maps.iN_max_iters    = uint16_t( std::max( 0, std::min( config.max_iters, max_iN_max_iters ) ) );
+   maps.trace_inversion = config.trace ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsSoA<T>::set_maps( const size_t i, const PSCMaps<T> & maps )
+{
+   if ( do_checks )
+   {
+      assert( i < num_caps );
+      assert( maps.initialized );
+   }
+
+   flags[i] = uint8_t( ( maps.fully_visible     ? flag_fully_visible     : 0 ) |
+                       ( maps.partially_visible ? flag_partially_visible : 0 ) |
+                       ( maps.center_below_hor  ? flag_center_below_hor  : 0 ) |
+                       ( maps.invisible         ? flag_invisible         : 0 ) |
+                       ( maps.using_radial      ? flag_using_radial      : 0 ) );
+
+   // fields which are not computed for some cases are stored as 0
+   const bool partial = maps.partially_visible,
+              radial  = partial && maps.using_radial ;
+
+   column( col_F )[i]            = maps.F ;
+   column( col_E )[i]            = maps.E ;
+   column( col_L )[i]            = maps.L ;
+   column( col_xe )[i]           = maps.xe ;
+   column( col_ax )[i]           = maps.ax ;
+   column( col_ay )[i]           = maps.ay ;
+   column( col_axay2 )[i]        = maps.axay2 ;
+   column( col_ay_sq )[i]        = maps.ay_sq ;
+   column( col_xe_sq )[i]        = maps.xe_sq ;
+   column( col_cos_beta_sq )[i]  = maps.cos_beta_sq ;
+   column( col_sin_beta_abs )[i] = maps.sin_beta_abs ;
+   column( col_yl )[i]           = partial ? maps.yl : T(0.0) ;
+   column( col_phi_l )[i]        = radial  ? maps.phi_l : T(0.0) ;
+   column( col_AE_phi_l )[i]     = radial  ? maps.AE_phi_l : T(0.0) ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline const T * PSCMapsSoA<T>::column( const Column c ) const
+{
+   return values.data() + size_t(c)*num_caps ;
+}
+// -----------------------------------------------------------------------------
+
+template< class T >
+inline T * PSCMapsSoA<T>::column( const Column c )
+{
+   return values.data() + size_t(c)*num_caps ;
+}
+
+} // end namespace PSCM
+
+#endif
@@ -0,0 +1,461 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'PSCMapsTabulated' (maps with a fitted inverse area function)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCMAPS_TABULATED_H
+#define PSCMAPS_TABULATED_H
+
+#include <vector>
+#include <limits>
+#include <type_traits>
+
+#include "PSCMaps.h"
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// constants (evaluated at compile time)
+
+// default number of intervals in the fit, for each side of 'yl' or 'phi_l'
+constexpr int tab_ini_num_intervals = 64 ;
+
+// maximum number of intervals (for each side), when refining to meet the tolerance
+constexpr int tab_max_num_intervals = 1024 ;
+
+// average cost of an iterative inversion, measured in evaluations of
+// Ap or Ar (along with their integrands), used to decide when the fit pays off
+// (an inversion does 3 to 6 evaluations, and a fit lookup costs about one)
+constexpr double tab_evals_per_inversion = 4.0 ;
+
+// -----------------------------------------------------------------------------
+// A class for projected spherical cap maps which uses a piecewise monotone
+// cubic (Hermite) fit of the inverse area function (Ap^{-1} or Ar^{-1}),
+// instead of the iterative inversion.
+//
+// The fit is built once for each cap (at 'initialize'), from nodes in 'y' or
+// 'theta' (one of them at 'yl' or 'phi_l'), where Ap or Ar (normalized) and
+// their derivatives are evaluated. The derivatives are limited so the fit is
+// monotone (Fritsch-Carlson), thus the error in an interval is never larger
+// than the interval. Nodes are closer near the maximum 'y' or 'theta', where
+// A' may be 0 and A^{-1} has an infinite slope. The error is measured as the
+// inversion tolerance is (max. |A(t)-u|, normalized, see 'InversionConfig'),
+// at the midpoints of the intervals in 'u'. The number of intervals is doubled
+// until the error is below the tolerance, and the fit is discarded if it is
+// not. The values of A are computed with at least double precision, the fit
+// is evaluated with T.
+//
+// The fit is only built when the number of samples expected for this cap
+// (the 'sample budget') makes it cheaper than the iterative inversion, and
+// when the map needs an iterative inversion at all (each refinement must pay
+// off too). Otherwise, 'eval_map' just uses 'PSCMaps::eval_map'.
+
+template< typename T >
+class PSCMapsTabulated
+{
+   public:
+
+   // Creates an uninitialized 'empty' object (not usable)
+   PSCMapsTabulated();
+
+   // Initializes the maps object (see 'PSCMaps::initialize'), and builds the
+   // fit if it pays off for 'sample_budget' samples ('sample_budget' == 0: always build it)
+   void initialize( const T p_alpha, const T p_beta, const bool p_use_radial,
+                    const size_t sample_budget,
+                    const InversionConfig<T> & p_config = InversionConfig<T>() );
+
+   // evaluates one of the two maps (according to 'using_radial')
+   // (s,t) must be in [0,1]^2
+   void eval_map( T s, T t, T &x, T &y ) const ;
+
+   // the underlying maps object
+   inline const PSCMaps<T> & get_maps() const ;
+
+   // true when the fit has been built (and it is used by 'eval_map')
+   inline bool is_tabulated() const ;
+
+   // number of nodes in the fit (0 when not tabulated)
+   inline size_t get_num_nodes() const ;
+
+   // max. error of the last fit built (max. |A(t)-u|, normalized), measured
+   // at the interval midpoints (it is below the tolerance when tabulated)
+   inline T get_max_error() const ;
+
+   // true if building the fit pays off for 'sample_budget' samples
+   static bool fit_pays_off( const PSCMaps<T> & maps, const size_t sample_budget );
+
+   // --------------------------------------------------------------------------
+   private:
+
+   // type used to build the fit: at least 'double', as the lune areas
+   // computed with 'float' have too much cancellation error
+   typedef typename std::conditional< (sizeof(T) < sizeof(double)), double, T >::type BT ;
+
+   // true when the map does an iterative inversion (so the fit is useful)
+   static bool needs_iteration( const PSCMaps<T> & maps );
+
+   // number of evaluations of A needed to build a fit with 'n' intervals on each side
+   static double build_cost( const PSCMaps<T> & maps, const int n );
+
+   // evaluates A (normalized) and its derivative at 't' (y or theta)
+   ValDer<BT> eval_A( const PSCMaps<BT> & mb, const BT t ) const ;
+
+   // builds the fit with 'n' intervals on each side of the split point, by
+   // using 'mb' (initialized for this cap), returns the max. error at the
+   // interval midpoints
+   T build_fit( const PSCMaps<BT> & mb, const int n );
+
+   // evaluates the fit of A^{-1} at 'u' in [0,u_fit_max]
+   T eval_fit( T u ) const ;
+
+   PSCMaps<T> maps ;     // maps object (initialized)
+
+   bool tabulated ;      // true when the fit has been built
+
+   BT t_split ,          // 'yl' or 'phi_l' (or 't_max' when there is no split)
+      t_max ,            // maximum value for A^{-1}
+      u_fit_max ,        // maximum 'u' covered by the fit (1, or the analytic inversion limit)
+      A_max ;            // maximum value of A (the normalization factor)
+
+   T  max_error ;        // max. error (normalized area) measured at the interval midpoints
+
+   std::vector<T>
+      node_u ,           // normalized area at each node (increasing)
+      node_t ,           // 'y' or 'theta' at each node
+      node_m ;           // derivative of A^{-1} at each node (limited)
+
+   std::vector<int>
+      guide ;            // guide[k] == index of the interval holding u == k/guide.size()
+} ;
+
+//****************************************************************************
+// Implementation of all methods
+
+// --------------------------------------------------------------------------
+// Creates an uninitialized 'empty' object (not usable)
+
+template< class T >
+PSCMapsTabulated<T>::PSCMapsTabulated( )
+{
+   tabulated    = false ;
+   max_error = T(0.0) ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline const PSCMaps<T> & PSCMapsTabulated<T>::get_maps() const
+{
+   return maps ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline bool PSCMapsTabulated<T>::is_tabulated() const
+{
+   return tabulated ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline size_t PSCMapsTabulated<T>::get_num_nodes() const
+{
+   return tabulated ? node_t.size() : 0 ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline T PSCMapsTabulated<T>::get_max_error() const
+{
+   return max_error ;
+}
+// --------------------------------------------------------------------------
+// the radial map does not iterate in the ellipse only case, and neither in the
+// lune only case with a tiny lune (parabola approximation)
+
+template< class T >
+bool PSCMapsTabulated<T>::needs_iteration( const PSCMaps<T> & maps )
+{
+   if ( maps.invisible )
+      return false ;
+   if ( ! maps.using_radial )
+      return true ;
+   if ( maps.fully_visible )
+      return false ;
+   return ! ( maps.center_below_hor && maps.L < 1e-5 ) ;
+}
+// --------------------------------------------------------------------------
+// a fit costs two evaluations of A for each interval (at the nodes and at the
+// midpoints, to measure the error)
+
+template< class T >
+double PSCMapsTabulated<T>::build_cost( const PSCMaps<T> & maps, const int n )
+{
+   const int num_sides = ( ! maps.using_radial && maps.partially_visible && ! maps.center_below_hor ) ? 2 : 1 ;
+   return 2.0*double( num_sides*n );
+}
+// --------------------------------------------------------------------------
+// each sample saves an inversion minus a lookup
+
+template< class T >
+bool PSCMapsTabulated<T>::fit_pays_off( const PSCMaps<T> & maps, const size_t sample_budget )
+{
+   if ( ! needs_iteration( maps ) )
+      return false ;
+   if ( sample_budget == 0 )
+      return true ;
+
+   const double saving = double( sample_budget )*( tab_evals_per_inversion - 1.0 );
+   return build_cost( maps, tab_ini_num_intervals ) < saving ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsTabulated<T>::initialize( const T p_alpha, const T p_beta,
+                                      const bool p_use_radial, const size_t sample_budget,
+                                      const InversionConfig<T> & p_config )
+{
+   maps.initialize( p_alpha, p_beta, p_use_radial, p_config );
+
+   tabulated    = false ;
+   max_error = T(0.0) ;
+   node_u.clear();
+   node_t.clear();
+   node_m.clear();
+   guide.clear();
+
+   if ( ! fit_pays_off( maps, sample_budget ) )
+      return ;
+
+   PSCMaps<BT> mb ;
+   mb.initialize( BT(p_alpha), BT(p_beta), p_use_radial );
+
+   A_max = BT(0.5)*mb.F ;
+
+   if ( ! mb.using_radial )
+   {
+      // parallel map: split at 'yl', except in the ellipse only case
+      t_max     = mb.center_below_hor ? mb.yl : mb.ay ;
+      t_split   = mb.partially_visible ? mb.yl : mb.ay ;
+      u_fit_max = BT(1.0) ;
+   }
+   else
+   {
+      // radial map: the fit covers [0,phi_l], above that (ellipse+lune), the
+      // analytic inversion is used, as in 'eval_Ar_inverse'
+      t_max     = mb.phi_l ;
+      t_split   = mb.phi_l ;
+      u_fit_max = mb.center_below_hor ? BT(1.0) : (mb.AE_phi_l + mb.L)/A_max ;
+   }
+
+   // build the fit, and refine it until the error is below the tolerance. Stop
+   // when a refinement does not pay off anymore (counting all the builds done
+   // so far), or when the error is not halved (it is then due to rounding)
+   const double saving = double( sample_budget )*( tab_evals_per_inversion - 1.0 );
+
+   int    n    = tab_ini_num_intervals ;
+   double cost = build_cost( maps, n );
+   max_error = build_fit( mb, n );
+   while ( p_config.tolerance < max_error && 2*n <= tab_max_num_intervals )
+   {
+      n    *= 2 ;
+      cost += build_cost( maps, n );
+      if ( sample_budget > 0 && saving <= cost )
+         break ;
+      const T prev_error = max_error ;
+      max_error = build_fit( mb, n );
+      if ( T(0.5)*prev_error < max_error )
+         break ;
+   }
+
+   // the tolerance is not met: discard the fit, so the iterative inversion is used
+   if ( p_config.tolerance < max_error )
+   {
+      node_u.clear();
+      node_t.clear();
+      node_m.clear();
+      guide.clear();
+      return ;
+   }
+   tabulated = true ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+inline ValDer<typename PSCMapsTabulated<T>::BT>
+   PSCMapsTabulated<T>::eval_A( const PSCMaps<BT> & mb, const BT t ) const
+{
+   const ValDer<BT> Ff = mb.using_radial
+                       ? mb.eval_Ar_with_integrand_lanes( t )
+                       : mb.eval_Ap_with_integrand_lanes( t ) ;
+   return ValDer<BT>{ Ff.value/A_max, Ff.der/A_max } ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+T PSCMapsTabulated<T>::build_fit( const PSCMaps<BT> & mb, const int n )
+{
+   // nodes: 'n' intervals in [0,t_split], and 'n' more in [t_split,t_max] (if
+   // not empty), the last side is graded (quadratically) towards 't_max'
+   auto uniform = [=]( BT a, BT b, int i ) { return a + (b-a)*(BT(i)/BT(n)) ; } ;
+   auto graded  = [=]( BT a, BT b, int i ) { const BT w = BT(1.0)-BT(i)/BT(n) ; return b - (b-a)*(w*w) ; } ;
+
+   std::vector<BT> tb ; // nodes
+   for( int i = 0 ; i <= n ; i++ )
+      tb.push_back( ( t_split < t_max ) ? uniform( BT(0.0), t_split, i ) : graded( BT(0.0), t_split, i ) );
+   if ( t_split < t_max )
+      for( int i = 1 ; i <= n ; i++ )
+         tb.push_back( graded( t_split, t_max, i ) );
+
+   const size_t num_nodes = tb.size() ;
+   std::vector<BT> ub( num_nodes ),       // normalized area at each node
+                   dudt( num_nodes ),     // derivative of A at each node
+                   secant( num_nodes-1 ); // slope of A^{-1} on each interval
+
+   for( size_t i = 0 ; i < num_nodes ; i++ )
+   {
+      const ValDer<BT> Ff = eval_A( mb, tb[i] );
+      ub[i]   = Ff.value ;
+      dudt[i] = Ff.der ;
+   }
+   ub[0]           = BT(0.0) ;
+   ub[num_nodes-1] = std::min( BT(1.0), u_fit_max );
+
+   // make the areas non-decreasing (they may be off by rounding errors in tiny intervals)
+   for( size_t i = 1 ; i < num_nodes ; i++ )
+      ub[i] = std::max( ub[i], ub[i-1] );
+
+   for( size_t i = 0 ; i+1 < num_nodes ; i++ )
+   {
+      const BT du = ub[i+1]-ub[i] ;
+      secant[i] = ( BT(0.0) < du ) ? (tb[i+1]-tb[i])/du : BT(0.0) ;
+   }
+
+   // store nodes, with derivatives of A^{-1} == 1/A' limited to 3 times the
+   // secant slopes on both sides (this makes the fit monotone, and handles A' == 0)
+   node_u.resize( num_nodes );
+   node_t.resize( num_nodes );
+   node_m.resize( num_nodes );
+   for( size_t i = 0 ; i < num_nodes ; i++ )
+   {
+      BT limit = std::numeric_limits<BT>::max() ;
+      if ( 0 < i )
+         limit = std::min( limit, BT(3.0)*secant[i-1] );
+      if ( i+1 < num_nodes )
+         limit = std::min( limit, BT(3.0)*secant[i] );
+
+      node_u[i] = T( ub[i] );
+      node_t[i] = T( tb[i] );
+      node_m[i] = T( ( limit*dudt[i] <= BT(1.0) ) ? limit : BT(1.0)/dudt[i] );
+   }
+
+   // guide table, for a constant time search of the interval
+   const size_t num_intervals = num_nodes-1 ;
+   guide.resize( num_intervals );
+   size_t j = 0 ;
+   for( size_t k = 0 ; k < num_intervals ; k++ )
+   {
+      const T u = T(u_fit_max)*T(k)/T(num_intervals) ;
+      while ( j+1 < num_intervals && node_u[j+1] <= u )
+         j++ ;
+      guide[k] = int(j) ;
+   }
+
+   // error at the interval midpoints (in 'u', as the inversion tolerance)
+   BT error = BT(0.0) ;
+   for( size_t i = 0 ; i < num_intervals ; i++ )
+   {
+      const T  u_mid = T( BT(0.5)*(ub[i] + ub[i+1]) ) ;
+      const BT t_fit = BT( eval_fit( u_mid ) ) ;
+      error = std::max( error, std::abs( eval_A( mb, t_fit ).value - BT(u_mid) ) );
+   }
+   return T( error ) ;
+}
+// --------------------------------------------------------------------------
+// cubic Hermite interpolation on the interval holding 'u'
+
+template< class T >
+inline T PSCMapsTabulated<T>::eval_fit( T u ) const
+{
+   const size_t num_intervals = guide.size() ;
+
+   const T u_max = T(u_fit_max) ;
+   u = std::max( T(0.0), std::min( u, u_max ));
+
+   const size_t k = std::min( size_t( (u/u_max)*T(num_intervals) ), num_intervals-1 );
+   size_t       i = size_t( guide[k] );
+   while ( i+1 < num_intervals && node_u[i+1] <= u )
+      i++ ;
+
+   // several nodes may have the same 'u' (near A' == 0, as 'u' is rounded to T),
+   // use the last one of them
+   const T h = node_u[i+1]-node_u[i] ;
+   if ( ! ( T(0.0) < h ) )
+      return node_t[i+1] ;
+
+   const T v   = (u-node_u[i])/h ,
+           v2  = v*v ,
+           v3  = v2*v ,
+           h00 = T(2.0)*v3 - T(3.0)*v2 + T(1.0) ,
+           h10 = v3 - T(2.0)*v2 + v ,
+           h01 = T(3.0)*v2 - T(2.0)*v3 ,
+           h11 = v3 - v2 ;
+
+   return h00*node_t[i] + h10*h*node_m[i] + h01*node_t[i+1] + h11*h*node_m[i+1] ;
+}
+// --------------------------------------------------------------------------
+
+template< class T >
+void PSCMapsTabulated<T>::eval_map( T s, T t, T &x, T &y ) const
+{
+   if ( ! tabulated )
+   {
+      maps.eval_map( s, t, x, y );
+      return ;
+   }
+
+   if ( do_checks )
+   {
+      assert( T(0.0) <= s && s <= T(1.0) );
+      assert( T(0.0) <= t && t <= T(1.0) );
+   }
+
+   // compute 'u' by scaling and translating 't' (as in 'PSCMaps')
+   const bool t_is_neg = t < T(0.5) ;
+   const T    u        = t_is_neg ? T(1.0)-T(2.0)*t
+                                  : T(2.0)*t - T(1.0) ;
+
+   if ( ! maps.using_radial )
+   {
+      // (the limits of 'maps' are used, as 't_max' was computed with 'BT')
+      const T y_pos = std::max( T(0.0), std::min( eval_fit( u ), maps.center_below_hor ? maps.yl : maps.ay ));
+      maps.hor_map_from_y( s, t_is_neg, y_pos, x, y );
+      return ;
+   }
+
+   // radial map (partially visible)
+   const T varphi = ( u <= T(u_fit_max) )
+                  ? std::max( T(0.0), std::min( eval_fit( u ), maps.phi_l ))
+                  : std::max( T(0.0), std::min( maps.eval_ArE_inverse( u*T(A_max) - maps.L ), T(M_PI) ));
+   T rmin, rmax ;
+   maps.eval_rmin_rmax( varphi, rmin, rmax );
+   maps.rad_map_from_angle( s, t_is_neg, varphi, rmin, rmax, false, x, y );
+}
+
+} // end namespace PSCM
+
+#endif
@@ -0,0 +1,261 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** stratified and low-discrepancy (s,t) sequences
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCSEQUENCES_H
+#define PSCSEQUENCES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#include "PSCMaps.h"  // 'do_checks'
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// Sequences of sample points (s,t) in [0,1)^2, to be passed to the maps
+// (which preserve the stratification of the samples, see the paper).
+//
+// All the sequences have the same interface: 'generate( first, n, s, t )'
+// writes the points with indexes 'first' to 'first+n-1' in s[i] and t[i],
+// for i in [0,n). Point 'k' only depends on 'k' and on the seed given to the
+// constructor, so any part of a sequence can be generated independently (and
+// by different threads). The objects are small and cheap to create, so a
+// sequence (with its own seed) can be used for each shading point.
+//
+//   UniformSequence : independent uniform random points (from a hash of the index)
+//   JitteredGrid    : one random point in each cell of a nx*ny grid (the cells
+//                     are visited in scanline order, a new jitter for each pass)
+//   SobolSequence   : the 2D Sobol (0,2)-sequence, with Owen scrambling (each
+//                     aligned block of 2^m points is a (0,m,2)-net)
+//   R2Sequence      : the R2 rank-1 lattice sequence (Roberts), randomly shifted
+//
+// See 'PSCMaps::eval_map_sequence', which evaluates the maps for a part of a
+// sequence without intermediate arrays.
+
+// -----------------------------------------------------------------------------
+// kinds of sequences (used to select one at runtime, see 'PSCMapsEngine')
+
+enum SequenceKind { sequence_uniform, sequence_sobol, sequence_r2 } ;
+
+// -----------------------------------------------------------------------------
+// a 64 bits hash of a 64 bits value ('splitmix64' finalizer)
+
+inline uint64_t hash64( uint64_t v )
+{
+   v += 0x9E3779B97F4A7C15ull ;
+   v  = ( v ^ ( v >> 30 ) )*0xBF58476D1CE4E5B9ull ;
+   v  = ( v ^ ( v >> 27 ) )*0x94D049BB133111EBull ;
+   return v ^ ( v >> 31 ) ;
+}
+// -----------------------------------------------------------------------------
+// a value in [0,1) from 32 bits (interpreted as a binary fraction):
+// 24 bits for float (so the value is exactly representable), 32 otherwise
+
+template< typename T >
+inline T unit_from_bits( const uint32_t bits )
+{
+   return ( sizeof(T) < sizeof(double) )
+      ? T( bits >> 8 )*T( 1.0/16777216.0 )
+      : T( bits )*T( 1.0/4294967296.0 ) ;
+}
+// -----------------------------------------------------------------------------
+// reverses the order of the bits in a 32 bits value
+
+inline uint32_t reverse_bits( uint32_t v )
+{
+   v = ( ( v >> 1 ) & 0x55555555u ) | ( ( v & 0x55555555u ) << 1 );
+   v = ( ( v >> 2 ) & 0x33333333u ) | ( ( v & 0x33333333u ) << 2 );
+   v = ( ( v >> 4 ) & 0x0F0F0F0Fu ) | ( ( v & 0x0F0F0F0Fu ) << 4 );
+   v = ( ( v >> 8 ) & 0x00FF00FFu ) | ( ( v & 0x00FF00FFu ) << 8 );
+   return ( v >> 16 ) | ( v << 16 );
+}
+// -----------------------------------------------------------------------------
+// Owen scrambling (nested uniform scrambling) of a 32 bits binary fraction,
+// as proposed by Burley (JCGT 2020): the bits are reversed and hashed with a
+// Laine-Karras permutation (with the constants by N. Vegdahl), in which each
+// bit only depends on the lower ones, so each bit of 'v' is flipped depending
+// only on the seed and on the bits above it
+
+inline uint32_t owen_scramble( const uint32_t v, const uint32_t seed )
+{
+   uint32_t x = reverse_bits( v );
+   x += seed ;
+   x ^= x*0x6C50B47Cu ;
+   x ^= x*0xB82F1E52u ;
+   x ^= x*0xC7AFE638u ;
+   x ^= x*0x8D22F6E6u ;
+   return reverse_bits( x );
+}
+// -----------------------------------------------------------------------------
+// second dimension of the Sobol sequence (the first one is the bit-reversed index),
+// generator matrix columns are v_0 = 2^31 and v_k = v_(k-1) xor (v_(k-1) >> 1)
+
+inline uint32_t sobol_second( uint32_t index )
+{
+   uint32_t r = 0 ;
+   for( uint32_t v = 1u << 31 ; index != 0 ; index >>= 1, v ^= v >> 1 )
+      if ( index & 1u )
+         r ^= v ;
+   return r ;
+}
+
+// *****************************************************************************
+// Sequences
+
+template< typename T >
+class UniformSequence
+{
+   public:
+   UniformSequence( const uint64_t p_seed = 0 ) : seed( p_seed ) {}
+
+   void generate( const size_t first, const size_t n, T * s, T * t ) const
+   {
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         const uint64_t bits = hash64( seed + uint64_t( first+i ) );
+         s[i] = unit_from_bits<T>( uint32_t( bits >> 32 ) );
+         t[i] = unit_from_bits<T>( uint32_t( bits ) );
+      }
+   }
+
+   private:
+   uint64_t seed ;
+} ;
+// -----------------------------------------------------------------------------
+
+template< typename T >
+class JitteredGrid
+{
+   public:
+   // a grid with 'p_nx' columns (along s) and 'p_ny' rows (along t)
+   JitteredGrid( const size_t p_nx, const size_t p_ny, const uint64_t p_seed = 0 )
+      : nx( p_nx ), ny( p_ny ), seed( p_seed )
+   {
+      if ( do_checks )
+         assert( 0 < nx && 0 < ny );
+   }
+
+   // number of cells (points in each pass)
+   size_t get_num_cells() const { return nx*ny ; }
+
+   void generate( const size_t first, const size_t n, T * s, T * t ) const
+   {
+      const T      dx  = T(1.0)/T(nx) ,
+                   dy  = T(1.0)/T(ny) ;
+      const size_t nxy = nx*ny ;
+
+      size_t cell = first % nxy ,
+             col  = cell % nx ,
+             row  = cell / nx ;
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         const uint64_t bits = hash64( seed + uint64_t( first+i ) );
+         s[i] = std::min( ( T(col) + unit_from_bits<T>( uint32_t( bits >> 32 ) ) )*dx, T(1.0) );
+         t[i] = std::min( ( T(row) + unit_from_bits<T>( uint32_t( bits ) ) )*dy, T(1.0) );
+
+         if ( ++col == nx )
+         {
+            col = 0 ;
+            if ( ++row == ny )
+               row = 0 ;
+         }
+      }
+   }
+
+   private:
+   size_t   nx, ny ;
+   uint64_t seed ;
+} ;
+// -----------------------------------------------------------------------------
+
+template< typename T >
+class SobolSequence
+{
+   public:
+   // 'p_scrambled == false' gives the plain (deterministic) Sobol points
+   // (the first one is (0,0)), otherwise they are Owen scrambled with the seed
+   SobolSequence( const uint64_t p_seed = 0, const bool p_scrambled = true )
+   {
+      const uint64_t h = hash64( p_seed );
+      seed_s = p_scrambled ? uint32_t( h >> 32 ) : 0u ;
+      seed_t = p_scrambled ? uint32_t( h ) : 0u ;
+      scrambled = p_scrambled ;
+   }
+
+   // at most 2^32 points (the indexes have 32 bits)
+   void generate( const size_t first, const size_t n, T * s, T * t ) const
+   {
+      if ( do_checks )
+         assert( uint64_t( first ) + uint64_t( n ) <= ( uint64_t(1) << 32 ) );
+
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         const uint32_t index = uint32_t( first+i ),
+                        bs    = reverse_bits( index ),
+                        bt    = sobol_second( index );
+         s[i] = unit_from_bits<T>( scrambled ? owen_scramble( bs, seed_s ) : bs );
+         t[i] = unit_from_bits<T>( scrambled ? owen_scramble( bt, seed_t ) : bt );
+      }
+   }
+
+   private:
+   uint32_t seed_s, seed_t ;
+   bool     scrambled ;
+} ;
+// -----------------------------------------------------------------------------
+
+template< typename T >
+class R2Sequence
+{
+   public:
+   // the points are shifted (modulo 1) by a random offset (from the seed)
+   R2Sequence( const uint64_t p_seed = 0 )
+   {
+      offset_s = hash64( p_seed );
+      offset_t = hash64( offset_s );
+   }
+
+   void generate( const size_t first, const size_t n, T * s, T * t ) const
+   {
+      // 1/g and 1/g^2 as 64 bits fractions, where g is the plastic number
+      // (the real root of x^3 = x+1), so the sums wrap around modulo 1
+      constexpr uint64_t a_s = 0xC13FA9A902A6328Full ,
+                         a_t = 0x91E10DA5C79E7B1Cull ;
+
+      uint64_t fs = offset_s + uint64_t( first )*a_s ,
+               ft = offset_t + uint64_t( first )*a_t ;
+      for( size_t i = 0 ; i < n ; i++ )
+      {
+         s[i] = unit_from_bits<T>( uint32_t( fs >> 32 ) );
+         t[i] = unit_from_bits<T>( uint32_t( ft >> 32 ) );
+         fs  += a_s ;
+         ft  += a_t ;
+      }
+   }
+
+   private:
+   uint64_t offset_s, offset_t ;
+} ;
+
+} // end namespace PSCM
+
+#endif
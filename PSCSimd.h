@@ -0,0 +1,420 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** template class 'Pack' (SIMD lanes) and aux funcs
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCSIMD_H
+#define PSCSIMD_H
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX2__) && defined(__FMA__)
+   #define PSCM_SIMD_AVX2
+   #include <immintrin.h>
+#endif
+
+namespace PSCM
+{
+namespace simd
+{
+
+// -----------------------------------------------------------------------------
+// A 'Pack<T>' holds 'width' values of type T (lanes), which are processed by
+// using a single instruction stream. A 'Mask<T>' holds one boolean per lane.
+//
+// When compiled with AVX2 and FMA enabled (e.g. '-mavx2 -mfma'), packs of
+// floats and doubles are 8 floats or 4 doubles in a 256 bits register.
+// Otherwise a portable version (arrays with the same number of lanes) is used.
+//
+// Code written in terms of the functions in this namespace also works on
+// plain scalars (T), so the same source can be used for SIMD and scalar paths.
+
+template< class T > struct Pack ;
+template< class T > struct Mask ;
+
+// scalar type for a value type (which is either a scalar or a Pack)
+template< class V > struct ScalarOf            { typedef V type ; } ;
+template< class T > struct ScalarOf< Pack<T> > { typedef T type ; } ;
+
+// -----------------------------------------------------------------------------
+// functions on plain scalars, so generic code can use them
+
+template< class T > inline T    fma( const T a, const T b, const T c ) { return a*b + c ; }
+template< class T > inline T    sqrt( const T a ) { return std::sqrt( a ); }
+template< class T > inline T    abs( const T a ) { return std::abs( a ); }
+template< class T > inline T    min( const T a, const T b ) { return std::min( a, b ); }
+template< class T > inline T    max( const T a, const T b ) { return std::max( a, b ); }
+template< class T > inline T    select( const bool m, const T a, const T b ) { return m ? a : b ; }
+template< class T > inline T    flip_sign( const T a, const bool m ) { return m ? -a : a ; }
+template< class T > inline T    round( const T a ) { return std::nearbyint( a ); } // to nearest (even) integer
+inline bool any( const bool m ) { return m ; }
+inline bool all( const bool m ) { return m ; }
+
+// clamp 'a' to the interval [lo,hi] (works on scalars and on packs)
+template< class V > inline V clamp( const V a, const V lo, const V hi ) { return max( lo, min( a, hi ) ); }
+
+// *****************************************************************************
+// portable version: fixed size arrays with as many lanes as a 256 bits register
+// (used for any type when AVX2 is not enabled, and for 'long double' always)
+
+template< class T > struct Pack
+{
+   typedef T scalar ;
+   enum { width = 32/sizeof(T) } ;
+
+   T v[width] ;
+
+   inline Pack() {}
+   inline Pack( const T a ) { for( int i = 0 ; i < width ; i++ ) v[i] = a ; }
+} ;
+
+template< class T > struct Mask
+{
+   bool m[Pack<T>::width] ;
+} ;
+
+template< class T > inline Pack<T> load( const T * p )
+{
+   Pack<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.v[i] = p[i] ;
+   return r ;
+}
+template< class T > inline void store( T * p, const Pack<T> & a )
+{
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) p[i] = a.v[i] ;
+}
+
+// apply a lane-wise function to one or two packs
+template< class T, class Func > inline Pack<T> map( const Pack<T> & a, Func f )
+{
+   Pack<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.v[i] = f( a.v[i] );
+   return r ;
+}
+template< class T, class Func > inline Pack<T> map( const Pack<T> & a, const Pack<T> & b, Func f )
+{
+   Pack<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.v[i] = f( a.v[i], b.v[i] );
+   return r ;
+}
+template< class T, class Func > inline Mask<T> map_mask( const Pack<T> & a, const Pack<T> & b, Func f )
+{
+   Mask<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.m[i] = f( a.v[i], b.v[i] );
+   return r ;
+}
+
+template< class T > inline Pack<T> operator + ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return x+y ; } ); }
+template< class T > inline Pack<T> operator - ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return x-y ; } ); }
+template< class T > inline Pack<T> operator * ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return x*y ; } ); }
+template< class T > inline Pack<T> operator / ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return x/y ; } ); }
+template< class T > inline Pack<T> operator - ( const Pack<T> & a ) { return map( a, []( T x ) { return -x ; } ); }
+
+template< class T > inline Pack<T> fma ( const Pack<T> & a, const Pack<T> & b, const Pack<T> & c ) { return a*b + c ; }
+template< class T > inline Pack<T> sqrt( const Pack<T> & a ) { return map( a, []( T x ) { return std::sqrt( x ); } ); }
+template< class T > inline Pack<T> abs ( const Pack<T> & a ) { return map( a, []( T x ) { return std::abs( x ); } ); }
+template< class T > inline Pack<T> min ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return y < x ? y : x ; } ); }
+template< class T > inline Pack<T> max ( const Pack<T> & a, const Pack<T> & b ) { return map( a, b, []( T x, T y ) { return x < y ? y : x ; } ); }
+template< class T > inline Pack<T> round( const Pack<T> & a ) { return map( a, []( T x ) { return std::nearbyint( x ); } ); }
+
+template< class T > inline Mask<T> operator <  ( const Pack<T> & a, const Pack<T> & b ) { return map_mask( a, b, []( T x, T y ) { return x <  y ; } ); }
+template< class T > inline Mask<T> operator <= ( const Pack<T> & a, const Pack<T> & b ) { return map_mask( a, b, []( T x, T y ) { return x <= y ; } ); }
+template< class T > inline Mask<T> operator >  ( const Pack<T> & a, const Pack<T> & b ) { return map_mask( a, b, []( T x, T y ) { return x >  y ; } ); }
+template< class T > inline Mask<T> operator >= ( const Pack<T> & a, const Pack<T> & b ) { return map_mask( a, b, []( T x, T y ) { return x >= y ; } ); }
+
+template< class T > inline Mask<T> operator & ( const Mask<T> & a, const Mask<T> & b )
+{
+   Mask<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.m[i] = a.m[i] && b.m[i] ;
+   return r ;
+}
+template< class T > inline Mask<T> operator | ( const Mask<T> & a, const Mask<T> & b )
+{
+   Mask<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.m[i] = a.m[i] || b.m[i] ;
+   return r ;
+}
+template< class T > inline Mask<T> operator ! ( const Mask<T> & a )
+{
+   Mask<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.m[i] = ! a.m[i] ;
+   return r ;
+}
+template< class T > inline Pack<T> select( const Mask<T> & m, const Pack<T> & a, const Pack<T> & b )
+{
+   Pack<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.v[i] = m.m[i] ? a.v[i] : b.v[i] ;
+   return r ;
+}
+template< class T > inline Pack<T> flip_sign( const Pack<T> & a, const Mask<T> & m )
+{
+   Pack<T> r ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) r.v[i] = m.m[i] ? -a.v[i] : a.v[i] ;
+   return r ;
+}
+template< class T > inline bool any( const Mask<T> & m )
+{
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) if ( m.m[i] ) return true ;
+   return false ;
+}
+template< class T > inline bool all( const Mask<T> & m )
+{
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) if ( ! m.m[i] ) return false ;
+   return true ;
+}
+
+// a mask with all lanes set to true
+template< class T > inline Mask<T> true_mask()
+{
+   return Pack<T>( T(0.0) ) <= Pack<T>( T(0.0) );
+}
+
+#ifdef PSCM_SIMD_AVX2
+
+// *****************************************************************************
+// AVX2 version: 8 floats
+
+template<> struct Pack<float>
+{
+   typedef float scalar ;
+   enum { width = 8 } ;
+
+   __m256 v ;
+
+   inline Pack() {}
+   inline Pack( const float a ) : v( _mm256_set1_ps( a ) ) {}
+   inline Pack( const __m256 p ) : v( p ) {}
+} ;
+
+template<> struct Mask<float>
+{
+   __m256 m ;
+
+   inline Mask() {}
+   inline Mask( const __m256 p ) : m( p ) {}
+} ;
+
+inline Pack<float> load( const float * p )                { return _mm256_loadu_ps( p ); }
+inline void        store( float * p, const Pack<float> a ) { _mm256_storeu_ps( p, a.v ); }
+
+inline Pack<float> operator + ( const Pack<float> a, const Pack<float> b ) { return _mm256_add_ps( a.v, b.v ); }
+inline Pack<float> operator - ( const Pack<float> a, const Pack<float> b ) { return _mm256_sub_ps( a.v, b.v ); }
+inline Pack<float> operator * ( const Pack<float> a, const Pack<float> b ) { return _mm256_mul_ps( a.v, b.v ); }
+inline Pack<float> operator / ( const Pack<float> a, const Pack<float> b ) { return _mm256_div_ps( a.v, b.v ); }
+inline Pack<float> operator - ( const Pack<float> a ) { return _mm256_xor_ps( a.v, _mm256_set1_ps( -0.0f ) ); }
+
+inline Pack<float> fma ( const Pack<float> a, const Pack<float> b, const Pack<float> c ) { return _mm256_fmadd_ps( a.v, b.v, c.v ); }
+inline Pack<float> sqrt( const Pack<float> a ) { return _mm256_sqrt_ps( a.v ); }
+inline Pack<float> abs ( const Pack<float> a ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a.v ); }
+inline Pack<float> min ( const Pack<float> a, const Pack<float> b ) { return _mm256_min_ps( a.v, b.v ); }
+inline Pack<float> max ( const Pack<float> a, const Pack<float> b ) { return _mm256_max_ps( a.v, b.v ); }
+inline Pack<float> round( const Pack<float> a ) { return _mm256_round_ps( a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+
+inline Mask<float> operator <  ( const Pack<float> a, const Pack<float> b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+inline Mask<float> operator <= ( const Pack<float> a, const Pack<float> b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LE_OQ ); }
+inline Mask<float> operator >  ( const Pack<float> a, const Pack<float> b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GT_OQ ); }
+inline Mask<float> operator >= ( const Pack<float> a, const Pack<float> b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_GE_OQ ); }
+
+inline Mask<float> operator & ( const Mask<float> a, const Mask<float> b ) { return _mm256_and_ps( a.m, b.m ); }
+inline Mask<float> operator | ( const Mask<float> a, const Mask<float> b ) { return _mm256_or_ps( a.m, b.m ); }
+inline Mask<float> operator ! ( const Mask<float> a ) { return _mm256_xor_ps( a.m, _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) ) ); }
+
+inline Pack<float> select( const Mask<float> m, const Pack<float> a, const Pack<float> b ) { return _mm256_blendv_ps( b.v, a.v, m.m ); }
+inline Pack<float> flip_sign( const Pack<float> a, const Mask<float> m ) { return _mm256_xor_ps( a.v, _mm256_and_ps( m.m, _mm256_set1_ps( -0.0f ) ) ); }
+inline bool        any( const Mask<float> m ) { return _mm256_movemask_ps( m.m ) != 0 ; }
+inline bool        all( const Mask<float> m ) { return _mm256_movemask_ps( m.m ) == 0xFF ; }
+
+// *****************************************************************************
+// AVX2 version: 4 doubles
+
+template<> struct Pack<double>
+{
+   typedef double scalar ;
+   enum { width = 4 } ;
+
+   __m256d v ;
+
+   inline Pack() {}
+   inline Pack( const double a ) : v( _mm256_set1_pd( a ) ) {}
+   inline Pack( const __m256d p ) : v( p ) {}
+} ;
+
+template<> struct Mask<double>
+{
+   __m256d m ;
+
+   inline Mask() {}
+   inline Mask( const __m256d p ) : m( p ) {}
+} ;
+
+inline Pack<double> load( const double * p )                 { return _mm256_loadu_pd( p ); }
+inline void         store( double * p, const Pack<double> a ) { _mm256_storeu_pd( p, a.v ); }
+
+inline Pack<double> operator + ( const Pack<double> a, const Pack<double> b ) { return _mm256_add_pd( a.v, b.v ); }
+inline Pack<double> operator - ( const Pack<double> a, const Pack<double> b ) { return _mm256_sub_pd( a.v, b.v ); }
+inline Pack<double> operator * ( const Pack<double> a, const Pack<double> b ) { return _mm256_mul_pd( a.v, b.v ); }
+inline Pack<double> operator / ( const Pack<double> a, const Pack<double> b ) { return _mm256_div_pd( a.v, b.v ); }
+inline Pack<double> operator - ( const Pack<double> a ) { return _mm256_xor_pd( a.v, _mm256_set1_pd( -0.0 ) ); }
+
+inline Pack<double> fma ( const Pack<double> a, const Pack<double> b, const Pack<double> c ) { return _mm256_fmadd_pd( a.v, b.v, c.v ); }
+inline Pack<double> sqrt( const Pack<double> a ) { return _mm256_sqrt_pd( a.v ); }
+inline Pack<double> abs ( const Pack<double> a ) { return _mm256_andnot_pd( _mm256_set1_pd( -0.0 ), a.v ); }
+inline Pack<double> min ( const Pack<double> a, const Pack<double> b ) { return _mm256_min_pd( a.v, b.v ); }
+inline Pack<double> max ( const Pack<double> a, const Pack<double> b ) { return _mm256_max_pd( a.v, b.v ); }
+inline Pack<double> round( const Pack<double> a ) { return _mm256_round_pd( a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+
+inline Mask<double> operator <  ( const Pack<double> a, const Pack<double> b ) { return _mm256_cmp_pd( a.v, b.v, _CMP_LT_OQ ); }
+inline Mask<double> operator <= ( const Pack<double> a, const Pack<double> b ) { return _mm256_cmp_pd( a.v, b.v, _CMP_LE_OQ ); }
+inline Mask<double> operator >  ( const Pack<double> a, const Pack<double> b ) { return _mm256_cmp_pd( a.v, b.v, _CMP_GT_OQ ); }
+inline Mask<double> operator >= ( const Pack<double> a, const Pack<double> b ) { return _mm256_cmp_pd( a.v, b.v, _CMP_GE_OQ ); }
+
+inline Mask<double> operator & ( const Mask<double> a, const Mask<double> b ) { return _mm256_and_pd( a.m, b.m ); }
+inline Mask<double> operator | ( const Mask<double> a, const Mask<double> b ) { return _mm256_or_pd( a.m, b.m ); }
+inline Mask<double> operator ! ( const Mask<double> a ) { return _mm256_xor_pd( a.m, _mm256_castsi256_pd( _mm256_set1_epi64x( -1 ) ) ); }
+
+inline Pack<double> select( const Mask<double> m, const Pack<double> a, const Pack<double> b ) { return _mm256_blendv_pd( b.v, a.v, m.m ); }
+inline Pack<double> flip_sign( const Pack<double> a, const Mask<double> m ) { return _mm256_xor_pd( a.v, _mm256_and_pd( m.m, _mm256_set1_pd( -0.0 ) ) ); }
+inline bool         any( const Mask<double> m ) { return _mm256_movemask_pd( m.m ) != 0 ; }
+inline bool         all( const Mask<double> m ) { return _mm256_movemask_pd( m.m ) == 0xF ; }
+
+#endif // ends #ifdef PSCM_SIMD_AVX2
+
+// a mask with the first 'n' lanes set to true (used for packs padded at the end)
+template< class T > inline Mask<T> first_lanes_mask( const int n )
+{
+   T index[Pack<T>::width] ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) index[i] = T(i) ;
+   return load( index ) < Pack<T>( T(n) );
+}
+// number of lanes set to true in a mask
+template< class T > inline int count( const Mask<T> & m )
+{
+   T lanes[Pack<T>::width] ;
+   store( lanes, select( m, Pack<T>( T(1.0) ), Pack<T>( T(0.0) ) ) );
+   int n = 0 ;
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) if ( lanes[i] != T(0.0) ) n++ ;
+   return n ;
+}
+
+// -----------------------------------------------------------------------------
+// transcendental functions on packs, evaluated lane by lane by using the
+// standard library functions (and on scalars, so generic code can use them)
+
+template< class T, class Func > inline Pack<T> apply( const Pack<T> & a, Func f )
+{
+   T buf[Pack<T>::width] ;
+   store( buf, a );
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) buf[i] = f( buf[i] );
+   return load( buf );
+}
+template< class T, class Func > inline Pack<T> apply( const Pack<T> & a, const Pack<T> & b, Func f )
+{
+   T buf_a[Pack<T>::width], buf_b[Pack<T>::width] ;
+   store( buf_a, a );
+   store( buf_b, b );
+   for( int i = 0 ; i < Pack<T>::width ; i++ ) buf_a[i] = f( buf_a[i], buf_b[i] );
+   return load( buf_a );
+}
+
+template< class T > inline T sin  ( const T a ) { return std::sin( a ); }
+template< class T > inline T cos  ( const T a ) { return std::cos( a ); }
+template< class T > inline T tan  ( const T a ) { return std::tan( a ); }
+template< class T > inline T asin ( const T a ) { return std::asin( a ); }
+template< class T > inline T atan ( const T a ) { return std::atan( a ); }
+template< class T > inline T atan2( const T a, const T b ) { return std::atan2( a, b ); }
+
+template< class T > inline Pack<T> sin  ( const Pack<T> & a ) { return apply( a, []( T x ) { return std::sin( x ); } ); }
+template< class T > inline Pack<T> cos  ( const Pack<T> & a ) { return apply( a, []( T x ) { return std::cos( x ); } ); }
+template< class T > inline Pack<T> tan  ( const Pack<T> & a ) { return apply( a, []( T x ) { return std::tan( x ); } ); }
+template< class T > inline Pack<T> asin ( const Pack<T> & a ) { return apply( a, []( T x ) { return std::asin( x ); } ); }
+template< class T > inline Pack<T> atan ( const Pack<T> & a ) { return apply( a, []( T x ) { return std::atan( x ); } ); }
+template< class T > inline Pack<T> atan2( const Pack<T> & a, const Pack<T> & b ) { return apply( a, b, []( T x, T y ) { return std::atan2( x, y ); } ); }
+
+// -----------------------------------------------------------------------------
+// load and store as many values as lanes in 'V' (a scalar or a Pack)
+
+template< class V > struct Lanes
+{
+   static inline V    load( const V * p )       { return *p ; }
+   static inline void store( V * p, const V a ) { *p = a ; }
+} ;
+template< class T > struct Lanes< Pack<T> >
+{
+   static inline Pack<T> load( const T * p )             { return simd::load( p ); }
+   static inline void    store( T * p, const Pack<T> a ) { simd::store( p, a ); }
+} ;
+
+template< class V >
+inline V load_lanes( const typename ScalarOf<V>::type * p ) { return Lanes<V>::load( p ); }
+
+template< class V >
+inline void store_lanes( typename ScalarOf<V>::type * p, const V a ) { Lanes<V>::store( p, a ); }
+
+// -----------------------------------------------------------------------------
+// sine and cosine of 'w', for 'w' in [-pi/2,pi/2] (no range reduction is done)
+// Uses truncated Taylor series, evaluated with Horner's rule: up to w^11/w^12
+// for floats and up to w^21/w^22 for doubles, so the truncation error is
+// below 6e-8 (floats) and 2e-18 (doubles) in that interval.
+// V can be a scalar type (float, double) or a Pack of them.
+
+template< class V >
+inline void sincos_pi2( const V w, V & sin_w, V & cos_w )
+{
+   typedef typename ScalarOf<V>::type T ;
+   constexpr bool dbl = sizeof(T) > sizeof(float) ;
+
+   const V w2 = w*w ;
+   V ps, pc ;
+
+   if ( dbl )
+   {
+      ps = fma( w2, V( T(  1.0/51090942171709440000.0) ), V( T(-1.0/121645100408832000.0) ) );
+      ps = fma( w2, ps, V( T( 1.0/355687428096000.0) ) );
+      ps = fma( w2, ps, V( T(-1.0/1307674368000.0) ) );
+      ps = fma( w2, ps, V( T( 1.0/6227020800.0) ) );
+      ps = fma( w2, ps, V( T(-1.0/39916800.0) ) );
+      pc = fma( w2, V( T( 1.0/1124000727777607680000.0) ), V( T(-1.0/2432902008176640000.0) ) );
+      pc = fma( w2, pc, V( T( 1.0/6402373705728000.0) ) );
+      pc = fma( w2, pc, V( T(-1.0/20922789888000.0) ) );
+      pc = fma( w2, pc, V( T( 1.0/87178291200.0) ) );
+      pc = fma( w2, pc, V( T(-1.0/479001600.0) ) );
+      pc = fma( w2, pc, V( T( 1.0/3628800.0) ) );
+      ps = fma( w2, ps, V( T( 1.0/362880.0) ) );
+   }
+   else
+   {
+      ps = V( T(-1.0/39916800.0) );
+      ps = fma( w2, ps, V( T( 1.0/362880.0) ) );
+      pc = fma( w2, V( T(-1.0/479001600.0) ), V( T( 1.0/3628800.0) ) );
+   }
+   ps = fma( w2, ps, V( T(-1.0/5040.0) ) );
+   ps = fma( w2, ps, V( T( 1.0/120.0) ) );
+   ps = fma( w2, ps, V( T(-1.0/6.0) ) );
+   pc = fma( w2, pc, V( T(-1.0/40320.0) ) );
+   pc = fma( w2, pc, V( T( 1.0/720.0) ) );
+   pc = fma( w2, pc, V( T(-1.0/24.0) ) );
+   pc = fma( w2, pc, V( T( 1.0/2.0) ) );
+
+   sin_w = fma( w*w2, ps, w );
+   cos_w = fma( -w2, pc, V( T(1.0) ) );
+}
+
+} // ends namespace simd
+} // ends namespace PSCM
+
+#endif // ends #ifndef PSCSIMD_H
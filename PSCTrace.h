@@ -0,0 +1,461 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** per-thread trace of slow or non-converged evaluations (lock-free ring buffers)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#ifndef PSCTRACE_H
+#define PSCTRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+namespace PSCM
+{
+
+// -----------------------------------------------------------------------------
+// constants (evaluated at compile time)
+
+// number of records in the ring buffer of each thread (a power of two), when
+// it is full the oldest records are overwritten
+constexpr size_t trace_ring_size = 4096 ;
+
+// initial value for the time threshold (in nanoseconds): faster evaluations
+// which converged are not recorded (see 'set_trace_min_time')
+constexpr uint32_t ini_trace_min_time_ns = 2000 ;
+
+// version of the trace files written by 'write_trace_file'
+constexpr uint32_t trace_file_version = 1 ;
+
+// -----------------------------------------------------------------------------
+// kinds of traced evaluations, and bits in 'TraceRecord::flags'
+
+enum TraceKind : uint8_t
+{
+   trace_initialize = 0 ,   // 'PSCMaps::initialize' (and the other initialization functions)
+   trace_Ap_inverse = 1 ,   // 'PSCMaps::eval_Ap_inverse' (parallel map)
+   trace_Ar_inverse = 2     // 'PSCMaps::eval_Ar_inverse' (radial map)
+} ;
+
+enum TraceFlags : uint8_t
+{
+   trace_radial     = 1 ,   // the maps object uses the radial map
+   trace_double     = 2 ,   // the maps object uses 'double' (otherwise 'float' or other)
+   trace_converged  = 4 ,   // the inversion converged (or no iterations were needed)
+   trace_iterative  = 8 ,   // the result was computed by 'InverseNSB' (not analytically)
+   trace_parabola   = 16 ,  // the result was computed by the small lune parabola
+   trace_forced     = 32 ,  // recorded because of 'InversionConfig::trace', not the threshold
+   trace_case_shift = 6     // the geometric case ('CapCase') is in the two highest bits
+} ;
+
+// -----------------------------------------------------------------------------
+// A record of one traced evaluation (fixed size, 9 words of 64 bits)
+
+struct TraceRecord
+{
+   double   alpha ,       // cap angles (recovered from the state of the maps object)
+            beta ,
+            s ,           // sample given to 'eval_map' (NaN when the inversion was
+            t ,           // called directly, or for 'initialize')
+            area ,        // area to invert, normalized to [0,1] (0 for 'initialize')
+            residual ,    // final |F(result)-area| of the iterations (normalized)
+            tolerance ;   // inversion settings of the maps object
+   uint32_t time_ns ;     // duration of the evaluation, in nanoseconds
+   uint16_t iterations ,  // iterations done by 'InverseNSB' (0 when not iterative)
+            max_iters ;   // inversion settings of the maps object
+   uint16_t thread ;      // index of the ring buffer where the record was written
+   uint8_t  kind ,        // a 'TraceKind' value
+            flags ;       // 'TraceFlags' bits
+
+   inline bool is_radial()    const { return ( flags & trace_radial ) != 0 ; }
+   inline bool is_double()    const { return ( flags & trace_double ) != 0 ; }
+   inline bool is_converged() const { return ( flags & trace_converged ) != 0 ; }
+   inline int  cap_case()     const { return flags >> trace_case_shift ; }
+
+   // true when 'kind' and the geometric case have valid values (see 'CapCase')
+   inline bool is_valid()     const { return kind <= trace_Ar_inverse && cap_case() <= 2 ; }
+} ;
+
+static_assert( sizeof(TraceRecord) == 72, "TraceRecord must have 9 words of 64 bits" );
+
+// -----------------------------------------------------------------------------
+// values written by the evaluation functions of the calling thread while an
+// evaluation is traced: the sample given to 'eval_map' (so the inversions it
+// calls can be replayed from it), and the outcome of the last inversion
+
+struct TraceScratch
+{
+   double   s, t ;        // (NaN when not inside 'eval_map')
+   double   residual ;
+   uint16_t iterations ;
+   uint8_t  flags ;       // 'trace_converged', 'trace_iterative' and 'trace_parabola'
+
+   inline void begin_evaluation() { residual = 0.0 ; iterations = 0 ; flags = trace_converged ; }
+} ;
+
+// returns the values of the calling thread
+inline TraceScratch & trace_scratch() ;
+
+// -----------------------------------------------------------------------------
+// A ring buffer of records, written only by its thread, and read by any thread
+// without locks: each slot has a sequence number which is odd while the record
+// is being written (a sequence lock), so the readers skip the records which
+// are overwritten while they copy them.
+
+class TraceRing
+{
+   public:
+
+   explicit TraceRing( const uint16_t p_index );
+
+   // writes a record (only called by the thread which owns the ring)
+   inline void push( const TraceRecord & record );
+
+   // appends the records currently in the ring (oldest first) to 'records'
+   void collect( std::vector<TraceRecord> & records ) const ;
+
+   // discards the records written so far
+   inline void clear();
+
+   // position in the list of rings (written in 'TraceRecord::thread')
+   inline uint16_t get_index() const { return index ; }
+
+   // --------------------------------------------------------------------------
+   private:
+
+   friend struct ThreadTraceRing ;
+
+   static constexpr size_t num_words = sizeof(TraceRecord)/sizeof(uint64_t) ;
+
+   struct Slot
+   {
+      std::atomic<uint64_t> seq ;               // 2n+1 while record n is written, 2n+2 after
+      std::atomic<uint64_t> words[num_words] ;  // the record
+   } ;
+
+   std::unique_ptr<Slot[]> slots ;
+   std::atomic<uint64_t>   head ,    // number of records written
+                           first ;   // first record not discarded by 'clear'
+   std::atomic<bool>       in_use ;  // true while a thread owns the ring
+   uint16_t                index ;   // position in the list of rings
+} ;
+
+// -----------------------------------------------------------------------------
+// functions on the traces of all the threads. The rings are kept after their
+// threads end (and reused by new threads), so their records can be collected
+// afterwards. The mutex which protects the list of rings is only taken when a
+// thread writes its first record, and by 'collect_trace' and 'clear_trace'.
+
+// writes a record in the ring of the calling thread (sets 'record.thread')
+inline void trace_record( TraceRecord record );
+
+// returns the records of all the threads, sorted by thread, oldest first
+inline std::vector<TraceRecord> collect_trace();
+
+// discards the records of all the threads
+inline void clear_trace();
+
+// sets and returns the time threshold (in nanoseconds): evaluations faster
+// than it are only recorded when they did not converge (or when forced by
+// 'InversionConfig::trace')
+inline void     set_trace_min_time( const uint32_t ns );
+inline uint32_t get_trace_min_time();
+
+// writes the records to a binary file, returns false on error
+inline bool write_trace_file( const std::string & file_name,
+                              const std::vector<TraceRecord> & records );
+
+// reads the records from a file written by 'write_trace_file', returns false
+// (and a message in 'error') on error, or when the number of records does not
+// match the file size, or any record is not valid (see 'TraceRecord::is_valid')
+inline bool read_trace_file( const std::string & file_name,
+                             std::vector<TraceRecord> & records, std::string & error );
+
+// -----------------------------------------------------------------------------
+// measures the time of an evaluation (the clock is only read when 'on' is true)
+
+class TraceTimer
+{
+   public:
+
+   explicit TraceTimer( const bool on )
+      : start( on ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point() ) {}
+
+   // nanoseconds since the construction (saturated to 32 bits)
+   inline uint32_t elapsed_ns() const ;
+
+   private:
+   std::chrono::steady_clock::time_point start ;
+} ;
+
+//****************************************************************************
+// Implementation of all functions
+
+inline TraceScratch & trace_scratch()
+{
+   static thread_local TraceScratch scratch =
+      { std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN(),
+        0.0, 0, trace_converged } ;
+   return scratch ;
+}
+// -----------------------------------------------------------------------------
+
+inline uint32_t TraceTimer::elapsed_ns() const
+{
+   const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start ).count();
+   return uint32_t( std::min<int64_t>( int64_t( ns ), int64_t( UINT32_MAX ) ) );
+}
+// -----------------------------------------------------------------------------
+
+inline TraceRing::TraceRing( const uint16_t p_index )
+   : slots( new Slot[trace_ring_size] ), head( 0 ), first( 0 ), in_use( false ), index( p_index )
+{
+   for( size_t i = 0 ; i < trace_ring_size ; i++ )
+   {
+      slots[i].seq.store( 0, std::memory_order_relaxed );
+      for( size_t k = 0 ; k < num_words ; k++ )
+         slots[i].words[k].store( 0, std::memory_order_relaxed );
+   }
+}
+// -----------------------------------------------------------------------------
+// the words are written between the two stores of the sequence number. They
+// are release stores, so a reader which sees any of them also sees the odd
+// sequence number stored before them
+
+inline void TraceRing::push( const TraceRecord & record )
+{
+   uint64_t words[num_words] ;
+   std::memcpy( words, &record, sizeof(TraceRecord) );
+
+   const uint64_t n    = head.load( std::memory_order_relaxed );
+   Slot &         slot = slots[n & ( trace_ring_size-1 )] ;
+
+   slot.seq.store( 2*n+1, std::memory_order_relaxed );
+   for( size_t k = 0 ; k < num_words ; k++ )
+      slot.words[k].store( words[k], std::memory_order_release );
+   slot.seq.store( 2*n+2, std::memory_order_release );
+   head.store( n+1, std::memory_order_release );
+}
+// -----------------------------------------------------------------------------
+// a record is kept when its sequence number is the same before and after
+// copying it (and it is the one expected for its position). The words are
+// acquire loads, so the second load of the sequence number is done after them
+
+inline void TraceRing::collect( std::vector<TraceRecord> & records ) const
+{
+   const uint64_t end   = head.load( std::memory_order_acquire ),
+                  begin = std::max( first.load( std::memory_order_acquire ),
+                                    end > trace_ring_size ? end - trace_ring_size : uint64_t( 0 ) );
+
+   for( uint64_t n = begin ; n < end ; n++ )
+   {
+      const Slot &   slot = slots[n & ( trace_ring_size-1 )] ;
+      const uint64_t seq  = slot.seq.load( std::memory_order_acquire );
+      if ( seq != 2*n+2 )
+         continue ;
+      uint64_t words[num_words] ;
+      for( size_t k = 0 ; k < num_words ; k++ )
+         words[k] = slot.words[k].load( std::memory_order_acquire );
+      if ( slot.seq.load( std::memory_order_relaxed ) != seq )
+         continue ;
+      TraceRecord record ;
+      std::memcpy( &record, words, sizeof(TraceRecord) );
+      records.push_back( record );
+   }
+}
+// -----------------------------------------------------------------------------
+
+inline void TraceRing::clear()
+{
+   first.store( head.load( std::memory_order_acquire ), std::memory_order_release );
+}
+// -----------------------------------------------------------------------------
+// the list of rings and its mutex, and the time threshold
+
+struct TraceRings
+{
+   std::mutex                               mutex ;
+   std::vector< std::unique_ptr<TraceRing> > rings ;
+} ;
+
+inline TraceRings & trace_rings()
+{
+   static TraceRings rings ;
+   return rings ;
+}
+inline std::atomic<uint32_t> & trace_min_time_ns()
+{
+   static std::atomic<uint32_t> min_time_ns( ini_trace_min_time_ns );
+   return min_time_ns ;
+}
+// -----------------------------------------------------------------------------
+// the ring of a thread: a free ring (whose thread ended) or a new one, which
+// is released when the thread ends
+
+struct ThreadTraceRing
+{
+   TraceRing * ring ;
+
+   ThreadTraceRing()
+   {
+      TraceRings & tr = trace_rings();
+      std::lock_guard<std::mutex> lock( tr.mutex );
+      ring = nullptr ;
+      for( const auto & r : tr.rings )
+         if ( ! r->in_use.load() )
+         {
+            ring = r.get();
+            break ;
+         }
+      if ( ring == nullptr )
+      {
+         tr.rings.emplace_back( new TraceRing( uint16_t( tr.rings.size() ) ) );
+         ring = tr.rings.back().get() ;
+      }
+      ring->in_use.store( true );
+   }
+   ~ThreadTraceRing()
+   {
+      ring->in_use.store( false );
+   }
+} ;
+// -----------------------------------------------------------------------------
+
+inline void trace_record( TraceRecord record )
+{
+   static thread_local ThreadTraceRing thread_ring ;
+   record.thread = thread_ring.ring->get_index() ;
+   thread_ring.ring->push( record );
+}
+// -----------------------------------------------------------------------------
+
+inline std::vector<TraceRecord> collect_trace()
+{
+   TraceRings & tr = trace_rings();
+   std::vector<TraceRecord> records ;
+   std::lock_guard<std::mutex> lock( tr.mutex );
+   for( const auto & r : tr.rings )
+      r->collect( records );
+   return records ;
+}
+// -----------------------------------------------------------------------------
+
+inline void clear_trace()
+{
+   TraceRings & tr = trace_rings();
+   std::lock_guard<std::mutex> lock( tr.mutex );
+   for( const auto & r : tr.rings )
+      r->clear();
+}
+// -----------------------------------------------------------------------------
+
+inline void set_trace_min_time( const uint32_t ns )
+{
+   trace_min_time_ns().store( ns, std::memory_order_relaxed );
+}
+inline uint32_t get_trace_min_time()
+{
+   return trace_min_time_ns().load( std::memory_order_relaxed );
+}
+// -----------------------------------------------------------------------------
+// file layout: the header below, followed by the records
+
+struct TraceFileHeader
+{
+   char     magic[8] ;     // == "PSCTRCE" (with the final 0)
+   uint32_t version ,      // == trace_file_version
+            record_size ;  // == sizeof(TraceRecord)
+   uint64_t num_records ;
+} ;
+
+inline bool write_trace_file( const std::string & file_name,
+                              const std::vector<TraceRecord> & records )
+{
+   TraceFileHeader h ;
+   std::memset( &h, 0, sizeof(h) );
+   std::strncpy( h.magic, "PSCTRCE", sizeof(h.magic) );
+   h.version     = trace_file_version ;
+   h.record_size = sizeof(TraceRecord) ;
+   h.num_records = records.size() ;
+
+   std::FILE * file = std::fopen( file_name.c_str(), "wb" );
+   if ( file == nullptr )
+      return false ;
+   const bool ok = std::fwrite( &h, sizeof(h), 1, file ) == 1 &&
+                   std::fwrite( records.data(), sizeof(TraceRecord), records.size(), file ) == records.size() ;
+   return ( std::fclose( file ) == 0 ) && ok ;
+}
+// -----------------------------------------------------------------------------
+
+inline bool read_trace_file( const std::string & file_name,
+                             std::vector<TraceRecord> & records, std::string & error )
+{
+   records.clear();
+   std::FILE * file = std::fopen( file_name.c_str(), "rb" );
+   if ( file == nullptr )
+   {
+      error = "cannot open file '" + file_name + "'" ;
+      return false ;
+   }
+
+   // size of the records in the file
+   long size = -1 ;
+   if ( std::fseek( file, 0, SEEK_END ) == 0 )
+      size = std::ftell( file ) - long( sizeof(TraceFileHeader) );
+   std::rewind( file );
+
+   TraceFileHeader h ;
+   if ( size < 0 || std::fread( &h, sizeof(h), 1, file ) != 1 )
+      error = "file '" + file_name + "' is too small" ;
+   else if ( std::strncmp( h.magic, "PSCTRCE", sizeof(h.magic) ) != 0 )
+      error = "file '" + file_name + "' is not a trace file" ;
+   else if ( h.version != trace_file_version || h.record_size != sizeof(TraceRecord) )
+      error = "file '" + file_name + "' has version " + std::to_string( h.version ) +
+              ", expected " + std::to_string( trace_file_version ) ;
+   else if ( h.num_records != uint64_t( size )/sizeof(TraceRecord) || uint64_t( size ) % sizeof(TraceRecord) != 0 )
+      error = "file '" + file_name + "' has " + std::to_string( size ) + " bytes of records, expected " +
+              std::to_string( h.num_records ) + " records" ;
+   else
+   {
+      records.resize( size_t( h.num_records ) );
+      if ( std::fread( records.data(), sizeof(TraceRecord), records.size(), file ) != records.size() )
+         error = "file '" + file_name + "' is truncated" ;
+      else if ( ! std::all_of( records.begin(), records.end(),
+                               []( const TraceRecord & r ) { return r.is_valid() ; } ) )
+         error = "file '" + file_name + "' has invalid records" ;
+      else
+         error.clear();
+      if ( ! error.empty() )
+         records.clear();
+   }
+   std::fclose( file );
+   return error.empty() ;
+}
+
+} // ends namespace PSCM
+
+#endif // ends #ifndef PSCTRACE_H
@@ -0,0 +1,337 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Multithreaded stress test (per-object inversion settings, and engine)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <PSCMaps.h>       // maps implementation
+#include <PSCMapsCache.h>  // cache of initialized maps
+#include <PSCMapsEngine.h> // multithreaded evaluation of many caps
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr int
+   ini_num_threads  = 8 ,     // default number of threads
+   num_caps         = 64 ,    // caps evaluated by each thread
+   samples_per_cap  = 64 ;    // samples for each cap (half of them in a batch)
+
+// --------------------------------------------------------------------------
+// the work done by one thread, and its results
+//
+// Each thread uses its own inversion settings (the tolerance depends on the
+// thread index) for its own maps objects and cache, and it also evaluates a
+// maps object shared (read only) by all the threads. Results are stored so
+// they can be compared with those of a single threaded run.
+
+struct ThreadWork
+{
+   int             index ;        // thread index
+   double          tolerance ;    // tolerance used by this thread
+   vector<double>  results ;      // all the (x,y) coordinates computed
+   double          max_residual ; // max. |Ap(y)/Ap_max - u| in the parallel inversions
+} ;
+
+void RunWork( ThreadWork & work, const PSCMaps<double> & shared_maps )
+{
+   const InversionConfig<double> config( work.tolerance, 50 );
+
+   std::mt19937 gen( 1000 + work.index );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+
+   PSCMaps<double>      maps ;
+   PSCMapsCache<double> cache( 16, 1e-3, config );
+
+   work.results.clear();
+   work.max_residual = 0.0 ;
+
+   for( int c = 0 ; c < num_caps ; c++ )
+   {
+      const double alpha  = 0.05 + 1.45*dist( gen ),
+                   beta   = ( 2.0*dist( gen ) - 1.0 )*0.5*M_PI ;
+      const bool   radial = ( c % 2 ) == 0 ;
+
+      maps.initialize( alpha, beta, radial, config );
+      if ( maps.is_invisible() )
+         continue ;
+      const PSCMaps<double> & cached = cache.get( alpha, beta, radial );
+
+      // single samples, with this thread's objects and with the shared object
+      double s[samples_per_cap], t[samples_per_cap], x[samples_per_cap], y[samples_per_cap] ;
+      for( int i = 0 ; i < samples_per_cap ; i++ )
+      {
+         s[i] = dist( gen );
+         t[i] = dist( gen );
+
+         double xv, yv ;
+         maps.eval_map( s[i], t[i], xv, yv );
+         work.results.push_back( xv );
+         work.results.push_back( yv );
+         shared_maps.eval_map( s[i], t[i], xv, yv );
+         work.results.push_back( xv );
+         work.results.push_back( yv );
+      }
+
+      // a batch, with the cached object
+      if ( ! cached.is_invisible() )
+      {
+         cached.eval_map_batch( s, t, x, y, samples_per_cap/2 );
+         for( int i = 0 ; i < samples_per_cap/2 ; i++ )
+         {
+            work.results.push_back( x[i] );
+            work.results.push_back( y[i] );
+         }
+      }
+
+      // the parallel inversion must be within this thread's tolerance
+      if ( ! radial )
+      {
+         const double Ap_max = 0.5*maps.get_area() ;
+         for( int i = 0 ; i < samples_per_cap ; i++ )
+         {
+            const double u      = t[i],
+                         y_inv  = maps.eval_Ap_inverse( u*Ap_max ),
+                         resid  = std::abs( maps.eval_Ap( y_inv )/Ap_max - u );
+            work.max_residual = std::max( work.max_residual, resid );
+         }
+      }
+   }
+}
+
+// --------------------------------------------------------------------------
+// evaluates the same jobs with 'PSCMapsEngine' using one thread and using
+// 'num_threads' threads (with small chunks, so there are many steals),
+// returns true when the results are the same
+
+bool RunEngine( const int num_threads )
+{
+   constexpr size_t num_jobs = 128, samples_per_job = 200 ;
+
+   std::mt19937 gen( 4321 );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+   vector<double> x( num_jobs*samples_per_job ), y( num_jobs*samples_per_job ),
+                  areas( num_jobs );
+   vector< SampleJob<double> > jobs( num_jobs );
+   for( size_t j = 0 ; j < num_jobs ; j++ )
+      jobs[j] = SampleJob<double>{ 0.05 + 1.45*dist( gen ), ( 2.0*dist( gen ) - 1.0 )*0.5*M_PI,
+                                   j % 3 != 0, samples_per_job, nullptr, nullptr,
+                                   &x[j*samples_per_job], &y[j*samples_per_job] } ;
+
+   PSCMapsEngine<double> engine_1( 1, 64 ),
+                         engine_n( unsigned( num_threads ), 64 );
+   engine_1.run( jobs.data(), num_jobs, areas.data() );
+   const vector<double> x1 = x, y1 = y, areas1 = areas ;
+   engine_n.run( jobs.data(), num_jobs, areas.data() );
+
+   const bool same = x == x1 && y == y1 && areas == areas1 ;
+   cout << "   engine: " << engine_n.get_num_chunks() << " chunks, " << engine_n.get_num_steals()
+        << " steals, results " << ( same ? "ok" : "differ" ) << endl ;
+   return same ;
+}
+// --------------------------------------------------------------------------
+// evaluates caps with the 'Counting' policy (scalar and batch), so the
+// inversion statistics of the calling thread are updated
+
+void RunCounting( const int index )
+{
+   std::mt19937 gen( 2000 + index );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+   PSCMaps<double,MathStd,Counting> maps ;
+   double s[samples_per_cap], t[samples_per_cap], x[samples_per_cap], y[samples_per_cap] ;
+
+   for( int c = 0 ; c < num_caps ; c++ )
+   {
+      maps.initialize( 0.05 + 1.45*dist( gen ), ( 2.0*dist( gen ) - 1.0 )*0.5*M_PI, ( c % 2 ) == 0 );
+      for( int i = 0 ; i < samples_per_cap ; i++ )
+      {
+         s[i] = dist( gen );
+         t[i] = dist( gen );
+      }
+      if ( maps.is_invisible() )
+         continue ;
+      for( int i = 0 ; i < samples_per_cap ; i++ )
+         maps.eval_map( s[i], t[i], x[i], y[i] );
+      maps.eval_map_batch( s, t, x, y, samples_per_cap );
+   }
+}
+// --------------------------------------------------------------------------
+// evaluates caps with the 'Tracing' policy, so records are written in the
+// trace of the calling thread
+
+void RunTracing( const int index )
+{
+   std::mt19937 gen( 3000 + index );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+   PSCMaps<double,MathStd,Tracing> maps ;
+   double x, y ;
+
+   for( int c = 0 ; c < num_caps ; c++ )
+   {
+      maps.initialize( 0.05 + 1.45*dist( gen ), ( 2.0*dist( gen ) - 1.0 )*0.5*M_PI, ( c % 2 ) == 0 );
+      if ( maps.is_invisible() )
+         continue ;
+      for( int i = 0 ; i < samples_per_cap ; i++ )
+         maps.eval_map( dist( gen ), dist( gen ), x, y );
+   }
+}
+// --------------------------------------------------------------------------
+// the traces of 'num_threads' threads are read by this thread while they are
+// written (every evaluation is recorded), and after the threads end. Returns
+// true when all the records read are complete ones
+
+bool RunTrace( const int num_threads )
+{
+   auto valid = []( const TraceRecord & r )
+   {
+      return r.kind <= trace_Ar_inverse && r.cap_case() < num_cap_cases && r.is_double() &&
+             ( std::isnan( r.s ) || ( 0.0 <= r.s && r.s <= 1.0 ) ) && r.iterations <= r.max_iters+1 ;
+   } ;
+
+   const uint32_t min_time = get_trace_min_time();
+   set_trace_min_time( 0 );
+   clear_trace();
+
+   std::atomic<int>    running( num_threads );
+   vector<std::thread> threads ;
+   for( int k = 0 ; k < num_threads ; k++ )
+      threads.emplace_back( [k,&running]() { RunTracing( k ); running-- ; } );
+
+   bool   ok         = true ;
+   size_t num_reads  = 0 ;
+   while ( running.load() > 0 )
+   {
+      for( const TraceRecord & r : collect_trace() )
+         ok = ok && valid( r );
+      num_reads++ ;
+   }
+   for( std::thread & thread : threads )
+      thread.join();
+
+   const vector<TraceRecord> records = collect_trace();
+   for( const TraceRecord & r : records )
+      ok = ok && valid( r );
+   ok = ok && ! records.empty() && records.size() <= size_t( num_threads )*trace_ring_size ;
+   set_trace_min_time( min_time );
+
+   cout << "   trace: " << records.size() << " records kept, " << num_reads << " concurrent reads, records "
+        << ( ok ? "ok" : "invalid" ) << endl ;
+   return ok ;
+}
+// --------------------------------------------------------------------------
+// the inversion statistics of 'num_threads' threads (flushed when they end)
+// must add up to the same totals as those of the same work done by this
+// thread, returns true when they do
+
+bool RunStats( const int num_threads )
+{
+   reset_total_inversion_stats();
+   for( int k = 0 ; k < num_threads ; k++ )
+      RunCounting( k );
+   flush_inversion_stats();
+   const InversionStats serial = total_inversion_stats();
+
+   reset_total_inversion_stats();
+   vector<std::thread> threads ;
+   for( int k = 0 ; k < num_threads ; k++ )
+      threads.emplace_back( RunCounting, k );
+   for( std::thread & thread : threads )
+      thread.join();
+   const InversionStats parallel = total_inversion_stats();
+
+   unsigned long long inversions = 0 ;
+   bool               same       = true ;
+   for( int m = 0 ; m < 2 ; m++ )
+      for( int c = 0 ; c < num_cap_cases ; c++ )
+      {
+         const InversionCaseStats & a = serial.cases[m][c], & b = parallel.cases[m][c] ;
+         same = same && a.inversions == b.inversions && a.interval_steps == b.interval_steps
+                && a.nan_steps == b.nan_steps && a.max_iters_exits == b.max_iters_exits
+                && a.parabola == b.parabola && std::equal( a.iters, a.iters+num_iters_bins, b.iters );
+         inversions += b.inversions ;
+      }
+   cout << "   inversion statistics: " << inversions << " inversions, totals "
+        << ( same ? "ok" : "differ" ) << endl ;
+   return same ;
+}
+// --------------------------------------------------------------------------
+// usage: stress_exe [num_threads]
+
+int main( int argc, char *argv[] )
+{
+   const int num_threads = ( argc < 2 ) ? ini_num_threads : std::max( 1, atoi( argv[1] ) );
+
+   PSCMaps<double> shared_maps ;
+   shared_maps.initialize( 0.6, 0.2, true );
+
+   // each thread uses a tolerance between 1e-2 and 1e-7
+   vector<ThreadWork> serial( num_threads ), parallel( num_threads );
+   for( int k = 0 ; k < num_threads ; k++ )
+   {
+      serial[k].index     = parallel[k].index     = k ;
+      serial[k].tolerance = parallel[k].tolerance = std::pow( 10.0, -2.0 - double( k % 6 ) );
+   }
+
+   // reference results, computed by a single thread
+   for( ThreadWork & work : serial )
+      RunWork( work, shared_maps );
+
+   // the same work, in concurrent threads
+   vector<std::thread> threads ;
+   for( ThreadWork & work : parallel )
+      threads.emplace_back( RunWork, std::ref( work ), std::cref( shared_maps ) );
+   for( std::thread & thread : threads )
+      thread.join();
+
+   cout << "multithreaded stress test: " << num_threads << " threads, "
+        << num_caps << " caps per thread, " << samples_per_cap << " samples per cap" << endl
+        << endl
+        << "   " << setw(8) << left << "thread" << right << setw(11) << "tolerance"
+        << setw(11) << "residual" << setw(10) << "results" << setw(10) << "status" << endl ;
+
+   bool ok = true ;
+   for( int k = 0 ; k < num_threads ; k++ )
+   {
+      const bool same   = serial[k].results == parallel[k].results ,
+                 in_tol = parallel[k].max_residual <= parallel[k].tolerance*(1.0+1e-6) + 1e-12 ,
+                 passed = same && in_tol ;
+      ok = ok && passed ;
+
+      cout << "   " << setw(8) << left << k << right << scientific << setprecision(1)
+           << setw(11) << parallel[k].tolerance
+           << setw(11) << parallel[k].max_residual << defaultfloat
+           << setw(10) << parallel[k].results.size()
+           << setw(10) << ( passed ? "ok" : ( same ? "residual" : "differ" ) ) << endl ;
+   }
+   ok = RunEngine( num_threads ) && ok ;
+   ok = RunStats( num_threads ) && ok ;
+   ok = RunTrace( num_threads ) && ok ;
+
+   cout << endl << ( ok ? "all threads passed" : "FAILED" ) << endl ;
+   return ok ? 0 : 1 ;
+}
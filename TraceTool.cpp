@@ -0,0 +1,255 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Trace tool: records slow or non-converged evaluations, dumps and replays them
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <algorithm>
+
+#include <PSCMaps.h>   // maps implementation (includes 'PSCTrace.h')
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr int
+   num_record_threads = 4 ,      // threads used by 'record'
+   num_record_caps    = 256 ,    // caps evaluated by each thread
+   samples_per_cap    = 256 ,    // 'eval_map' calls for each cap
+   ini_repeats        = 16 ;     // default repetitions of each replayed evaluation
+
+const char * const kind_names[] = { "initialize", "Ap_inverse", "Ar_inverse" } ;
+const char * const case_names[] = { "ellipse only", "ellipse+lune", "lune only" } ;
+
+double sink = 0.0 ;
+
+// --------------------------------------------------------------------------
+// the work of one thread in 'record': random caps (the same for float and
+// double), both maps, evaluated with the 'Tracing' policy (returns a checksum)
+
+template< class T >
+double RecordCaps( const int index )
+{
+   std::mt19937 gen( 4321 + index );
+   std::uniform_real_distribution<double> dist( 0.0, 1.0 );
+   PSCMaps<T,MathStd,Tracing> maps ;
+   double checksum = 0.0 ;
+
+   for( int c = 0 ; c < num_record_caps ; c++ )
+   {
+      const double alpha  = 0.05 + 1.45*dist( gen ),
+                   beta   = ( 2.0*dist( gen ) - 1.0 )*0.5*M_PI ;
+      const bool   radial = ( c % 2 ) == 0 ;
+
+      maps.initialize( T(alpha), T(beta), radial );
+      if ( maps.is_invisible() )
+         continue ;
+      T x, y, sum = T(0.0) ;
+      for( int i = 0 ; i < samples_per_cap ; i++ )
+      {
+         maps.eval_map( T(dist( gen )), T(dist( gen )), x, y );
+         sum += x + y ;
+      }
+      checksum += double( sum );
+   }
+   return checksum ;
+}
+// --------------------------------------------------------------------------
+// usage: record file [min_time_ns]
+
+int Record( const string & file_name, const uint32_t min_time_ns )
+{
+   set_trace_min_time( min_time_ns );
+   clear_trace();
+
+   vector<thread> threads ;
+   vector<double> checksums( num_record_threads, 0.0 );
+   for( int i = 0 ; i < num_record_threads ; i++ )
+      threads.push_back( thread( [i,&checksums]()
+      {
+         checksums[i] = RecordCaps<float>( i ) + RecordCaps<double>( i );
+      }));
+   for( int i = 0 ; i < num_record_threads ; i++ )
+   {
+      threads[i].join();
+      sink += checksums[i] ;
+   }
+
+   const vector<TraceRecord> records = collect_trace();
+   if ( ! write_trace_file( file_name, records ) )
+   {
+      cerr << "cannot write the trace file '" << file_name << "'" << endl ;
+      return 1 ;
+   }
+   cout << records.size() << " records (threshold " << min_time_ns << " ns, " << num_record_threads
+        << " threads) written to '" << file_name << "'" << endl
+        << "(checksum " << sink << ")" << endl ;
+   return 0 ;
+}
+// --------------------------------------------------------------------------
+// usage: dump file
+
+int Dump( const vector<TraceRecord> & records )
+{
+   cout << "  " << setw(4) << "thr" << setw(12) << "kind" << setw(14) << "case" << setw(9) << "map"
+        << setw(7) << "type" << setw(9) << "alpha" << setw(9) << "beta" << setw(9) << "s"
+        << setw(9) << "t" << setw(9) << "area" << setw(7) << "iters" << setw(11) << "residual"
+        << setw(10) << "time ns" << "  flags" << endl ;
+
+   for( const TraceRecord & r : records )
+   {
+      cout << "  " << setw(4) << r.thread << setw(12) << kind_names[r.kind] << setw(14) << case_names[r.cap_case()]
+           << setw(9) << ( r.is_radial() ? "radial" : "parallel" ) << setw(7) << ( r.is_double() ? "double" : "float" )
+           << fixed << setprecision(4) << setw(9) << r.alpha << setw(9) << r.beta << setw(9) << r.s
+           << setw(9) << r.t << setw(9) << r.area << setw(7) << r.iterations
+           << scientific << setprecision(2) << setw(11) << r.residual << defaultfloat
+           << setw(10) << r.time_ns << "  "
+           << ( r.is_converged() ? "" : "not-converged " )
+           << ( ( r.flags & trace_parabola ) ? "parabola " : "" )
+           << ( ( r.flags & trace_forced ) ? "forced" : "" ) << endl ;
+   }
+   cout << records.size() << " records" << endl ;
+   return 0 ;
+}
+// --------------------------------------------------------------------------
+// replays one record: initializes the maps as recorded (with 'trace' set, so
+// all the evaluations are recorded), and repeats the evaluation, from (s,t)
+// when it was called from 'eval_map'. Writes in 'result' the record of the
+// last repetition, with the fastest time, and returns false when the replay
+// wrote no records (it took another path, e.g. no inversion is done now)
+
+template< class T >
+bool ReplayRecord( const TraceRecord & rec, const int repeats, TraceRecord & result )
+{
+   PSCMaps<T,MathStd,Tracing> maps ;
+   const InversionConfig<T>   config( T(rec.tolerance), int( rec.max_iters ), true );
+
+   maps.initialize( T(rec.alpha), T(rec.beta), rec.is_radial(), config );
+   clear_trace();
+
+   for( int i = 0 ; i < repeats ; i++ )
+   {
+      if ( rec.kind == trace_initialize )
+         maps.initialize( T(rec.alpha), T(rec.beta), rec.is_radial(), config );
+      else if ( ! std::isnan( rec.s ) )
+      {
+         T x, y ;
+         maps.eval_map( T(rec.s), T(rec.t), x, y );
+         sink += double( x + y );
+      }
+      else
+      {
+         const T area = T(rec.area)*T(0.5)*maps.get_area() ;
+         sink += double( rec.kind == trace_Ar_inverse ? maps.eval_Ar_inverse( area ) : maps.eval_Ap_inverse( area ) );
+      }
+   }
+
+   const vector<TraceRecord> replayed = collect_trace();
+   if ( replayed.empty() )
+      return false ;
+   result = replayed.back() ;
+   for( const TraceRecord & r : replayed )
+      result.time_ns = std::min( result.time_ns, r.time_ns );
+   return true ;
+}
+// --------------------------------------------------------------------------
+// usage: replay file [repeats]
+
+int Replay( const vector<TraceRecord> & records, const int repeats )
+{
+   size_t num_same = 0, num_replayed = 0 ;
+   double rec_time = 0.0, rep_time = 0.0 ;
+
+   cout << "  " << setw(12) << "kind" << setw(14) << "case" << setw(9) << "map" << setw(7) << "type"
+        << setw(13) << "iterations" << setw(21) << "time ns (fastest)" << endl ;
+
+   for( const TraceRecord & rec : records )
+   {
+      cout << "  " << setw(12) << kind_names[rec.kind] << setw(14) << case_names[rec.cap_case()]
+           << setw(9) << ( rec.is_radial() ? "radial" : "parallel" ) << setw(7) << ( rec.is_double() ? "double" : "float" ) ;
+
+      TraceRecord rep ;
+      const bool  replayed = rec.is_double() ? ReplayRecord<double>( rec, repeats, rep )
+                                             : ReplayRecord<float>( rec, repeats, rep );
+      if ( ! replayed )
+      {
+         cout << setw(6) << rec.iterations << " -> " << setw(3) << "-"
+              << setw(10) << rec.time_ns << " -> " << setw(7) << "-" << "   (not reproduced)" << endl ;
+         continue ;
+      }
+      const bool same = rep.iterations == rec.iterations && rep.is_converged() == rec.is_converged() ;
+      num_replayed++ ;
+      if ( same )
+         num_same++ ;
+      rec_time += double( rec.time_ns );
+      rep_time += double( rep.time_ns );
+
+      cout << setw(6) << rec.iterations << " -> " << setw(3) << rep.iterations
+           << setw(10) << rec.time_ns << " -> " << setw(7) << rep.time_ns
+           << ( same ? "" : "   (different iterations)" ) << endl ;
+   }
+
+   cout << endl << records.size() << " records replayed " << repeats << " times each, "
+        << num_replayed << " reproduced, " << num_same << " with the recorded iterations" << endl ;
+   if ( num_replayed > 0 )
+      cout << "mean time (reproduced records): recorded " << fixed << setprecision(1) << rec_time/double( num_replayed )
+           << " ns, replayed (fastest) " << rep_time/double( num_replayed ) << " ns" << defaultfloat << endl ;
+   return 0 ;
+}
+// --------------------------------------------------------------------------
+// usage: trace_exe record file [min_time_ns]
+//        trace_exe dump file
+//        trace_exe replay file [repeats]
+
+int main( int argc, char *argv[] )
+{
+   const string mode = ( argc > 1 ) ? argv[1] : "" ;
+   if ( argc < 3 || 4 < argc || ( mode != "record" && mode != "dump" && mode != "replay" ) )
+   {
+      cerr << "usage: " << argv[0] << " record file [min_time_ns]" << endl
+           << "       " << argv[0] << " dump file" << endl
+           << "       " << argv[0] << " replay file [repeats]" << endl ;
+      return 1 ;
+   }
+   const string file_name = argv[2] ;
+
+   if ( mode == "record" )
+      return Record( file_name, ( argc == 4 ) ? uint32_t( atol( argv[3] ) ) : ini_trace_min_time_ns );
+
+   vector<TraceRecord> records ;
+   string              error ;
+   if ( ! read_trace_file( file_name, records, error ) )
+   {
+      cerr << error << endl ;
+      return 1 ;
+   }
+   if ( mode == "dump" )
+      return Dump( records );
+
+   const int exit_code = Replay( records, ( argc == 4 ) ? std::max( 1, atoi( argv[3] ) ) : ini_repeats );
+   cout << "(checksum " << sink << ")" << endl ;
+   return exit_code ;
+}
@@ -0,0 +1,258 @@
+// *********************************************************************
+// **
+// ** Projected Spherical Cap Maps
+// ** Precision/speed tuning of the inversion settings (against a long double reference)
+// **
+// ** Copyright (C) 2018 Carlos Ureña and Iliyan Georgiev
+// **
+// ** Licensed under the Apache License, Version 2.0 (the "License");
+// ** you may not use this file except in compliance with the License.
+// ** You may obtain a copy of the License at
+// **
+// **    http://www.apache.org/licenses/LICENSE-2.0
+// **
+// ** Unless required by applicable law or agreed to in writing, software
+// ** distributed under the License is distributed on an "AS IS" BASIS,
+// ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// ** See the License for the specific language governing permissions and
+// ** limitations under the License.
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <sstream>
+
+#include <PSCMaps.h>       // maps implementation
+#include <PSCSequences.h>  // (s,t) sequences
+
+using namespace PSCM ; // projected spherical cap map namespace (see 'PSCMaps.h')
+using namespace std ;
+
+// --------------------------------------------------------------------------
+// compile-time constants
+
+constexpr int
+   num_alpha        = 8 ,     // number of alpha values in the sweep
+   num_beta         = 9 ,     // number of beta values in the sweep (for each alpha)
+   samples_per_cap  = 256 ,   // (s,t) samples for each cap (Sobol points)
+   num_cap_runs     = 3 ;     // timing runs for each cap (the fastest one is kept)
+constexpr double
+   min_cap_time     = 1e-3 ;  // minimum time (in seconds) of each timing run
+
+// settings for the reference maps (long double, so the errors of double are measured)
+constexpr long double
+   ref_tolerance    = 1e-16L ;
+constexpr int
+   ref_max_iters    = 1000 ;
+
+// --------------------------------------------------------------------------
+// a cap in the sweep, and the (s,t) samples (the same ones for all the caps)
+
+struct TuneCap
+{
+   double alpha, beta ;
+} ;
+
+// --------------------------------------------------------------------------
+// results for one setting (tolerance and max. iterations), for all the caps
+
+struct TuneResult
+{
+   double tolerance ;
+   int    max_iters ;
+   double ns_per_sample ,  // time per sample, in nanoseconds (mean of the time per sample of each cap)
+          max_pos_err ,    // max. and mean error in (x,y) (euclidean distance)
+          mean_pos_err ,
+          max_area_err ,   // max. and mean error in area fraction (|t'-t|, where
+          mean_area_err ;  // t' is the preimage of (x,y) in the reference maps)
+} ;
+
+// --------------------------------------------------------------------------
+// the caps in the sweep: alpha in [0.05,1.5], beta in [-alpha,pi/2]
+// (the invisible caps are not included)
+
+vector<TuneCap> SweepCaps()
+{
+   vector<TuneCap> caps ;
+   for( int i = 0 ; i < num_alpha ; i++ )
+   {
+      const double alpha = 0.05 + 1.45*double( i )/double( num_alpha-1 );
+      for( int j = 0 ; j < num_beta ; j++ )
+      {
+         const double f = double( j+1 )/double( num_beta+1 ); // beta is never exactly -alpha
+         caps.push_back( TuneCap{ alpha, -alpha + f*( 0.5*M_PI + alpha ) } );
+      }
+   }
+   return caps ;
+}
+// --------------------------------------------------------------------------
+// evaluates all the settings for 'T' and one map, and returns their results
+
+template< class T >
+vector<TuneResult> TuneType( const bool use_radial, const vector<TuneCap> & caps,
+                             const vector<double> & tolerances, const vector<int> & iters )
+{
+   typedef long double LT ;
+   constexpr size_t n = samples_per_cap ;
+
+   // the (s,t) samples, exactly representable in 'T'
+   vector<T> s( n ), t( n ), x( n ), y( n );
+   const SobolSequence<T> seq( 1234 );
+   seq.generate( 0, n, s.data(), t.data() );
+
+   // reference positions, for each cap (initialized with the same angles as 'T' maps)
+   vector<LT> x_ref( caps.size()*n ), y_ref( caps.size()*n ), s_ref( n ), t_ref( n );
+   for( size_t i = 0 ; i < n ; i++ )
+   {
+      s_ref[i] = LT( s[i] );
+      t_ref[i] = LT( t[i] );
+   }
+   PSCMaps<LT> ref ;
+   for( size_t c = 0 ; c < caps.size() ; c++ )
+   {
+      ref.initialize( LT( T( caps[c].alpha ) ), LT( T( caps[c].beta ) ), use_radial,
+                      InversionConfig<LT>( ref_tolerance, ref_max_iters ) );
+      ref.eval_map_batch( s_ref.data(), t_ref.data(), &x_ref[c*n], &y_ref[c*n], n );
+   }
+
+   vector<TuneResult> results ;
+   PSCMaps<T>         pscm ;
+
+   for( const double tol : tolerances )
+   for( const int max_iters : iters )
+   {
+      TuneResult r = { tol, max_iters, 0.0, 0.0, 0.0, 0.0, 0.0 } ;
+
+      for( size_t c = 0 ; c < caps.size() ; c++ )
+      {
+         pscm.initialize( T( caps[c].alpha ), T( caps[c].beta ), use_radial,
+                          InversionConfig<T>( T( tol ), max_iters ) );
+
+         // time the batch (repeated until 'min_cap_time' has elapsed, in each
+         // run). The time per sample is averaged over the caps (not over all the
+         // samples), so the fast caps, which are repeated more times, do not
+         // dominate it
+         using clock = std::chrono::steady_clock ;
+         double cap_ns = std::numeric_limits<double>::max() ;
+         for( int run = 0 ; run < num_cap_runs ; run++ )
+         {
+            const auto start = clock::now();
+            double     elapsed = 0.0 ;
+            size_t     num_reps = 0 ;
+            do
+            {
+               pscm.eval_map_batch( s.data(), t.data(), x.data(), y.data(), n );
+               num_reps++ ;
+               elapsed = std::chrono::duration<double>( clock::now() - start ).count();
+            }
+            while ( elapsed < min_cap_time );
+            cap_ns = std::min( cap_ns, 1e9*elapsed/double( num_reps*n ) );
+         }
+         r.ns_per_sample += cap_ns ;
+
+         // errors w.r.t. the reference: position, and area fraction of the preimage
+         ref.initialize( LT( T( caps[c].alpha ) ), LT( T( caps[c].beta ) ), use_radial,
+                         InversionConfig<LT>( ref_tolerance, ref_max_iters ) );
+         for( size_t i = 0 ; i < n ; i++ )
+         {
+            LT s_pre, t_pre ;
+            ref.inverse_map( LT( x[i] ), LT( y[i] ), s_pre, t_pre );
+            const double pos_err  = double( std::hypot( LT( x[i] ) - x_ref[c*n+i], LT( y[i] ) - y_ref[c*n+i] ) ),
+                         area_err = double( std::abs( t_pre - t_ref[i] ) );
+            r.max_pos_err    = std::max( r.max_pos_err, pos_err );
+            r.mean_pos_err  += pos_err ;
+            r.max_area_err   = std::max( r.max_area_err, area_err );
+            r.mean_area_err += area_err ;
+         }
+      }
+      r.ns_per_sample /= double( caps.size() );
+      r.mean_pos_err  /= double( caps.size()*n );
+      r.mean_area_err /= double( caps.size()*n );
+      results.push_back( r );
+   }
+   return results ;
+}
+// --------------------------------------------------------------------------
+// prints the results for 'T' and one map, and the recommended setting: the
+// fastest one whose max. area error is below 'target' (when 'target' is 0, or
+// it is below the smallest max. area error of all settings, so it cannot be
+// met, the bound is twice that smallest error, and a message is printed)
+
+template< class T >
+void Tune( const char * type_name, const bool use_radial, const vector<TuneCap> & caps,
+           const vector<double> & tolerances, const vector<int> & iters, const double target,
+           vector<string> & recommended )
+{
+   const vector<TuneResult> results = TuneType<T>( use_radial, caps, tolerances, iters );
+
+   cout << endl << type_name << ", " << ( use_radial ? "radial" : "parallel" ) << " map:" << endl
+        << endl
+        << "   " << setw(10) << "tolerance" << setw(7) << "iters" << setw(11) << "ns/sample"
+        << setw(11) << "max.pos." << setw(11) << "mean pos." << setw(11) << "max.area" << setw(11) << "mean area" << endl ;
+
+   double best_err = std::numeric_limits<double>::max() ;
+   for( const TuneResult & r : results )
+   {
+      best_err = std::min( best_err, r.max_area_err );
+      cout << "   " << scientific << setprecision(0) << setw(10) << r.tolerance
+           << setw(7) << r.max_iters << fixed << setprecision(1) << setw(11) << r.ns_per_sample
+           << scientific << setprecision(1) << setw(11) << r.max_pos_err << setw(11) << r.mean_pos_err
+           << setw(11) << r.max_area_err << setw(11) << r.mean_area_err << defaultfloat << endl ;
+   }
+
+   const bool   target_met = target > 0.0 && best_err <= target ;
+   const double bound      = target_met ? target : 2.0*best_err ;
+   if ( target > 0.0 && ! target_met )
+      cout << endl << "   the target max. area error " << scientific << setprecision(1) << target
+           << " is not reached by any setting (the smallest is " << best_err << "), using "
+           << bound << " instead" << defaultfloat << endl ;
+
+   const TuneResult * best = nullptr ;
+   for( const TuneResult & r : results )
+      if ( r.max_area_err <= bound && ( best == nullptr || r.ns_per_sample < best->ns_per_sample ) )
+         best = &r ;
+
+   std::ostringstream line ;
+   line << "   " << setw(7) << left << type_name << setw(9) << ( use_radial ? "radial" : "parallel" ) << right
+        << "InversionConfig<" << type_name << ">( " << scientific << setprecision(0) << best->tolerance
+        << ", " << best->max_iters << " )   // " << fixed << setprecision(1) << best->ns_per_sample
+        << " ns/sample, max. area error " << scientific << setprecision(1) << best->max_area_err
+        << ", max. position error " << best->max_pos_err
+        << ( target > 0.0 && ! target_met ? " (target not reached)" : "" ) ;
+   recommended.push_back( line.str() );
+}
+// --------------------------------------------------------------------------
+// usage: tune_exe [target]
+// (target: max. error in area fraction wanted, 0 or none: the best achievable)
+
+int main( int argc, char *argv[] )
+{
+   const double target = ( argc > 1 ) ? atof( argv[1] ) : 0.0 ;
+   const vector<TuneCap> caps = SweepCaps();
+
+   cout << "inversion settings sweep: " << caps.size() << " caps (alpha in [0.05,1.5], beta in [-alpha,pi/2]), "
+        << samples_per_cap << " Sobol (s,t) samples each," << endl
+        << "errors w.r.t. long double maps with tolerance " << double( ref_tolerance ) << endl
+        << "(max. and mean errors in the map position, and in the area fraction of the preimage)" << endl ;
+
+   vector<string> recommended ;
+   for( const bool use_radial : { true, false } )
+   {
+      Tune<float> ( "float", use_radial, caps, { 1e-2, 1e-3, 1e-4, 1e-5, 1e-6 },
+                    { 2, 4, 8, 20 }, target, recommended );
+      Tune<double>( "double", use_radial, caps, { 1e-3, 1e-4, 1e-6, 1e-8, 1e-10, 1e-12 },
+                    { 2, 4, 8, 20, 40 }, target, recommended );
+   }
+
+   cout << endl << "recommended settings (the fastest with max. area error below "
+        << ( target > 0.0 ? "the target, or " : "" ) << "twice the smallest one):" << endl
+        << endl ;
+   for( const string & line : recommended )
+      cout << line << endl ;
+   return 0 ;
+}